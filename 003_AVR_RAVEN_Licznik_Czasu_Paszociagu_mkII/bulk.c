@@ -0,0 +1,244 @@
+/*
+ * bulk.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Sliding window bulk transfer with CRC-16 and selective retransmit,
+ *      see bulk.h for the frame layout.
+ */
+
+#include <string.h>
+#include <stdbool.h>
+#include <util/crc16.h>
+#include "bulk.h"
+#include "uart.h"
+#include "main.h"
+#include "swtimer.h"
+
+/**
+ *  \addtogroup lcd
+ *  \{
+ */
+
+#define BULK_FREE    (0)     /**< Slot not in use. */
+#define BULK_QUEUED  (1)     /**< Block waiting for room in txbuf. */
+#define BULK_SENT    (2)     /**< Block sent, waiting for its ack. */
+#define BULK_ACKED   (3)     /**< Block acked, but an older one is still missing. */
+
+/** window slot, holds the frame payload ready to send */
+typedef struct {
+	uint8_t state;
+	/** already resent for a gap in the acks */
+	uint8_t resent;
+	uint8_t length;
+	uint8_t buf[BULK_DATA_SIZE + 3];
+} t_bulk_slot;
+
+t_bulk_stats bulk_stats;
+
+static t_bulk_slot bulk_window[BULK_WINDOW];
+/** oldest block not acked yet */
+static uint8_t bulk_base;
+/** sequence number of the next new block */
+static uint8_t bulk_next;
+/** runs while blocks are in flight, restarted whenever the window makes progress */
+static t_swtimer bulk_timer;
+
+#define BULK_SLOT(seq) (&bulk_window[(seq) & (BULK_WINDOW - 1)])
+
+/*---------------------------------------------------------------------------*/
+
+static uint16_t bulk_crc(const uint8_t *data, uint8_t length) {
+	uint16_t crc = 0xFFFF;
+
+	while (length--) {
+		crc = _crc_ccitt_update(crc, *data++);
+	}
+	return crc;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Start a new transfer, forgetting any blocks still in flight.
+ */
+void bulk_start(void) {
+	memset(bulk_window, 0, sizeof(bulk_window));
+	memset(&bulk_stats, 0, sizeof(bulk_stats));
+	bulk_base = bulk_next = 0;
+	swtimer_stop(&bulk_timer);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief No ack for BULK_TIMEOUT, send the whole window again.
+ */
+static void bulk_timeout(void) {
+	t_bulk_slot *slot;
+	uint8_t seq;
+
+	for (seq = bulk_base; seq != bulk_next; seq++) {
+		slot = BULK_SLOT(seq);
+		if (slot->state == BULK_SENT) {
+			slot->state = BULK_QUEUED;
+			bulk_stats.retries++;
+		}
+		slot->resent = false;
+	}
+	bulk_poll();
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief The window made progress, time the next ack from now.
+ */
+static void bulk_restart_timer(void) {
+	swtimer_start(&bulk_timer, bulk_timeout, SWTIMER_MS(BULK_TIMEOUT), SWTIMER_MS(BULK_TIMEOUT));
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Add the next block to the window and send it if txbuf has room.
+ *
+ *   \param data Block to send, copied into the window.
+ *   \param length Block length, at most BULK_DATA_SIZE. 0 ends the transfer.
+ *
+ *   \retval true The block was taken.
+ *   \retval false The window is full, call bulk_poll() and try again.
+ */
+uint8_t bulk_send(const uint8_t *data, uint8_t length) {
+	t_bulk_slot *slot;
+	uint16_t crc;
+
+	if (length > BULK_DATA_SIZE || (uint8_t) (bulk_next - bulk_base) >= BULK_WINDOW) {
+		return false;
+	}
+
+	slot = BULK_SLOT(bulk_next);
+	slot->buf[0] = bulk_next;
+	memcpy(&slot->buf[1], data, length);
+	crc = bulk_crc(slot->buf, length + 1);
+	slot->buf[length + 1] = crc & 0xff;
+	slot->buf[length + 2] = crc >> 8;
+	slot->length = length + 3;
+	slot->resent = false;
+	slot->state = BULK_QUEUED;
+
+	if (bulk_next == bulk_base) {
+		bulk_restart_timer();
+	}
+	bulk_next++;
+	bulk_stats.blocks++;
+
+	bulk_poll();
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Send queued blocks in sequence order. Call from a task while a
+ *   transfer is running, txbuf may not have had room for all of them.
+ */
+void bulk_poll(void) {
+	t_bulk_slot *slot;
+	uint8_t seq;
+
+	for (seq = bulk_base; seq != bulk_next; seq++) {
+		slot = BULK_SLOT(seq);
+		if (slot->state == BULK_QUEUED) {
+			if (!uart_queue_frame(SEND_BULK_DATA, slot->length, slot->buf)) {
+				/* txbuf full, keep the order and try again later */
+				break;
+			}
+			slot->state = BULK_SENT;
+		}
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Check for the end of a transfer.
+ *
+ *   \return True once every block sent has been acked.
+ */
+uint8_t bulk_done(void) {
+	return bulk_base == bulk_next;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Handle a REPORT_BULK_ACK frame from the 1284p.
+ *
+ *   \param payload base, bitmap, crc16.
+ *   \param length Payload length.
+ */
+void bulk_ack(const uint8_t *payload, uint8_t length) {
+	t_bulk_slot *slot;
+	uint8_t base;
+	uint8_t seq;
+	uint8_t highest;
+	uint8_t i;
+
+	if (length != 4 || bulk_crc(payload, 2) != (payload[2] | (payload[3] << 8))) {
+		bulk_stats.bad_acks++;
+		return;
+	}
+
+	/* Ignore acks from an old window or for blocks never sent */
+	base = payload[0];
+	if ((uint8_t) (base - bulk_base) > (uint8_t) (bulk_next - bulk_base)) {
+		return;
+	}
+
+	/* Cumulative part, everything before base has arrived */
+	if (base != bulk_base) {
+		if (base == bulk_next) {
+			swtimer_stop(&bulk_timer);
+		} else {
+			bulk_restart_timer();
+		}
+	}
+	while (bulk_base != base) {
+		BULK_SLOT(bulk_base)->state = BULK_FREE;
+		bulk_base++;
+	}
+
+	/* Selective part, blocks after base that have arrived */
+	highest = base;
+	for (i = 0; i < BULK_WINDOW - 1; i++) {
+		seq = base + 1 + i;
+		if (seq == bulk_next) {
+			break;
+		}
+		if (payload[1] & (1 << i)) {
+			BULK_SLOT(seq)->state = BULK_ACKED;
+			highest = seq;
+		}
+	}
+
+	/* Anything missing below the highest block acked got lost, send it again once */
+	for (seq = bulk_base; seq != highest; seq++) {
+		slot = BULK_SLOT(seq);
+		if (slot->state == BULK_SENT && !slot->resent) {
+			slot->state = BULK_QUEUED;
+			slot->resent = true;
+			bulk_stats.retries++;
+		}
+	}
+
+	bulk_poll();
+}
+
+/** \}   */
@@ -0,0 +1,54 @@
+/*
+ * bulk.h
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Reliable bulk transfer to the ATmega1284p over the binary frame link.
+ *
+ *      Every block travels in a SEND_BULK_DATA frame with the payload
+ *      seq, data[0..BULK_DATA_SIZE], crc16 (low byte first). The CRC is
+ *      CRC-CCITT, initial value 0xFFFF, over seq and data. An empty block ends
+ *      the transfer.
+ *
+ *      The receiver answers with REPORT_BULK_ACK frames carrying
+ *      base, bitmap, crc16 (over base and bitmap): every block before base has
+ *      arrived, and bit n of bitmap set means block base+1+n has arrived too.
+ *      Blocks the receiver reports as missing behind a later block are sent
+ *      again straight away; a window that makes no progress for BULK_TIMEOUT
+ *      ms is sent again in full.
+ */
+
+#ifndef BULK_H
+#define BULK_H
+
+#include <stdint.h>
+
+#define BULK_WINDOW     (4)     /**< Blocks in flight, power of two, at most 9. */
+#define BULK_DATA_SIZE  (64)    /**< Largest block, the frame must fit in txbuf. */
+#define BULK_TIMEOUT    (500)   /**< ms without an ack before the window is resent. */
+
+/** bulk transfer counters */
+typedef struct {
+	/** blocks sent for the first time */
+	uint16_t blocks;
+	/** blocks sent again */
+	uint16_t retries;
+	/** acks dropped for a bad CRC */
+	uint16_t bad_acks;
+} t_bulk_stats;
+
+extern t_bulk_stats bulk_stats;
+
+void bulk_start(void);
+uint8_t bulk_send(const uint8_t *data, uint8_t length);
+void bulk_poll(void);
+uint8_t bulk_done(void);
+void bulk_ack(const uint8_t *payload, uint8_t length);
+
+#endif /* BULK_H */
@@ -0,0 +1,190 @@
+/*
+ * calendar.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Calendar date and time checkpoints, see calendar.h.
+ */
+
+#include <string.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "calendar.h"
+#include "timer.h"
+#include "rtc.h"
+#include "flashrec.h"
+#include "swtimer.h"
+
+/**
+ *  \addtogroup lcd
+ *  \{
+ */
+
+static const uint8_t calendar_month_days[12] PROGMEM = {
+	31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+};
+
+static t_swtimer calendar_timer;
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Days in a month.
+ *
+ *   \param month 1-12.
+ *   \param year Years since 2000.
+ */
+uint8_t calendar_days_in_month(uint8_t month, uint8_t year) {
+	if (month == 2 && !(year & 3)) {
+		return 29;
+	}
+	return pgm_read_byte(&calendar_month_days[month - 1]);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Turn RTC over to the next day, from the overflow interrupt at
+ *   midnight.
+ */
+void calendar_next_day(void) {
+	if (++RTC.wday >= 7) {
+		RTC.wday = 0;
+	}
+	if (++RTC.day > calendar_days_in_month(RTC.month, RTC.year)) {
+		RTC.day = 1;
+		if (++RTC.month > 12) {
+			RTC.month = 1;
+			if (++RTC.year > CALENDAR_LAST_YEAR) {
+				RTC.year = 0;
+			}
+		}
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief The date and time of RTC as seconds since 2000-01-01 00:00.
+ */
+uint32_t calendar_epoch(void) {
+	t_time now;
+	uint16_t days;
+	uint8_t month;
+
+	rtc_now(&now);
+
+	/* 2000 was a leap year, so are the years before year + 3 / 4 */
+	days = now.year * 365 + (now.year + 3) / 4;
+	for (month = 1; month < now.month; month++) {
+		days += calendar_days_in_month(month, now.year);
+	}
+	days += now.day - 1;
+
+	return ((uint32_t) days * 24 + now.hour) * 3600UL + (uint16_t) now.min * 60 + now.sec;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Set the date and time of RTC. total_sec carries on, so run times
+ *   and timestamps do not jump.
+ *
+ *   \param epoch Seconds since 2000-01-01 00:00.
+ *   \param flags New TIME_xxx flags.
+ *
+ *   \return false if epoch is past 2099, RTC is left as it was.
+ */
+bool calendar_set(uint32_t epoch, uint8_t flags) {
+	uint16_t days;
+	uint16_t rest;
+	uint8_t year = 0;
+	uint8_t month = 1;
+	uint8_t wday;
+	uint16_t length;
+
+	if (epoch >= CALENDAR_EPOCH_END) {
+		return false;
+	}
+
+	days = epoch / 86400UL;
+	/* 2000-01-01 was a Saturday */
+	wday = (days + 6) % 7;
+	while (days >= (length = (year & 3) ? 365 : 366)) {
+		days -= length;
+		year++;
+	}
+	while (days >= (length = calendar_days_in_month(month, year))) {
+		days -= length;
+		month++;
+	}
+	rest = (epoch % 86400UL) / 60;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		RTC.sec = epoch % 60;
+		RTC.min = rest % 60;
+		RTC.hour = rest / 60;
+		RTC.day = days + 1;
+		RTC.month = month;
+		RTC.year = year;
+		RTC.wday = wday;
+		RTC.flags = flags;
+	}
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Store the date and time in the FLASH_REC_TIME record. Runs from
+ *   calendar_timer, and when the time is set.
+ */
+void calendar_checkpoint(void) {
+	t_calendar_checkpoint checkpoint;
+
+	checkpoint.epoch = calendar_epoch();
+	flashRecWrite(FLASH_REC_TIME, &checkpoint, sizeof(checkpoint));
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Carry on from the last checkpoint, and start checkpointing. Call
+ *   after flashInit().
+ *
+ *   Without a checkpoint the clock stays at 2000-01-01, uncertain as well.
+ */
+void calendar_init(void) {
+	t_calendar_checkpoint checkpoint;
+
+	if (flashRecRead(FLASH_REC_TIME, &checkpoint, sizeof(checkpoint)) == 0) {
+		calendar_set(checkpoint.epoch, TIME_UNCERTAIN);
+	}
+	swtimer_start(&calendar_timer, calendar_checkpoint,
+			SWTIMER_MS(CALENDAR_CHECKPOINT_PERIOD), SWTIMER_MS(CALENDAR_CHECKPOINT_PERIOD));
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief REPORT_TIME handler, the 1284p sets the date and time.
+ *
+ *   \param payload uint32 seconds since 2000-01-01 00:00, local time.
+ *   \param length Payload length, 4.
+ */
+void calendar_report_time(const uint8_t *payload, uint8_t length) {
+	uint32_t epoch;
+
+	memcpy(&epoch, payload, sizeof(epoch));
+	if (calendar_set(epoch, 0)) {
+		calendar_checkpoint();
+	}
+}
+
+/** \}   */
@@ -0,0 +1,57 @@
+/*
+ * calendar.h
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Calendar date of the RTC and keeping the time across power cuts.
+ *
+ *      RTC carries the date next to the time of day. The overflow interrupt
+ *      turns it over at midnight with calendar_next_day(). Years run from
+ *      2000 to 2099, so every fourth year is a leap year. A date and time is
+ *      also a compact uint32 of seconds since 2000-01-01 00:00, see
+ *      calendar_epoch(). That is local time, as shown on the LCD.
+ *
+ *      The time is checkpointed in the FLASH_REC_TIME record every
+ *      CALENDAR_CHECKPOINT_PERIOD. At boot calendar_init() carries on from
+ *      the last checkpoint with TIME_UNCERTAIN set, as the time the power was
+ *      off is not known. The 1284p clears it by setting the time with
+ *      REPORT_TIME. Binary telemetry samples carry TELEMETRY_TIME_UNCERTAIN
+ *      meanwhile. The clock page sets the hour and minute by hand through
+ *      calendar_set() as well, and checkpoints once it is left. That leaves
+ *      the flag as it was, because the date is still unknown.
+ */
+
+#ifndef CALENDAR_H
+#define CALENDAR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Last year, counted from 2000 */
+#define CALENDAR_LAST_YEAR          (99)
+/** Seconds from 2000-01-01 to 2100-01-01 */
+#define CALENDAR_EPOCH_END          (36525UL * 86400UL)
+/** ms between checkpoints, at most 2047 s for a software timer */
+#define CALENDAR_CHECKPOINT_PERIOD  (15UL * 60UL * 1000UL)
+
+/** \brief FLASH_REC_TIME record */
+typedef struct {
+	/** calendar_epoch() at the checkpoint */
+	uint32_t epoch;
+} t_calendar_checkpoint;
+
+uint8_t calendar_days_in_month(uint8_t month, uint8_t year);
+void calendar_next_day(void);
+uint32_t calendar_epoch(void);
+bool calendar_set(uint32_t epoch, uint8_t flags);
+void calendar_checkpoint(void);
+void calendar_init(void);
+void calendar_report_time(const uint8_t *payload, uint8_t length);
+
+#endif /* CALENDAR_H */
@@ -0,0 +1,72 @@
+/*
+ * cobs.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      In-place COBS encoding, see cobs.h.
+ */
+
+#include "cobs.h"
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Encode a block in place. Each 0x00 in the data is replaced by the
+ *   distance to the next one, the first distance goes into buf[0].
+ *
+ *   \param buf Data in buf[1..length], buf[0] is free. Holds the encoded block
+ *   in buf[0..length] on return.
+ *   \param length Data length, at most COBS_MAX_DATA.
+ *
+ *   \return Encoded length, length + 1.
+ */
+uint8_t cobs_encode(uint8_t *buf, uint8_t length) {
+	uint8_t code_pos = 0;
+	uint8_t i;
+
+	for (i = 1; i <= length; i++) {
+		if (buf[i] == 0) {
+			buf[code_pos] = i - code_pos;
+			code_pos = i;
+		}
+	}
+	buf[code_pos] = length + 1 - code_pos;
+
+	return length + 1;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Decode a block in place, the reverse of cobs_encode().
+ *
+ *   \param buf Encoded block, without the 0x00 delimiter. Holds the data in
+ *   buf[1..] on return.
+ *   \param length Encoded length.
+ *
+ *   \return Data length, or 0 if the block is not valid COBS (an empty
+ *   block also decodes to 0).
+ */
+uint8_t cobs_decode(uint8_t *buf, uint8_t length) {
+	uint8_t pos = 0;
+	uint8_t code;
+
+	while (pos < length) {
+		code = buf[pos];
+		if (code == 0 || code > length - pos) {
+			return 0;
+		}
+		if (pos) {
+			/* This code byte stood for a 0x00 in the data */
+			buf[pos] = 0;
+		}
+		pos += code;
+	}
+	return length - 1;
+}
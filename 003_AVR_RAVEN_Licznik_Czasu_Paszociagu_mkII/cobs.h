@@ -0,0 +1,28 @@
+/*
+ * cobs.h
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      In-place Consistent Overhead Byte Stuffing. An encoded block holds no
+ *      0x00 bytes, so 0x00 can delimit frames and a receiver resyncs at the
+ *      next delimiter. Blocks are limited to COBS_MAX_DATA bytes, which keeps
+ *      the overhead at exactly one byte and lets both directions work in place.
+ */
+
+#ifndef COBS_H
+#define COBS_H
+
+#include <stdint.h>
+
+#define COBS_MAX_DATA   (253)   /**< Largest block, every code byte then fits in 1..254. */
+
+uint8_t cobs_encode(uint8_t *buf, uint8_t length);
+uint8_t cobs_decode(uint8_t *buf, uint8_t length);
+
+#endif /* COBS_H */
@@ -0,0 +1,264 @@
+/*
+ * export.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Streams a flashfile to the 1284p, see export.h. The next block is read
+ *      from the dataflash (USART1 in SPI mode) while USART0 interrupts are still
+ *      sending the previous ones, so the link is the only bottleneck.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include "export.h"
+#include "bulk.h"
+#include "uart.h"
+#include "main.h"
+#include "flashfile.h"
+#include "flashlog.h"
+#include "sched.h"
+
+/**
+ *  \addtogroup lcd
+ *  \{
+ */
+
+static uint8_t export_active;
+/** node being read, 0 past the end of the export */
+static uint16_t export_node;
+/** next node, from the header of export_node */
+static uint16_t export_next;
+/** read offset in the data of export_node */
+static uint16_t export_offset;
+/** file bytes from the start of export_node to the end of the file */
+static uint32_t export_left;
+/** last time to export, EXPORT_BY_TIME only */
+static uint32_t export_to;
+static uint8_t export_by_time;
+/** block read ahead of the bulk window */
+static uint8_t export_block[BULK_DATA_SIZE];
+static uint8_t export_block_len;
+static uint8_t export_block_ready;
+/** the empty block ending the transfer has been handed to bulk_send() */
+static uint8_t export_end_sent;
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Get the time of the keyframe a log node starts with.
+ *
+ *   \param node The node to check.
+ *   \param time Returns the keyframe time.
+ *
+ *   \return False if the node does not start with a keyframe.
+ */
+static uint8_t export_node_time(uint16_t node, uint32_t *time) {
+	uint8_t buf[5];
+
+	flashPageRead(buf, node, sizeof(flashNodeHeader_t), sizeof(buf));
+	if (buf[0] != FLASH_LOG_KEYFRAME) {
+		return false;
+	}
+	memcpy(time, &buf[1], sizeof(*time));
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Make a node the current one, reading its header.
+ *
+ *   \param node The node, 0 to end the export.
+ */
+static void export_enter_node(uint16_t node) {
+	flashNodeHeader_t hdr;
+	uint32_t time;
+
+	export_offset = 0;
+	export_node = node;
+	if (!node || !export_left) {
+		export_node = 0;
+		return;
+	}
+
+	/* A time range stops at the first node starting after it */
+	if (export_by_time && export_node_time(node, &time) && time > export_to) {
+		export_node = 0;
+		return;
+	}
+
+	flashPageRead(&hdr, node, 0, sizeof(hdr));
+	export_next = hdr.nextNode;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Leave the current node for the next one.
+ */
+static void export_next_node(void) {
+	export_left = (export_left > FLASH_FILE_NODE_SIZE) ? export_left - FLASH_FILE_NODE_SIZE : 0;
+	export_enter_node(export_next);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Read the next block of the export into export_block. A block never
+ *   crosses a node, so it is a single dataflash read.
+ */
+static void export_fill(void) {
+	uint16_t node_len;
+	uint16_t len;
+
+	if (export_node) {
+		node_len = (export_left < FLASH_FILE_NODE_SIZE) ? export_left : FLASH_FILE_NODE_SIZE;
+		len = node_len - export_offset;
+		if (len > BULK_DATA_SIZE) {
+			len = BULK_DATA_SIZE;
+		}
+		flashPageRead(export_block, export_node, sizeof(flashNodeHeader_t) + export_offset, len);
+		export_offset += len;
+		if (export_offset >= node_len) {
+			export_next_node();
+		}
+		export_block_len = len;
+	} else {
+		/* Empty block ends the transfer */
+		export_block_len = 0;
+	}
+	export_block_ready = true;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Send the SEND_EXPORT_INFO answer.
+ */
+static void export_info(int8_t status, uint32_t size) {
+	uint8_t payload[5];
+
+	payload[0] = status;
+	memcpy(&payload[1], &size, sizeof(size));
+	uart_serial_send_frame(SEND_EXPORT_INFO, sizeof(payload), payload);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Handle a REPORT_EXPORT frame from the 1284p.
+ *
+ *   \param payload EXPORT_BY_NAME and a filename, or EXPORT_BY_TIME and a range.
+ *   \param length Payload length.
+ */
+void export_request(const uint8_t *payload, uint8_t length) {
+	char name[UART_MAX_PAYLOAD];
+	flashFile_t file;
+	uint32_t from;
+	uint32_t time;
+	uint16_t node;
+	uint16_t next;
+
+	if (export_active) {
+		return export_info(EXPORT_BUSY, 0);
+	}
+
+	if (length > 1 && payload[0] == EXPORT_BY_NAME) {
+		memcpy(name, &payload[1], length - 1);
+		name[length - 1] = 0;
+		export_by_time = false;
+	} else if (length == 9 && payload[0] == EXPORT_BY_TIME) {
+		strcpy(name, FLASH_LOG_NAME);
+		memcpy(&from, &payload[1], sizeof(from));
+		memcpy(&export_to, &payload[5], sizeof(export_to));
+		export_by_time = true;
+	} else {
+		return export_info(EXPORT_INVALID, 0);
+	}
+
+	if (flashOpen(name, &file) < 0) {
+		return export_info(EXPORT_NOT_FOUND, 0);
+	}
+
+	export_left = file.size;
+	node = file.startNode;
+	if (export_by_time) {
+		/* Skip nodes that end before the range, i.e. the next one starts before it */
+		while (export_left > FLASH_FILE_NODE_SIZE) {
+			flashPageRead(&next, node, offsetof(flashNodeHeader_t, nextNode), sizeof(next));
+			if (!next || !export_node_time(next, &time) || time > from) {
+				break;
+			}
+			export_left -= FLASH_FILE_NODE_SIZE;
+			node = next;
+		}
+		export_info(EXPORT_OK, EXPORT_SIZE_UNKNOWN);
+	} else {
+		export_info(EXPORT_OK, file.size);
+	}
+
+	bulk_start();
+	export_enter_node(node);
+	export_block_ready = false;
+	export_end_sent = false;
+	export_active = true;
+	export_poll();
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Keep an export going, the EXPORT task. Blocks are read one ahead,
+ *   so the dataflash read for the next block runs while the UART sends. A run
+ *   reads at most one block and posts SCHED_EV_FLASH for the next.
+ */
+void export_poll(void) {
+	uint8_t filled = false;
+
+	if (!export_active) {
+		return;
+	}
+
+	bulk_poll();
+	while (!export_end_sent) {
+		if (!export_block_ready) {
+			if (filled) {
+				/* One dataflash read per run, let the other tasks in */
+				sched_post(SCHED_EV_FLASH);
+				break;
+			}
+			export_fill();
+			filled = true;
+		}
+		if (!bulk_send(export_block, export_block_len)) {
+			/* Window full, the block stays read ahead */
+			break;
+		}
+		export_end_sent = (export_block_len == 0);
+		export_block_ready = false;
+	}
+
+	if (export_end_sent && bulk_done()) {
+		export_active = false;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Check for an export in progress.
+ *
+ *   \return True until the last block has been acked.
+ */
+uint8_t export_busy(void) {
+	return export_active;
+}
+
+/** \}   */
@@ -0,0 +1,45 @@
+/*
+ * export.h
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Export of flashfile contents to the ATmega1284p.
+ *
+ *      The 1284p asks with REPORT_EXPORT, payload either
+ *      EXPORT_BY_NAME, filename or
+ *      EXPORT_BY_TIME, uint32 from, uint32 to (calendar_epoch(), FLASH_LOG_NAME).
+ *      The answer is SEND_EXPORT_INFO with int8 status, uint32 size, followed on
+ *      success by the file contents as a bulk transfer (see bulk.h). A time
+ *      range is exported as the whole log nodes covering it, size is then
+ *      EXPORT_SIZE_UNKNOWN.
+ */
+
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdint.h>
+
+#define EXPORT_BY_NAME      (0)
+#define EXPORT_BY_TIME      (1)
+
+/** \name SEND_EXPORT_INFO status */
+/** \{ */
+#define EXPORT_OK           (0)
+#define EXPORT_NOT_FOUND    (-1)
+#define EXPORT_BUSY         (-2)
+#define EXPORT_INVALID      (-3)
+/** \} */
+
+#define EXPORT_SIZE_UNKNOWN (0xFFFFFFFF)
+
+void export_request(const uint8_t *payload, uint8_t length);
+void export_poll(void);
+uint8_t export_busy(void);
+
+#endif /* EXPORT_H */
@@ -39,6 +39,7 @@
 #include <string.h>
 #include <avr/io.h>
 #include <ctype.h>
+#include <util/delay.h>
 #include "spi.h"
 #include "flashHQ.h"
 
@@ -59,13 +60,54 @@ flashGeometry_t flashGeom[] = {
     { 9,  3, 10, 264, 32768, 1024 }, // 64MB 100000 ID:01000=8                  S: 31 - 8,1016,1024
 };
 
-static uint16_t flashCurrentBufPage = -1;   // track which page is currently loaded
+// Opcodes for each of the internal memory buffers
+typedef struct {
+    uint8_t load;
+    uint8_t read;
+    uint8_t write;
+    uint8_t store;
+    uint8_t eraseStore;
+    uint8_t pageWrite;
+} flashBufOps_t;
+
+static const flashBufOps_t flashBufOps[FLASH_MAX_BUFFERS] = {
+    { FLASH_OP_BUF_LOAD, FLASH_OP_BUF_READ, FLASH_OP_BUF_WRITE,
+      FLASH_OP_BUF_STORE, FLASH_OP_BUF_ERASE_STORE, FLASH_OP_PAGE_WRITE },
+    { FLASH_OP_BUF2_LOAD, FLASH_OP_BUF2_READ, FLASH_OP_BUF2_WRITE,
+      FLASH_OP_BUF2_STORE, FLASH_OP_BUF2_ERASE_STORE, FLASH_OP_PAGE_WRITE2 },
+};
 
-// Used to indicate that the internal memory buffer is currently being used as a write
-// cache.  If a function needs to use the internal buffer then it will flush the buffer
+// The cachePage of a buffer indicates that it is currently being used as a write
+// cache.  If a function needs to use the buffer then it will flush the buffer
 // to this page and set the it back to 0.
-uint16_t flashWriteCachePage = 0;
+static flashBuffer_t flashBuffers[FLASH_MAX_BUFFERS] = {
+    { FLASH_BUF_SYSTEM, -1, 0, 0, 0 },
+    { FLASH_BUF_SYSTEM, -1, 0, 0, 0 },
+};
+static uint8_t flashBufSel = 0;             // buffer used by the buffer operations
+static flashBuffer_t *flashBuf = &flashBuffers[0];
+static uint8_t flashBufClock = 0;
+
+flashBufStats_t flashBufStats;
 int8_t flashId = -1;
+uint8_t flashActivity;
+static bool flashAsleep;
+
+/**
+ * Select the flash for an operation, resuming it from deep power down first.
+ */
+static void flashSelect(void)
+{
+    if (flashAsleep) {
+        pinLow(FLASH_PORT_CS, FLASH_CS);
+        spiUsartTransfer(FLASH_OP_RESUME);
+        pinHigh(FLASH_PORT_CS, FLASH_CS);
+        _delay_us(FLASH_RESUME_US);
+        flashAsleep = false;
+    }
+    flashActivity++;
+    pinLow(FLASH_PORT_CS, FLASH_CS);
+}
 
 /**
  * Return number of flash pages.
@@ -84,11 +126,11 @@ uint16_t flashNumPages(void)
  */
 bool flashFlushCache(uint16_t page)
 {
-    if (flashWriteCachePage && (flashWriteCachePage != page))
+    if (flashBuf->cachePage && (flashBuf->cachePage != page))
     {
-        DPRINTF_P(PSTR("flashFlushCAche(): storing page\n"), flashWriteCachePage);
-        flashBufStore(flashWriteCachePage);
-        flashWriteCachePage = 0;
+        DPRINTF_P(PSTR("flashFlushCAche(): storing page\n"), flashBuf->cachePage);
+        flashBufStore(flashBuf->cachePage);
+        flashBuf->cachePage = 0;
         return true;
     }
 
@@ -96,6 +138,118 @@ bool flashFlushCache(uint16_t page)
 }
 
 
+/**
+ * Select the internal memory buffer used by the following buffer operations.
+ * A file writer keeps its buffer pinned between calls. When every buffer is
+ * pinned the least recently used one is flushed and handed over.
+ * A system operation does not unpin the buffer it takes, it borrows it: the
+ * cached page is flushed and the owner gets it back, loaded and with the page
+ * erased again, on its next select.
+ * @param owner dirPage of the file writing through the buffer, or
+ *        FLASH_BUF_SYSTEM for short map, directory and record updates
+ * @returns the selected buffer
+ */
+uint8_t flashBufSelect(uint16_t owner)
+{
+    uint8_t sel = 0;
+    uint8_t age = 0;
+
+    for (uint8_t ind=0; ind<FLASH_NUM_BUFFERS; ind++) {
+        uint8_t bufAge;
+
+        if ((owner != FLASH_BUF_SYSTEM) && (flashBuffers[ind].owner == owner)) {
+            sel = ind;
+            age = 0xFF;
+            break;
+        }
+
+        // prefer an unpinned buffer, otherwise the least recently used one
+        bufAge = flashBufClock - flashBuffers[ind].lastUse;
+        if (bufAge > 0x7F) {
+            bufAge = 0x7F;
+        }
+        if (flashBuffers[ind].owner == FLASH_BUF_SYSTEM) {
+            bufAge |= 0x80;
+        } else if ((owner == FLASH_BUF_SYSTEM) && (flashBuffers[ind].cachePage == 0)) {
+            // nothing cached (or already lent), free for the system to use
+            bufAge |= 0x80;
+        }
+        if (bufAge >= age) {
+            age = bufAge;
+            sel = ind;
+        }
+    }
+
+    flashBufSel = sel;
+    flashBuf = &flashBuffers[sel];
+    if (flashBuf->owner == FLASH_BUF_SYSTEM) {
+        flashBuf->owner = owner;
+    } else if (owner == FLASH_BUF_SYSTEM) {
+        // lend the buffer, the owner keeps it pinned
+        if (flashBuf->cachePage) {
+            DPRINTF_P(PSTR("flashBufSelect(): lending buffer %d of owner %d\n"), sel, flashBuf->owner);
+            flashBufStats.loans++;
+            flashBuf->reloadPage = flashBuf->cachePage;
+            flashFlushCache(0);
+        }
+    } else if (flashBuf->owner != owner) {
+        DPRINTF_P(PSTR("flashBufSelect(): evicting owner %d from buffer %d\n"), flashBuf->owner, sel);
+        flashBufStats.evictions++;
+        if (flashFlushCache(0)) {
+            flashBufStats.contentionFlushes++;
+        }
+        flashBuf->reloadPage = 0;
+        flashBuf->owner = owner;
+    } else if (flashBuf->reloadPage) {
+        // back from a loan: reload the flushed page and erase it so that the
+        // cache can be stored without an erase again
+        flashBufLoad(flashBuf->reloadPage);
+        flashPageErase(flashBuf->reloadPage);
+        flashBuf->cachePage = flashBuf->reloadPage;
+        flashBuf->reloadPage = 0;
+    }
+    flashBuf->lastUse = ++flashBufClock;
+
+    return sel;
+}
+
+
+/**
+ * Check whether a file writer still has its buffer pinned. A writer that lost
+ * it to another writer must reload and erase its last node before appending.
+ * @param owner dirPage of the file
+ * @returns true if a buffer is pinned to the owner
+ */
+bool flashBufHeld(uint16_t owner)
+{
+    for (uint8_t ind=0; ind<FLASH_NUM_BUFFERS; ind++) {
+        if (flashBuffers[ind].owner == owner) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * Unpin the buffer of a closed file, flushing any cached page.
+ * @param owner dirPage of the file
+ */
+void flashBufRelease(uint16_t owner)
+{
+    for (uint8_t ind=0; ind<FLASH_NUM_BUFFERS; ind++) {
+        if (flashBuffers[ind].owner == owner) {
+            flashBufSel = ind;
+            flashBuf = &flashBuffers[ind];
+            flashFlushCache(0);
+            flashBuf->reloadPage = 0;
+            flashBuf->owner = FLASH_BUF_SYSTEM;
+        }
+    }
+}
+
+
 /**
  * Wait for the flash to be ready
  */
@@ -106,7 +260,7 @@ void flashWaitReady(void)
 #ifdef DEBUG_FLASH
     uint32_t start = millis();
 #endif
-    pinLow(FLASH_PORT_CS, FLASH_CS);
+    flashSelect();
     spiUsartTransfer(FLASH_OP_GET_STATUS);
     while (!((res=spiUsartTransfer(0)) & FLASH_STATUS_BUSY))
     {
@@ -116,6 +270,39 @@ void flashWaitReady(void)
 }
 
 
+/**
+ * Put the flash in deep power down, the next operation resumes it. Skipped
+ * while a buffer holds data not stored yet, as the buffers may not survive.
+ * @retval true the flash is powered down
+ * @retval false a buffer is in use, or there is no flash
+ */
+bool flashPowerDown(void)
+{
+    if (flashAsleep) {
+        return true;
+    }
+    if (flashId < 0) {
+        return false;
+    }
+    for (uint8_t ind=0; ind<FLASH_NUM_BUFFERS; ind++) {
+        if ((flashBuffers[ind].owner != FLASH_BUF_SYSTEM) || flashBuffers[ind].cachePage) {
+            return false;
+        }
+    }
+
+    flashWaitReady();
+    flashSelect();
+    spiUsartTransfer(FLASH_OP_DEEP_POWER_DOWN);
+    pinHigh(FLASH_PORT_CS, FLASH_CS);
+
+    for (uint8_t ind=0; ind<FLASH_NUM_BUFFERS; ind++) {
+        flashBuffers[ind].loadedPage = -1;
+    }
+    flashAsleep = true;
+    return true;
+}
+
+
 /**
  * Erase entire flash
  */
@@ -125,7 +312,7 @@ void flashChipErase(void)
     flashWaitReady();
     DPRINTF_P(PSTR("writing chip erase op\n"));
     DPRINTF_P(PSTR("    %02x %02x %02x %02x\n"), op[0], op[1], op[2], op[3]);
-    pinLow(FLASH_PORT_CS, FLASH_CS);
+    flashSelect();
     spiUsartWrite(op, sizeof(op));
     pinHigh(FLASH_PORT_CS, FLASH_CS);
     DPRINTF_P(PSTR("waiting for erase complete\n"));
@@ -159,7 +346,7 @@ void flashWritePageOp(uint8_t opcode, uint16_t page, uint16_t offset)
 void flashSingleOp(uint8_t op, uint16_t page, uint16_t offset)
 {
     flashWaitReady();
-    pinLow(FLASH_PORT_CS, FLASH_CS);
+    flashSelect();
     flashWritePageOp(op, page, offset);
     pinHigh(FLASH_PORT_CS, FLASH_CS);
 }
@@ -181,7 +368,7 @@ int flashCheckId(void)
 
     DPRINTF_P(PSTR("flashCheckId()\n"));
 
-    pinLow(FLASH_PORT_CS, FLASH_CS);
+    flashSelect();
     spiUsartTransfer(FLASH_OP_READ_DEV_ID);
     spiUsartRead((uint8_t *)&data, sizeof(data));
     pinHigh(FLASH_PORT_CS, FLASH_CS);
@@ -213,6 +400,9 @@ int flashInit(void)
     /*pinMode(FLASH_PORT_CS, FLASH_CS, OUTPUT, false);*/
     pinHigh(FLASH_PORT_CS, FLASH_CS);
 
+    // the flash keeps its power over a reset, it may still be powered down
+    flashAsleep = true;
+
     DPRINTF_P(PSTR("flashInit()\n"));
 
     /*  Check flash identification */
@@ -239,13 +429,13 @@ int flashBufLoad(uint16_t page)
         return -1;
     }
 
-    if (page && (flashWriteCachePage == page))
+    if (page && (flashBuf->cachePage == page))
     {
         // already loaded, cached
         return 0;
     }
 
-    if (flashCurrentBufPage == page)
+    if (flashBuf->loadedPage == page)
     {
         // already loaded, not modified
         return 0;
@@ -253,8 +443,8 @@ int flashBufLoad(uint16_t page)
 
     flashFlushCache(page);
 
-    flashSingleOp(FLASH_OP_BUF_LOAD, page, 0);
-    flashCurrentBufPage = page;
+    flashSingleOp(flashBufOps[flashBufSel].load, page, 0);
+    flashBuf->loadedPage = page;
 
     return 0;
 }
@@ -271,8 +461,8 @@ int flashBufLoad(uint16_t page)
 void flashBufRead(void *datap, uint16_t offset, uint16_t size)
 {
     flashWaitReady();
-    pinLow(FLASH_PORT_CS, FLASH_CS);
-    flashWritePageOp(FLASH_OP_BUF_READ, 0, offset);
+    flashSelect();
+    flashWritePageOp(flashBufOps[flashBufSel].read, 0, offset);
     spiUsartRead((uint8_t *)datap, size);
     pinHigh(FLASH_PORT_CS, FLASH_CS);
 }
@@ -295,7 +485,7 @@ int flashPageRead(void *datap, uint16_t page, uint16_t offset, uint16_t size)
     }
 
     flashWaitReady();
-    pinLow(FLASH_PORT_CS, FLASH_CS);
+    flashSelect();
     flashWritePageOp(FLASH_OP_PAGE_READ, page, offset);
     spiUsartWrite(dummy, sizeof(dummy));   // 4 don't care bytes
     spiUsartRead((uint8_t *)datap, size);
@@ -318,7 +508,7 @@ void flashRawRead(void *datap, uint32_t addr, uint16_t size)
     uint16_t offset = addr - (page*FLASH_PAGE_SIZE);
 
     flashWaitReady();
-    pinLow(FLASH_PORT_CS, FLASH_CS);
+    flashSelect();
     flashWritePageOp(FLASH_OP_READ, page, offset);
     spiUsartRead((uint8_t *)datap, size);
     pinHigh(FLASH_PORT_CS, FLASH_CS);
@@ -338,8 +528,8 @@ int flashBufStore(uint16_t page)
         return -1;
     }
 
-    flashSingleOp(FLASH_OP_BUF_STORE, page, 0);
-    flashCurrentBufPage = page;
+    flashSingleOp(flashBufOps[flashBufSel].store, page, 0);
+    flashBuf->loadedPage = page;
 
     return 0;
 }
@@ -358,8 +548,8 @@ int flashBufEraseStore(uint16_t page)
         return -1;
     }
 
-    flashSingleOp(FLASH_OP_BUF_ERASE_STORE, page, 0);
-    flashCurrentBufPage = page;
+    flashSingleOp(flashBufOps[flashBufSel].eraseStore, page, 0);
+    flashBuf->loadedPage = page;
 
     return 0;
 }
@@ -437,11 +627,11 @@ void flashBufWrite(void *datap, uint16_t offset, uint16_t size)
 {
     if (size) {
         flashWaitReady();
-        pinLow(FLASH_PORT_CS, FLASH_CS);
-        flashWritePageOp(FLASH_OP_BUF_WRITE, 0, offset);
+        flashSelect();
+        flashWritePageOp(flashBufOps[flashBufSel].write, 0, offset);
         spiUsartWrite((uint8_t *)datap, size);
         pinHigh(FLASH_PORT_CS, FLASH_CS);
-        flashCurrentBufPage = -1;
+        flashBuf->loadedPage = -1;
     }
 }
 
@@ -459,13 +649,13 @@ void flashBufFill(void *datap, uint16_t offset, uint16_t size, uint16_t repeat)
     if (size)
     {
         flashWaitReady();
-        pinLow(FLASH_PORT_CS, FLASH_CS);
-        flashWritePageOp(FLASH_OP_BUF_WRITE, 0, offset);
+        flashSelect();
+        flashWritePageOp(flashBufOps[flashBufSel].write, 0, offset);
         while (repeat--) {
             spiUsartWrite((uint8_t *)datap, size);
         }
         pinHigh(FLASH_PORT_CS, FLASH_CS);
-        flashCurrentBufPage = -1;
+        flashBuf->loadedPage = -1;
     }
 }
 
@@ -483,13 +673,13 @@ void flashBufSet(uint8_t value, uint16_t offset, uint16_t size)
     if (size)
     {
         flashWaitReady();
-        pinLow(FLASH_PORT_CS, FLASH_CS);
-        flashWritePageOp(FLASH_OP_BUF_WRITE, 0, offset);
+        flashSelect();
+        flashWritePageOp(flashBufOps[flashBufSel].write, 0, offset);
         while (size--) {
             spiUsartTransfer(value);
         }
         pinHigh(FLASH_PORT_CS, FLASH_CS);
-        flashCurrentBufPage = -1;
+        flashBuf->loadedPage = -1;
     }
 }
 
@@ -505,10 +695,10 @@ void flashBufSet(uint8_t value, uint16_t offset, uint16_t size)
  */
 void flashBufWriteCached(void *datap, uint16_t page, uint16_t offset, uint16_t size)
 {
-    if (flashWriteCachePage != page)
+    if (flashBuf->cachePage != page)
     {
         flashBufLoad(page);
-        flashWriteCachePage = page;
+        flashBuf->cachePage = page;
     }
 
     flashBufWrite(datap, offset, size);
@@ -521,7 +711,7 @@ void flashBufWriteCached(void *datap, uint16_t page, uint16_t offset, uint16_t s
 void flashBufSetCache(uint16_t page)
 {
     flashFlushCache(page);
-    flashWriteCachePage = page;
+    flashBuf->cachePage = page;
 }
 
 
@@ -547,18 +737,18 @@ int flashPageWrite(void *datap, uint16_t page, uint16_t offset, uint16_t size)
     if (size)
     {
         flashWaitReady();
-        pinLow(FLASH_PORT_CS, FLASH_CS);
-        flashWritePageOp(FLASH_OP_PAGE_WRITE, page, offset);
+        flashSelect();
+        flashWritePageOp(flashBufOps[flashBufSel].pageWrite, page, offset);
         spiUsartWrite((uint8_t *)datap, size);
         pinHigh(FLASH_PORT_CS, FLASH_CS);
 
         if ((offset == 0) && (size == FLASH_PAGE_SIZE))
         {
-            flashCurrentBufPage = page;
+            flashBuf->loadedPage = page;
         }
         else
         {
-            flashCurrentBufPage = -1;
+            flashBuf->loadedPage = -1;
         }
     }
 
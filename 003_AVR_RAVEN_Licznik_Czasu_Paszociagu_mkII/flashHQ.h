@@ -70,14 +70,28 @@
 #define FLASH_OP_BUF_WRITE        0x84	// write to the memory buffer
 #define FLASH_OP_BUF_ERASE_STORE  0x83	// write the buffer to a flash page, no erase
 #define FLASH_OP_BUF_STORE        0x88	// write the buffer to a flash page, no erase
+#define FLASH_OP_PAGE_WRITE2      0x85	// as above, through memory buffer 2
+#define FLASH_OP_BUF2_LOAD        0x55
+#define FLASH_OP_BUF2_READ        0xD3
+#define FLASH_OP_BUF2_WRITE       0x87
+#define FLASH_OP_BUF2_ERASE_STORE 0x86
+#define FLASH_OP_BUF2_STORE       0x89
 #define FLASH_OP_CHIP_ERASE       0xC7, 0x94, 0x80, 0x9A	// erase entire chip
 #define FLASH_OP_GET_STATUS       0xD7	// Read status
 #define FLASH_OP_SECTOR_ERASE     0x7C  // Erase a sector
 #define FLASH_OP_BLOCK_ERASE      0x50  // Erase a block
 #define	FLASH_OP_READ_DEV_ID      0x9F  // Read Manufacturing and Device ID
+#define FLASH_OP_DEEP_POWER_DOWN  0xB9  // Deep power down, only resume is accepted
+#define FLASH_OP_RESUME           0xAB  // Resume from deep power down
+
+#define FLASH_RESUME_US           35    // resume time, tRDPD
 
 #define FLASH_STATUS_BUSY         (1<<7)  // flash status busy bit
 
+#define FLASH_MAX_BUFFERS         2
+#define FLASH_NUM_BUFFERS         ((FLASH_NUM_PAGES > 512) ? 2 : 1)  // the 1Mbit part has a single buffer
+#define FLASH_BUF_SYSTEM          0     // owner for map, directory and record updates
+
 #define FLASH_SECTOR_0A       0x0800 // Internal identifier for Sector 0a operations
 #define FLASH_SECTOR_0B		  0x1000 // Internal identifier for Sector 0b operations
 
@@ -91,8 +105,29 @@ typedef struct {
     uint16_t sectorSize;;
 } flashGeometry_t;
 
+// Internal memory buffer state. A buffer is pinned to the open file (owner)
+// writing through it until it is released or evicted by another owner.
+// System operations only borrow a pinned buffer: the cached page is flushed
+// and reloaded for the owner on its next select.
+typedef struct {
+    uint16_t owner;         // dirPage of the writing file, FLASH_BUF_SYSTEM if not pinned
+    uint16_t loadedPage;    // page currently loaded, -1 if none/modified
+    uint16_t cachePage;     // page the buffer is caching writes for, 0 if none
+    uint16_t reloadPage;    // cache page flushed while lent to the system, 0 if none
+    uint8_t lastUse;        // LRU stamp
+} flashBuffer_t;
+
+// Buffer arbitration counters
+typedef struct {
+    uint16_t evictions;         // pinned buffers taken over by another owner
+    uint16_t contentionFlushes; // cached pages flushed early because of an eviction
+    uint16_t loans;             // pinned buffers lent to a system operation
+} flashBufStats_t;
+
 extern int8_t flashId;
 extern flashGeometry_t flashGeom[];
+extern flashBufStats_t flashBufStats;
+extern uint8_t flashActivity;       // counts flash operations, for idle detection
 
 int flashInit(void);
 uint16_t flashNumPages(void);
@@ -104,6 +139,7 @@ int flashPageRead(void *datap, uint16_t page, uint16_t offset, uint16_t size);
 int flashBufStore(uint16_t page);
 int flashBufEraseStore(uint16_t page);
 
+bool flashPowerDown(void);
 void flashChipErase(void);
 int flashPageErase(uint16_t page);
 int flashBlockErase(uint16_t block);
@@ -113,6 +149,10 @@ void flashBufWrite(void *datap, uint16_t offset, uint16_t size);
 void flashBufFill(void *datap, uint16_t offset, uint16_t size, uint16_t repeat);
 void flashBufSet(uint8_t value, uint16_t offset, uint16_t size);
 
+uint8_t flashBufSelect(uint16_t owner);
+bool flashBufHeld(uint16_t owner);
+void flashBufRelease(uint16_t owner);
+
 void flashBufWriteCached(void *datap, uint16_t page, uint16_t offset, uint16_t size);
 void flashBufSetCache(uint16_t page);
 int flashPageWrite(void *datap, uint16_t page, uint16_t offset, uint16_t size);
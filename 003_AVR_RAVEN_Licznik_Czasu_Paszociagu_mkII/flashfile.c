@@ -45,6 +45,20 @@
 
 #define max(x,y) (x > y ? x : y)
 
+// flashFormat() flags the record pages in the last byte of the node map
+#if 2*FLASH_REC_COUNT > 8
+#error FLASH_REC_COUNT record pages must fit in the last node map byte
+#endif
+
+// Free node count, kept in RAM and stored to the FLASH_REC_FREE record by
+// flashClose() and flashFormat(). The map pages are programmed without an
+// erase so the count can't be stored next to the bitmap.
+static uint16_t flashFreeNodes;
+static uint16_t flashFreeSaved;    // count in the record
+static bool flashFreeLoaded;
+
+static void flashFreeStore(void);
+
 /*bool flashMapNodeAvailable(flashNodeMap_t *map, uint16_t node)
 {
     return (map->free[node>>3] & (1 << (7-(node & 7)))) != 0;
@@ -54,10 +68,12 @@ void flashFormat(void)
 {
     DPRINTF_P(PSTR("Erasing chip\n"));
     flashChipErase();
+    flashBufSelect(FLASH_BUF_SYSTEM);
 
     uint16_t count;
     uint16_t mapPage;
     uint8_t used = 0xFF >> (FLASH_MAP_PAGE_COUNT+1);   // 1 for the directory entry
+    flashFormatStamp_t stamp = { FLASH_FORMAT_MAGIC, FLASH_FORMAT_LAYOUT };
 
     flashBufSet(used, 0, 1);    // flag map pages as used
     flashBufSet(0xFF, 1, FLASH_PAGE_SIZE-1);
@@ -68,7 +84,34 @@ void flashFormat(void)
         flashBufStore(mapPage);
     }
     flashBufSet(0, count, FLASH_PAGE_SIZE-count);
+    // flag the persistent record pages at the top of the flash as used
+    flashBufSet((uint8_t)(0xFF << (2*FLASH_REC_COUNT)), count-1, 1);
+    flashBufWrite(&stamp, FLASH_FORMAT_OFFSET, sizeof(stamp));
     flashBufStore(mapPage);
+
+    flashRecReset();
+    flashFreeNodes = FLASH_USABLE_NODES;
+    flashFreeSaved = ~flashFreeNodes;   // the erase took the record with it
+    flashFreeLoaded = true;
+    flashFreeStore();
+}
+
+
+/**
+ * Check the format stamp. A chip formatted before the stamp, or with another
+ * record count, may have files where this build keeps its records.
+ * @retval true formatted by this layout
+ * @retval false not, or there is no flash
+ */
+bool flashFormatValid(void)
+{
+    flashFormatStamp_t stamp;
+
+    if (flashId < 0) {
+        return false;
+    }
+    flashPageRead(&stamp, FLASH_FORMAT_PAGE, FLASH_FORMAT_OFFSET, sizeof(stamp));
+    return (stamp.magic == FLASH_FORMAT_MAGIC) && (stamp.layout == FLASH_FORMAT_LAYOUT);
 }
 
 
@@ -120,6 +163,7 @@ int flashOpen(char *filename, flashFile_t *filep)
         filep->size = dir.size;
         filep->offset = 0;
         filep->curNode = 0;
+        filep->dirPage = page;
         filep->eof = false;
         return 0;
     }
@@ -183,6 +227,80 @@ int flashRead(flashFile_t *filep, uint8_t *buffer, uint16_t size)
 }
 
 
+/**
+ * Count the free nodes by scanning the node map.
+ * @returns the number of free nodes
+ * @note slow, only used when there is no valid free count record
+ */
+static uint16_t flashMapCountFree(void)
+{
+    uint8_t map[16];
+    uint16_t mapOffset;
+    uint16_t count = 0;
+
+    for (mapOffset=0; mapOffset < FLASH_MAP_SIZE; mapOffset += sizeof(map)) {
+        flashRawRead(map, mapOffset, sizeof(map));
+        for (uint8_t ind=0; ind<sizeof(map) && (mapOffset+ind) < FLASH_MAP_SIZE; ind++) {
+            for (uint8_t bits=map[ind]; bits; bits &= bits-1) {
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
+
+
+/**
+ * Load the free node count, recounting it if the record is missing.
+ */
+static void flashFreeLoad(void)
+{
+    if (flashFreeLoaded) {
+        return;
+    }
+
+    if (flashRecRead(FLASH_REC_FREE, &flashFreeNodes, sizeof(flashFreeNodes)) < 0) {
+        DPRINTF_P(PSTR("flashFreeLoad(): no free count record, scanning map\n"));
+        flashFreeNodes = flashMapCountFree();
+        flashFreeSaved = ~flashFreeNodes;   // store it with the next close
+    } else {
+        flashFreeSaved = flashFreeNodes;
+    }
+    flashFreeLoaded = true;
+}
+
+
+/**
+ * Store the free node count if it changed since the last store.
+ * @note a reset with a file open leaves the record counting the nodes the
+ *       file took since, they are lost to the file as well
+ */
+static void flashFreeStore(void)
+{
+    if (flashFreeLoaded && (flashFreeNodes != flashFreeSaved)) {
+        if (flashRecWrite(FLASH_REC_FREE, &flashFreeNodes, sizeof(flashFreeNodes)) == 0) {
+            flashFreeSaved = flashFreeNodes;
+        }
+    }
+}
+
+
+/**
+ * Return the number of free nodes.
+ * @returns free nodes, each holding FLASH_FILE_NODE_SIZE bytes of file data,
+ *          0 if there is no flash
+ */
+uint16_t flashFree(void)
+{
+    if (flashId < 0) {
+        return 0;
+    }
+    flashFreeLoad();
+    return flashFreeNodes;
+}
+
+
 /**
  * Marks a node as in use. Uses the flash chips internal buffer.
  */
@@ -190,14 +308,23 @@ void flashMapUseNode(uint16_t node)
 {
     uint16_t mapPage = node / FLASH_NODES_PER_PAGE;
     uint16_t offset = (node % FLASH_NODES_PER_PAGE)/8;
+    uint8_t bit = 1 << (7-(node & 7));
     uint8_t map;
 
+    flashFreeLoad();
+
     flashBufLoad(mapPage);
     flashBufRead(&map, offset, sizeof(map));
-    map &= ~(1 << (7-(node & 7)));
+    if (!(map & bit)) {
+        // already in use, leave the free count alone
+        return;
+    }
+    map &= ~bit;
     flashBufSet(map, offset, 1);
     flashBufStore(mapPage);
 
+    flashFreeNodes--;
+
     DPRINTF_P(PSTR("marked node %d as used (page %d, offset %d, map 0x%02x)\n"), node, mapPage, offset, map);
 }
 
@@ -235,6 +362,7 @@ uint16_t flashNextFreeNode(void)
  */
 uint16_t flashAllocNode(uint16_t node)
 {
+    flashBufSelect(FLASH_BUF_SYSTEM);
 
     if (node == 0) {
         node = flashNextFreeNode();
@@ -259,6 +387,8 @@ int flashCreate(char *filename, flashFile_t *filep)
     uint16_t lastDirPage = 0;
     uint16_t page = flashFindFile(filename, &dir, &lastDirPage);
 
+    flashBufSelect(FLASH_BUF_SYSTEM);
+
     if (page != 0) {
         // file already exists. Overwrite?
         return -1;
@@ -325,6 +455,7 @@ int flashWrite(flashFile_t *filep, void *datap, size_t size)
             return -2; // no room left
         }
         DPRINTF_P(PSTR("flashWrite(): new file, allocated node %d for it\n"), node);
+        flashBufSelect(filep->dirPage);
         filep->offset = 0;
         space = FLASH_FILE_NODE_SIZE;
         offset = 0;
@@ -338,6 +469,11 @@ int flashWrite(flashFile_t *filep, void *datap, size_t size)
         flashBufSetCache(node);
     } else {
         DPRINTF_P(PSTR("flashWrite(): existing file, loading last node %d\n"), node);
+        if (!flashBufHeld(filep->dirPage)) {
+            // evicted by another writer, the last node was stored and needs an erase
+            filep->curNode = 0;
+        }
+        flashBufSelect(filep->dirPage);
         // file already exists, load the last node into the
         // internal buffer and read out the header
         flashBufLoad(node);
@@ -372,9 +508,11 @@ int flashWrite(flashFile_t *filep, void *datap, size_t size)
 
         DPRINTF_P(PSTR("flashWrite(): writing %d bytes to node %d at offset %d hdr\n"), space, node, offset);
         flashBufWrite(datap, (uint16_t)&nodep->data[offset], space);
-        flashFlushCache(node);
+        datap = (uint8_t *)datap + space;
+        flashFlushCache(0);     // full, nothing to lend to the node allocation
 
-        flashAllocNode(nextNode);  // this will flush the cache...
+        flashAllocNode(nextNode);
+        flashBufSelect(filep->dirPage);
 
         // new header
         filep->hdr.prevNode = node;
@@ -407,13 +545,16 @@ int flashClose(flashFile_t *filep)
     // update file size in directory entry, and start/end nodes
     // XXX only do this on close to speed things up?
     flashDirEntry_t *dir = (flashDirEntry_t *)0;
-    flashBufLoad(filep->dirPage);
+    flashBufSelect(filep->dirPage);
+    flashBufLoad(filep->dirPage);   // flushes the cached last node
     DPRINTF_P(PSTR("flashWrite(): updating dir entry %d, file size %d, endNode %d hdr\n"),
             filep->dirPage, filep->size, filep->endNode);
     flashBufWrite(&filep->size, (uint16_t)&dir->size, sizeof(dir->size));
     flashBufWrite(&filep->startNode, (uint16_t)&dir->startNode, sizeof(dir->startNode));
     flashBufWrite(&filep->endNode, (uint16_t)&dir->endNode, sizeof(dir->endNode));
     flashBufEraseStore(filep->dirPage);
+    flashBufRelease(filep->dirPage);
+    flashFreeStore();
 
     return 0;
 }
@@ -35,8 +35,8 @@
 
 #include <stdbool.h>
 #include "flashHQ.h"
+#include "flashrec.h"
 
-#define FLASH_AVAILBLE_SIZE ((FLASH_NUM_PAGES + 7)/8);
 #define FLASH_MAP_SIZE  (FLASH_NUM_PAGES/8)		// number of bytes needed for node map
 
 #define FLASH_FILE_NODE_SIZE (FLASH_PAGE_SIZE - sizeof(flashNodeHeader_t))
@@ -50,6 +50,20 @@
 #define FLASH_NODES_PER_PAGE (FLASH_PAGE_SIZE*8)
 #define FLASH_MAP_PAGE_COUNT  (FLASH_NUM_PAGES / (2*FLASH_NODES_PER_PAGE-1) + 1)
 #define FLASH_DIR_START_PAGE  FLASH_MAP_PAGE_COUNT
+// nodes free after a format: all but the map, first directory and record pages
+#define FLASH_USABLE_NODES    (FLASH_NUM_PAGES - (FLASH_MAP_PAGE_COUNT+1) - 2*FLASH_REC_COUNT)
+
+// Format stamp, at the end of the last map page past the bitmap. The record
+// pages move with FLASH_REC_COUNT, so the count is the layout.
+#define FLASH_FORMAT_MAGIC    0x4C46   // "FL"
+#define FLASH_FORMAT_LAYOUT   FLASH_REC_COUNT
+#define FLASH_FORMAT_PAGE     ((FLASH_MAP_SIZE-1) / FLASH_PAGE_SIZE)
+#define FLASH_FORMAT_OFFSET   (FLASH_PAGE_SIZE - sizeof(flashFormatStamp_t))
+
+typedef struct {
+    uint16_t magic;
+    uint8_t layout;
+} flashFormatStamp_t;
 
 // Node header - a doubly-linked list of nodes
 typedef struct {
@@ -89,7 +103,9 @@ typedef struct {
 } flashFile_t;
 
 void flashFormat(void);
+bool flashFormatValid(void);
 uint16_t flashAllocNode(uint16_t node);
+uint16_t flashFree(void);
 int flashOpen(char *filename, flashFile_t *filep);
 int flashRead(flashFile_t *filep, uint8_t *buffer, uint16_t size);
 int flashSeek(flashFile_t *filep, uint16_t filepos);
@@ -0,0 +1,233 @@
+/*
+ * flashlog.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/*
+ *	Delta encoded runtime log records, see flashlog.h for the format
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "flashlog.h"
+
+static uint8_t flashLogPutVarint(uint8_t *buf, uint32_t value)
+{
+    uint8_t len = 0;
+
+    while (value >= 0x80) {
+        buf[len++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buf[len++] = value;
+    return len;
+}
+
+static int8_t flashLogGetVarint(const uint8_t *buf, uint16_t size, uint32_t *value)
+{
+    uint8_t len = 0;
+    uint8_t shift = 0;
+
+    *value = 0;
+    do {
+        if ((len >= size) || (shift > 28)) {
+            return -1;
+        }
+        *value |= (uint32_t)(buf[len] & 0x7F) << shift;
+        shift += 7;
+    } while (buf[len++] & 0x80);
+
+    return len;
+}
+
+
+/**
+ * Initialise the encoder/decoder state, the next record will be a keyframe.
+ */
+void flashLogInit(flashLog_t *logp)
+{
+    memset(logp, 0, sizeof(*logp));
+}
+
+
+/**
+ * Encode a state change. Writes a keyframe instead of a delta record if the
+ * log isn't synced yet or the time went backwards.
+ * @param logp log state, updated with the new value
+ * @param buf buffer for the record, at least FLASH_LOG_MAX_RECORD bytes
+ * @param tag FLASH_LOG_LINES or FLASH_LOG_TEMP
+ * @param time time of the change in seconds
+ * @param value the new line mask or temperature
+ * @returns the record length
+ */
+uint8_t flashLogEncode(flashLog_t *logp, uint8_t *buf, uint8_t tag, uint32_t time, int16_t value)
+{
+    uint32_t delta = time - logp->time;
+    uint8_t len = 1;
+
+    if (!logp->synced || (time < logp->time)) {
+        if (tag == FLASH_LOG_LINES) {
+            logp->lines = value;
+        } else {
+            logp->temp = value;
+        }
+        logp->time = time;
+        logp->synced = true;
+
+        buf[0] = FLASH_LOG_KEYFRAME;
+        memcpy(&buf[1], &logp->time, sizeof(logp->time));
+        buf[5] = logp->lines;
+        memcpy(&buf[6], &logp->temp, sizeof(logp->temp));
+        return FLASH_LOG_KEYFRAME_SIZE;
+    }
+
+    if (delta < FLASH_LOG_DELTA_VARINT) {
+        buf[0] = tag | delta;
+    } else {
+        buf[0] = tag | FLASH_LOG_DELTA_VARINT;
+        len += flashLogPutVarint(&buf[len], delta);
+    }
+
+    if (tag == FLASH_LOG_LINES) {
+        buf[len++] = logp->lines ^ value;
+        logp->lines = value;
+    } else {
+        int16_t diff = value - logp->temp;
+        // zigzag, small negative deltas stay small
+        len += flashLogPutVarint(&buf[len], (uint16_t)(((uint16_t)diff << 1) ^ (diff >> 15)));
+        logp->temp = value;
+    }
+    logp->time = time;
+
+    return len;
+}
+
+
+/**
+ * Decode one record.
+ * @param logp log state, updated from the record
+ * @param buf the record
+ * @param size bytes available in buf
+ * @retval >0 length of the decoded record
+ * @retval 0 padding, the record stream continues at the next node
+ * @retval -1 truncated or invalid record
+ * @note delta records decoded before the first keyframe leave logp->synced false
+ */
+int8_t flashLogDecode(flashLog_t *logp, const uint8_t *buf, uint16_t size)
+{
+    uint32_t value;
+    int8_t len = 1;
+    int8_t n;
+
+    if (size == 0) {
+        return -1;
+    }
+
+    switch (buf[0] & FLASH_LOG_TAG_MASK) {
+        case 0:
+            if (buf[0] == FLASH_LOG_PAD) {
+                return 0;
+            }
+            if ((buf[0] != FLASH_LOG_KEYFRAME) || (size < FLASH_LOG_KEYFRAME_SIZE)) {
+                return -1;
+            }
+            memcpy(&logp->time, &buf[1], sizeof(logp->time));
+            logp->lines = buf[5];
+            memcpy(&logp->temp, &buf[6], sizeof(logp->temp));
+            logp->synced = true;
+            return FLASH_LOG_KEYFRAME_SIZE;
+        case FLASH_LOG_LINES:
+        case FLASH_LOG_TEMP:
+            break;
+        default:
+            return -1;
+    }
+
+    value = buf[0] & FLASH_LOG_DELTA_MASK;
+    if (value == FLASH_LOG_DELTA_VARINT) {
+        n = flashLogGetVarint(&buf[len], size - len, &value);
+        if (n < 0) {
+            return -1;
+        }
+        len += n;
+    }
+    logp->time += value;
+
+    if ((buf[0] & FLASH_LOG_TAG_MASK) == FLASH_LOG_LINES) {
+        if (len >= size) {
+            return -1;
+        }
+        logp->lines ^= buf[len++];
+    } else {
+        n = flashLogGetVarint(&buf[len], size - len, &value);
+        if (n < 0) {
+            return -1;
+        }
+        len += n;
+        logp->temp += (int16_t)((value >> 1) ^ -(value & 1));
+    }
+
+    return len;
+}
+
+
+/**
+ * Encode and append a record, padding out the current node if it doesn't fit.
+ */
+static int flashLogAppend(flashLog_t *logp, flashFile_t *filep, uint8_t tag, uint32_t time, int16_t value)
+{
+    uint8_t buf[FLASH_LOG_MAX_RECORD];
+    uint16_t space = FLASH_FILE_NODE_SIZE - (filep->size % FLASH_FILE_NODE_SIZE);
+    flashLog_t prev = *logp;
+    uint8_t len;
+    int res;
+
+    if (space == FLASH_FILE_NODE_SIZE) {
+        // every node starts with a keyframe
+        logp->synced = false;
+    }
+
+    len = flashLogEncode(logp, buf, tag, time, value);
+    if (len > space) {
+        memset(buf, FLASH_LOG_PAD, space);
+        res = flashWrite(filep, buf, space);
+        if (res < 0) {
+            return res;
+        }
+        *logp = prev;
+        logp->synced = false;
+        len = flashLogEncode(logp, buf, tag, time, value);
+    }
+
+    return flashWrite(filep, buf, len);
+}
+
+
+/**
+ * Log a change of the feed line states.
+ * @param logp log state
+ * @param filep log file, open for writing
+ * @param time seconds of the change
+ * @param lines bit per line, 1 = running
+ * @returns the flashWrite() result
+ */
+int flashLogLines(flashLog_t *logp, flashFile_t *filep, uint32_t time, uint8_t lines)
+{
+    return flashLogAppend(logp, filep, FLASH_LOG_LINES, time, lines);
+}
+
+
+/**
+ * Log a temperature sample.
+ * @param logp log state
+ * @param filep log file, open for writing
+ * @param time seconds of the sample
+ * @param temp the temperature as returned by temp_get()
+ * @returns the flashWrite() result
+ */
+int flashLogTemp(flashLog_t *logp, flashFile_t *filep, uint32_t time, int16_t temp)
+{
+    return flashLogAppend(logp, filep, FLASH_LOG_TEMP, time, temp);
+}
@@ -0,0 +1,58 @@
+/*
+ * flashlog.h
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/*
+ * Compact runtime log records stored in a flashfile.
+ *
+ * Records are a stream of states (time, line mask, temperature). Each record
+ * starts with a tag byte:
+ *
+ *   0x00        padding, the rest of the node is unused
+ *   0x01        keyframe: uint32 time, uint8 lines, int16 temperature
+ *   10dddddd    line change: time delta d, then the uint8 mask of lines that toggled
+ *   11dddddd    temperature: time delta d, then the zigzag varint temperature delta
+ *
+ * A delta of FLASH_LOG_DELTA_VARINT is followed by the real delta as a varint.
+ * Records never straddle a node and every node starts with a keyframe, so a
+ * reader can resync at any node boundary.
+ */
+
+#ifndef _FLASHLOG_H
+#define _FLASHLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "flashfile.h"
+
+#define FLASH_LOG_PAD           0x00
+#define FLASH_LOG_KEYFRAME      0x01
+#define FLASH_LOG_LINES         0x80
+#define FLASH_LOG_TEMP          0xC0
+#define FLASH_LOG_TAG_MASK      0xC0
+#define FLASH_LOG_DELTA_MASK    0x3F
+#define FLASH_LOG_DELTA_VARINT  0x3F    // delta too big for the tag, varint follows
+
+#define FLASH_LOG_NAME          "runtime.log"   // the feed-line log file
+
+#define FLASH_LOG_KEYFRAME_SIZE 8
+#define FLASH_LOG_MAX_RECORD    9       // temperature record with the longest varints
+
+// Encoder/decoder state, the last state written to or read from the log
+typedef struct {
+    uint32_t time;      // seconds of the last record, calendar_epoch() in runtime.c
+    uint8_t lines;      // bit per feed line, 1 = running
+    int16_t temp;
+    bool synced;        // false until a keyframe has been written/read
+} flashLog_t;
+
+void flashLogInit(flashLog_t *logp);
+uint8_t flashLogEncode(flashLog_t *logp, uint8_t *buf, uint8_t tag, uint32_t time, int16_t value);
+int8_t flashLogDecode(flashLog_t *logp, const uint8_t *buf, uint16_t size);
+int flashLogLines(flashLog_t *logp, flashFile_t *filep, uint32_t time, uint8_t lines);
+int flashLogTemp(flashLog_t *logp, flashFile_t *filep, uint32_t time, int16_t temp);
+
+#endif
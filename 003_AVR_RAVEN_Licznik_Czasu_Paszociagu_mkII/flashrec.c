@@ -0,0 +1,236 @@
+/*
+ * flashrec.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/*
+ *	A/B double-buffered persistent records for the AT45DB flash
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+#include <util/crc16.h>
+#include "flashrec.h"
+#include "flashfile.h"
+
+// Slot holding the newest valid copy of each record, found on first access
+typedef struct {
+    bool known;
+    int8_t slot;        // -1 if neither slot holds a valid copy
+    uint8_t size;
+    uint16_t seq;
+} flashRecState_t;
+
+static flashRecState_t flashRecState[FLASH_REC_COUNT];
+static int8_t flashRecLayout;  // 0 not checked yet, 1 format stamp matches, -1 it doesn't
+
+
+static uint16_t flashRecCrc(uint16_t crc, const uint8_t *datap, uint8_t size)
+{
+    while (size--) {
+        crc = _crc_ccitt_update(crc, *datap++);
+    }
+    return crc;
+}
+
+
+/**
+ * Check that a record slot holds a complete copy.
+ * @param rec the record number
+ * @param slot the slot to check, 0 or 1
+ * @param hdr returns the slot header
+ * @retval true the header and payload CRC are valid
+ * @retval false the slot is erased or was only partially written
+ */
+static bool flashRecSlotValid(uint8_t rec, uint8_t slot, flashRecHeader_t *hdr)
+{
+    uint8_t buf[16];
+    uint16_t page = FLASH_REC_PAGE(rec, slot);
+    uint16_t crc = 0xFFFF;
+    uint8_t offset;
+    uint8_t len;
+
+    flashPageRead(hdr, page, 0, sizeof(*hdr));
+    if ((hdr->magic != FLASH_REC_MAGIC) || (hdr->size > FLASH_REC_MAX_SIZE)) {
+        return false;
+    }
+
+    crc = flashRecCrc(crc, (uint8_t *)&hdr->seq, sizeof(hdr->seq));
+    crc = flashRecCrc(crc, &hdr->size, sizeof(hdr->size));
+    for (offset=0; offset < hdr->size; offset += len) {
+        len = hdr->size - offset;
+        if (len > sizeof(buf)) {
+            len = sizeof(buf);
+        }
+        flashPageRead(buf, page, sizeof(*hdr) + offset, len);
+        crc = flashRecCrc(crc, buf, len);
+    }
+
+    DPRINTF_P(PSTR("flashRecSlotValid(): rec %d slot %d seq %d crc 0x%04x/0x%04x\n"),
+            rec, slot, hdr->seq, crc, hdr->crc);
+    return crc == hdr->crc;
+}
+
+
+/**
+ * Check once that the record pages are where this build expects them.
+ * @retval true the chip was formatted with this record layout
+ */
+static bool flashRecLayoutValid(void)
+{
+    if (flashRecLayout == 0) {
+        flashRecLayout = flashFormatValid() ? 1 : -1;
+        DPRINTF_P(PSTR("flashRecLayoutValid(): %d\n"), flashRecLayout);
+    }
+    return flashRecLayout > 0;
+}
+
+
+/**
+ * Find the slot holding the newest valid copy of a record.
+ * @param rec the record number
+ * @returns the slot, or -1 if there is no valid copy
+ */
+static int8_t flashRecFind(uint8_t rec)
+{
+    flashRecState_t *state = &flashRecState[rec];
+    flashRecHeader_t hdrA;
+    flashRecHeader_t hdrB;
+    bool validA;
+    bool validB;
+
+    if (state->known) {
+        return state->slot;
+    }
+
+    validA = flashRecSlotValid(rec, 0, &hdrA);
+    validB = flashRecSlotValid(rec, 1, &hdrB);
+
+    if (validA && validB) {
+        // sequence numbers wrap, compare the distance rather than the values
+        state->slot = ((int16_t)(hdrB.seq - hdrA.seq) > 0) ? 1 : 0;
+    } else if (validA) {
+        state->slot = 0;
+    } else if (validB) {
+        state->slot = 1;
+    } else {
+        state->slot = -1;
+    }
+
+    if (state->slot == 0) {
+        state->seq = hdrA.seq;
+        state->size = hdrA.size;
+    } else if (state->slot == 1) {
+        state->seq = hdrB.seq;
+        state->size = hdrB.size;
+    } else {
+        state->seq = 0;
+        state->size = 0;
+    }
+    state->known = true;
+
+    return state->slot;
+}
+
+
+/**
+ * Forget the cached slot state, e.g. after the flash has been erased.
+ */
+void flashRecReset(void)
+{
+    memset(flashRecState, 0, sizeof(flashRecState));
+    flashRecLayout = 0;
+}
+
+
+/**
+ * Read the newest valid copy of a record.
+ * @param rec the record number
+ * @param datap buffer to store the record in
+ * @param size the expected record size
+ * @retval 0 success
+ * @retval -1 no valid copy of the record, invalid record number, or no flash
+ * @retval -2 the stored record has a different size
+ * @retval -3 the flash was formatted with another layout, reformat it
+ */
+int flashRecRead(uint8_t rec, void *datap, uint8_t size)
+{
+    int8_t slot;
+
+    if ((rec >= FLASH_REC_COUNT) || (flashId < 0)) {
+        return -1;
+    }
+    if (!flashRecLayoutValid()) {
+        return -3;
+    }
+
+    slot = flashRecFind(rec);
+    if (slot < 0) {
+        return -1;
+    }
+
+    if (flashRecState[rec].size != size) {
+        return -2;
+    }
+
+    flashPageRead(datap, FLASH_REC_PAGE(rec, slot), sizeof(flashRecHeader_t), size);
+
+    return 0;
+}
+
+
+/**
+ * Store a new copy of a record. The copy is written to the slot not holding
+ * the current copy with a single buffer erase/program operation.
+ * @param rec the record number
+ * @param datap the record data
+ * @param size the record size
+ * @retval 0 success
+ * @retval -1 invalid record number or size, or no flash
+ * @retval -3 the flash was formatted with another layout, the record pages
+ *         may belong to files and are left alone
+ * @note uses the internal buffer, flushing any cached page first
+ */
+int flashRecWrite(uint8_t rec, void *datap, uint8_t size)
+{
+    flashRecState_t *state;
+    flashRecHeader_t hdr;
+    uint16_t page;
+    int8_t slot;
+
+    if ((rec >= FLASH_REC_COUNT) || (size > FLASH_REC_MAX_SIZE) || (flashId < 0)) {
+        return -1;
+    }
+    if (!flashRecLayoutValid()) {
+        return -3;
+    }
+
+    state = &flashRecState[rec];
+    slot = flashRecFind(rec);
+    slot = (slot < 0) ? 0 : (slot ^ 1);
+    page = FLASH_REC_PAGE(rec, slot);
+
+    hdr.magic = FLASH_REC_MAGIC;
+    hdr.seq = state->seq + 1;
+    hdr.size = size;
+    hdr.crc = flashRecCrc(0xFFFF, (uint8_t *)&hdr.seq, sizeof(hdr.seq));
+    hdr.crc = flashRecCrc(hdr.crc, &hdr.size, sizeof(hdr.size));
+    hdr.crc = flashRecCrc(hdr.crc, datap, size);
+
+    DPRINTF_P(PSTR("flashRecWrite(): rec %d slot %d seq %d\n"), rec, slot, hdr.seq);
+
+    flashBufSelect(FLASH_BUF_SYSTEM);
+    flashFlushCache(page);
+    flashBufWrite(&hdr, 0, sizeof(hdr));
+    flashBufWrite(datap, sizeof(hdr), size);
+    flashBufEraseStore(page);
+
+    state->slot = slot;
+    state->seq = hdr.seq;
+    state->size = size;
+
+    return 0;
+}
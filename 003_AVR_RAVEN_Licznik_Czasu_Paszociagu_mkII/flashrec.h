@@ -0,0 +1,48 @@
+/*
+ * flashrec.h
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/*
+ * Power-loss safe persistent records for the AT45DB flash.
+ *
+ * Every record owns two dedicated pages at the top of the flash (slot A and
+ * slot B). An update programs the slot that does not hold the newest valid
+ * copy, so a reset in the middle of a write can only ever lose the update in
+ * progress, never the previous value.
+ */
+
+#ifndef _FLASHREC_H
+#define _FLASHREC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "flashHQ.h"
+
+#define FLASH_REC_COUNT       3        // number of records, each uses 2 pages, see FLASH_FORMAT_LAYOUT
+#define FLASH_REC_MAGIC       0x5243   // "RC"
+#define FLASH_REC_MAX_SIZE    64       // max payload size of a single record
+
+#define FLASH_REC_COUNTERS    0        // feed-line runtime totals, see runtime.h
+#define FLASH_REC_FREE        1        // free node count, see flashFree()
+#define FLASH_REC_TIME        2        // clock checkpoint, see calendar.h
+
+// first page used by the record slots, these are never handed out by flashAllocNode()
+#define FLASH_REC_START_PAGE  (FLASH_NUM_PAGES - 2*FLASH_REC_COUNT)
+#define FLASH_REC_PAGE(rec, slot) (FLASH_REC_START_PAGE + 2*(rec) + (slot))
+
+// Record slot header, followed by size bytes of payload
+typedef struct {
+    uint16_t magic;
+    uint16_t seq;       // incremented on every update, newest slot wins
+    uint8_t size;       // payload size in bytes
+    uint16_t crc;       // CRC-CCITT over seq, size and payload
+} flashRecHeader_t;
+
+void flashRecReset(void);
+int flashRecRead(uint8_t rec, void *datap, uint8_t size);
+int flashRecWrite(uint8_t rec, void *datap, uint8_t size);
+
+#endif
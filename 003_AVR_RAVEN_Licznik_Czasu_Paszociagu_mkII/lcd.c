@@ -242,6 +242,8 @@ static int lcd_text_wr_ptr = 0;
 static bool lcd_scroll_enable;
 static int lcd_scroll_prescale;
 static int lcd_scroll_prescale_value;
+/** Bits of lcd_num_image_t that belong to the digits, the rest are symbols */
+static lcd_num_image_t lcd_num_mask;
 static int lcd_num_print(uint16_t numb, bool negative, lcd_padding_t padding);
 static void lcd_nmb_print_dig(uint8_t val, int dig);
 static int lcd_text_sl(void);
@@ -258,6 +260,8 @@ static int lcd_char_put(unsigned char c, int pos);
  *  \return 0
  */
 int lcd_init(void) {
+	uint8_t i;
+
 	/*
 	 * Configuring LCD with Extern clock (TOSC, 32.768kHz)
 	 *                      32786 Hz          32786 Hz
@@ -301,6 +305,11 @@ int lcd_init(void) {
 	/* clear screen */
 	lcd_symbol_clr_all();
 
+	/* Every segment of every digit */
+	for (i = 0; i < 4; i++) {
+		lcd_num_image_digit(&lcd_num_mask, LCD_SEV_SEG_INDEX_8, i);
+	}
+
 	/* Calculate scrolling value */
 	lcd_scroll_prescale_value = LCD_CLCK_FRQ / 64;
 	lcd_scroll_prescale_value >>=
@@ -422,6 +431,54 @@ int lcd_num_clr(void) {
 
 /*---------------------------------------------------------------------------*/
 
+/**
+ *  \brief This will put the segments of one digit into a numeric image.
+ *
+ *  The digits sit in the last LCDDR byte of each COM row (LCDDR4, 9, 14
+ *  and 19), two bits a digit, so a COM row is seg_inf[] offset / 5.
+ *
+ *  \param image Image to change.
+ *  \param numb Index to seg_map[], 0-15 or LCD_SEV_SEG_INDEX_xxx.
+ *  \param dig Digit, 0 is the rightmost.
+ */
+void lcd_num_image_digit(lcd_num_image_t *image, uint8_t numb, uint8_t dig) {
+	uint8_t val = pgm_read_byte(&seg_map[numb]);
+	uint8_t inf;
+	uint8_t bit;
+	uint8_t j;
+
+	for (j = 0; j < 7; ++j) {
+		inf = pgm_read_byte(&seg_inf[j]);
+		bit = (inf >> 5) << (dig * 2);
+		if (val & (1 << j)) {
+			image->com[(inf & 0x1F) / 5] |= bit;
+		} else {
+			image->com[(inf & 0x1F) / 5] &= ~bit;
+		}
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *  \brief This will show a numeric image, four register writes instead of
+ *  drawing the digits segment by segment.
+ *
+ *  \param image Image built with lcd_num_image_digit().
+ */
+void lcd_num_image_put(const lcd_num_image_t *image) {
+	volatile unsigned char* lcd_data = (volatile unsigned char*) 0xEC;
+	uint8_t com;
+
+	for (com = 0; com < 4; com++) {
+		lcd_data[5 * com + 4] = (lcd_data[5 * com + 4] & ~lcd_num_mask.com[com])
+				| image->com[com];
+	}
+	lcd_symbol_clr(LCD_SYMBOL_MINUS);
+}
+
+/*---------------------------------------------------------------------------*/
+
 /**
  *  \brief This will put a string of characters out to the LCD.
  *
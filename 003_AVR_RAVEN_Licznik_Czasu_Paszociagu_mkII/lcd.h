@@ -116,6 +116,12 @@
      LCD_NUM_PADDING_SPACE
  } lcd_padding_t;
 
+ /** Segments of the four numeric digits, one byte for each COM row. Built with
+  *  lcd_num_image_digit() and written in one go with lcd_num_image_put(). */
+ typedef struct {
+     uint8_t com[4];
+ } lcd_num_image_t;
+
  typedef enum {
  /*  name               = (bit_number << bit_number_offset) | mem_offset*/
      /* Raven */
@@ -330,6 +336,8 @@
  int  lcd_num_putdec(int numb, lcd_padding_t padding);
  int  lcd_num_clr(void);
  void lcd_single_print_dig(uint8_t numb, uint8_t pos);
+ void lcd_num_image_digit(lcd_num_image_t *image, uint8_t numb, uint8_t dig);
+ void lcd_num_image_put(const lcd_num_image_t *image);
  /** @} */
 
  /** @name Text functions */
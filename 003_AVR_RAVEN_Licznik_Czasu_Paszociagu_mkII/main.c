@@ -88,12 +88,32 @@
  *   -# <b>SEND_ADC2 - (0x82)</b>
  *   -# <b>SEND_SLEEP- (0x83)</b>
  *   -# <b>SEND_WAKE - (0x84)</b>
+ *   -# <b>SEND_LINK_SPEED - (0x85)</b> - Payload is the requested UART_SPEED_xxx and UART_FRAMING_xxx
+ *   -# <b>SEND_BULK_DATA - (0x86)</b> - Bulk transfer block, see bulk.h
+ *   -# <b>SEND_EXPORT_INFO - (0x87)</b> - Answer to REPORT_EXPORT, see export.h
+ *   -# <b>SEND_TELEMETRY - (0x88)</b> - Sample count followed by that many ttelemetry samples
+ *   -# <b>SEND_LINK_STATS - (0x89)</b> - Answer to REPORT_LINK_STATS, the UART_STATS_xxx page followed
+ *   by its counters, see uart.h
+ *   -# <b>SEND_RUNTIME - (0x8A)</b> - Answer to REPORT_LINES, the feed-line runtime totals, see runtime.h
  *
  *  The following commands are received from the 1284p.
  *   -# <b>REPORT_PING      - (0xC0)</b>
  *   -# <b>REPORT_PING_BEEP - (0xC1)</b>
  *   -# <b>REPORT_TEXT_MSG  - (0xC2)</b>
  *   -# <b>REPORT_WAKE      - (0xC3)</b>
+ *   -# <b>REPORT_LINK_SPEED - (0xC4)</b> - Payload is the accepted UART_SPEED_xxx and optionally
+ *   UART_FRAMING_xxx (SOF framing if left out), both sides switch once this frame has been sent
+ *   -# <b>REPORT_BULK_ACK  - (0xC5)</b> - Bulk transfer acknowledgement, see bulk.h
+ *   -# <b>REPORT_EXPORT    - (0xC6)</b> - Export a file or a time range of the log, see export.h
+ *   -# <b>REPORT_TELEMETRY_MODE - (0xC7)</b> - Payload TELEMETRY_ASCII/TELEMETRY_BINARY and the
+ *   number of samples per SEND_TELEMETRY frame
+ *   -# <b>REPORT_LINK_STATS - (0xC8)</b> - Query a UART_STATS_xxx page of link counters, an optional
+ *   second byte UART_STATS_CLEAR clears the page once sent
+ *   -# <b>REPORT_TIME      - (0xC9)</b> - Payload is the uint32 local time in seconds since 2000, see calendar.h
+ *   -# <b>REPORT_LINES     - (0xCA)</b> - Payload is a bit per feed line running, see runtime.h
+ *
+ *   With RS485_ENABLE the same frames run on a multi-drop RS-485 bus, addressed
+ *   and polled by a bus master, see rs485.h.
  *
  *     \section sleep_lcd Sleep and Doze
  *   -# The Raven draws 27 milliamps when the 3290p and 1284p are both running and the RF230 in receive mode.
@@ -102,7 +122,9 @@
  *    It is controlled by contiki on the 1284p according to the selected MAC power protocols to obtain the
  *    bulk of power savings; however the 3290p menu can tell it to sleep unconditionally or in a doze cycle.
  *   -# Unconditional SLEEP requires pushing the joystick button for wakeup. Once awake the 3290p sends
- *    SEND_WAKE commands to the 1284p until it responds with a REPORT_WAKE. "WAIT 1284p" is displayed during this time.
+ *    SEND_WAKE commands to the 1284p with an exponential backoff, idle sleeping in between, until it responds
+ *    with a REPORT_WAKE. "WAKE 1284p" is displayed during this time, "WAKE ERR" if it does not answer within
+ *    WAKE_TIMEOUT ms.
  *    Current draw is 40 microamps.
  *   -# As configured, doze sleeps the 3290p for 5 seconds after telling 1284p to sleep for 4 seconds. The 3290p
  *    wakes briefly to send temperature and voltage to the 1284p (which should be awake at this time), then tells it to
@@ -163,6 +185,13 @@
 
 #include "flashfile.h"
 #include "spi.h"
+#include "export.h"
+#include "modbus.h"
+#include "rs485.h"
+#include "sched.h"
+#include "swtimer.h"
+#include "calendar.h"
+#include "runtime.h"
 
 
 #include <string.h>
@@ -210,6 +239,8 @@ const char menu_text4[] PROGMEM = "TEMP";
 const char menu_text5[] PROGMEM = "MODE ";
 const char menu_text6[] PROGMEM = "DEG F";
 const char menu_text7[] PROGMEM = "DEG C";
+const char menu_text8[] PROGMEM = "LINK";
+const char menu_text9[] PROGMEM = "ADRES";
 
 
 /*---------------------------------------------------------------------------*/
@@ -222,7 +253,7 @@ const char menu_text7[] PROGMEM = "DEG C";
  *
  *   { text, left, right, up, down, *state, tmenufunc enter_func}
  */
-const PROGMEM tmenu_item menu_items[8]  = {
+const PROGMEM tmenu_item menu_items[9 + RS485_ENABLE]  = {
     {menu_text0,   0,  0,  0,  1, 0,                       0                  },
     {menu_text1,   1,  1,  0,  2, 0,                       0                  },
     {menu_text2,   2,  0,  1,  3, 0,                       time_reset		  },
@@ -230,12 +261,19 @@ const PROGMEM tmenu_item menu_items[8]  = {
     {menu_text4,   4,  4,  3,  5, 0,                       0                  },
     {menu_text5,   5,  5,  4,  6, 0,                       0                  },
     {menu_text6,   6,  6,  5,  7, 0,    		           0   				  },
-    {menu_text7,   7,  7,  6,  7, 0,        			   0    			  },
+    {menu_text7,   7,  7,  6,  8, 0,        			   0    			  },
+#if RS485_ENABLE
+    {menu_text8,   8,  8,  7,  9, 0,                       menu_link_stats    },
+    {menu_text9,   9,  9,  8,  9, 0,                       menu_rs485_address },
+#else
+    {menu_text8,   8,  8,  7,  8, 0,                       menu_link_stats    },
+#endif
 };
 #endif /* !DOXYGEN */
 
 key_state_t button = KEY_STATE_NO_KEY;
 tmenu_item menu;
+uint8_t menu_ndx;
 uint8_t count;
 uint8_t timeout_count;
 
@@ -252,6 +290,7 @@ void read_menu(uint8_t ndx) {
 	uint8_t *src = (uint8_t*) &menu_items[ndx];
 	uint8_t *dest = (uint8_t*) &menu;
 
+	menu_ndx = ndx;
 	for (i = 0; i < sizeof(tmenu_item); i++) {
 		*dest++ = pgm_read_byte(src + i);
 	}
@@ -305,6 +344,144 @@ void check_menu(void) {
 	}*/
 }
 
+/** \brief Turns the colon off half way through the second. */
+static t_swtimer main_colon_timer;
+
+/** \brief Powers the dataflash down once it has been left alone for a while. */
+static t_swtimer main_flash_timer;
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief The colon is lit for the first half of every second.
+ */
+static void main_colon_off(void) {
+	lcd_symbol_clr(LCD_SYMBOL_COL);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Deep power down the dataflash if it was not used since the last
+ *   check. Any flash operation wakes it up again.
+ */
+static void main_flash_idle(void) {
+	static uint8_t seen;
+
+	if (seen == flashActivity) {
+		flashPowerDown();
+	}
+	seen = flashActivity;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief CLOCK task, once a second. Shows the time with a blinking colon, and
+ *   the temperature when it is on.
+ */
+void main_clock_task(uint8_t events) {
+	show_clock();
+	lcd_symbol_set(LCD_SYMBOL_COL);
+	swtimer_start(&main_colon_timer, main_colon_off, SWTIMER_MS(500), 0);
+
+	/* Update LCD with temp data. */
+	if (temp_flag) {
+		menu_display_temp();
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief KEYS task, on every joystick scan. Dispatches a new button press to
+ *   the menu.
+ */
+void main_key_task(uint8_t events) {
+	if (!is_button()) {
+		return;
+	}
+
+	/* Dispatch the button pressed */
+	switch (get_button()) {
+	case KEY_UP:
+		read_menu(menu.up);
+		lcd_puts_P(menu.text);
+		break;
+	case KEY_DOWN:
+		read_menu(menu.down);
+		lcd_puts_P(menu.text);
+		break;
+	case KEY_LEFT:
+		read_menu(menu.left);
+		lcd_puts_P(menu.text);
+		break;
+	case KEY_RIGHT:
+		/*
+		 * Check to see if we should show another menu or
+		 * run a function
+		 */
+		if (!menu.enter_func) {
+			/* Just another menu to display */
+			read_menu(menu.right);
+			lcd_puts_P(menu.text);
+			break;
+		}
+		/* Drop through here */
+	case KEY_ENTER:
+		/* Call the menu function on right or enter buttons */
+		if (menu.enter_func) {
+			menu.enter_func(menu.state);
+			if (menu.state) {
+				/*
+				 * We just called a selection menu (not a test),
+				 * so re-display the text for this menu level
+				 */
+				lcd_puts_P(menu.text);
+			}
+			/* After enter key, check the right button menu and display. */
+			read_menu(menu.right);
+			lcd_puts_P(menu.text);
+		}
+		break;
+	default:
+		break;
+	}
+	/* After button press, check for menus... */
+	check_menu();
+}
+
+#if MODBUS_ENABLE
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief MODBUS task, once a second. Requests are answered from the TIMER1
+ *   interrupt, this only refreshes the input registers.
+ */
+void main_modbus_task(uint8_t events) {
+	modbus_poll();
+}
+#else
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief LINK task, on received characters and every second for the frame
+ *   timeouts. Processes the frames from the 1284p.
+ */
+void main_link_task(uint8_t events) {
+	uart_serial_rcv_frame(false);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief EXPORT task, keeps an export going, see export_poll().
+ */
+void main_export_task(uint8_t events) {
+	export_poll();
+}
+#endif
+
 /*---------------------------------------------------------------------------*/
 
 /**
@@ -329,6 +506,17 @@ int main(void) {
 
 	sei();
 
+#if MODBUS_ENABLE
+	/* USART0 is a Modbus RTU slave instead of the 1284p link */
+	modbus_init();
+#elif RS485_ENABLE
+	/* USART0 is a node on a multi-drop RS-485 bus, frames wait for the master's poll */
+	rs485_init();
+#else
+	/* Speed up the 1284p link, stays at 38400 and SOF framing if the 1284p does not ack */
+	uart_link_negotiate(UART_SPEED_500K, UART_FRAMING_COBS);
+#endif
+
 /*	lcd_symbol_set(LCD_SYMBOL_RAVEN);
 	lcd_symbol_set(LCD_SYMBOL_IP);
 	 Start with main menu
@@ -347,8 +535,10 @@ int main(void) {
 	led_on();
 
 
-	flashFile_t file, file_open;
 	flashInit();    // Initialize flash memory
+	swtimer_start(&main_flash_timer, main_flash_idle, SWTIMER_MS(FLASH_IDLE_TIME), SWTIMER_MS(FLASH_IDLE_TIME));
+	calendar_init();
+	runtime_init();
 
 /*	char str[32];
 	sprintf(str, "%d", Flash_ID);
@@ -389,101 +579,8 @@ int main(void) {
 	beep(0);
 	_delay_ms(2000);*/
 
-
-	int res = flashOpen("luj.txt", &file_open);
-	if (res < 0) {
-		lcd_puts("ERR3");
-	    while (1);
-	}
-
-	_delay_ms(100);
-	uint8_t read_data[5];
-	memset(read_data, 0, sizeof(read_data));
-
-	flashRead(&file_open, read_data, sizeof(read_data));
-	lcd_puts((char*)read_data);
-	beep(0);
-	flashClose(&file_open);
-
-	while(1);
-
-
-
-
-
-	for (;;) {
-
-		/* Make sure interrupts are always on */
-		sei();
-		/* The one second timer has fired. */
-		if (timer_flag) {
-			static uint8_t temp = 0;
-			timer_flag = 0;
-			/* Check if main menu needs toggled. */
-			lcd_num_putdec(get_hour(), LCD_NUM_PADDING_ZERO);
-			if(temp++%2) lcd_symbol_set(LCD_SYMBOL_COL);
-			else lcd_symbol_clr(LCD_SYMBOL_COL);
-
-			/* Update LCD with temp data. */
-			if (temp_flag) {
-				menu_display_temp();
-			}
-		}
-
-
-		/* Check for button press and deal with it */
-		if (is_button()) {
-			/* Dispatch the button pressed */
-			switch (get_button()) {
-			case KEY_UP:
-				read_menu(menu.up);
-				lcd_puts_P(menu.text);
-				break;
-			case KEY_DOWN:
-				read_menu(menu.down);
-				lcd_puts_P(menu.text);
-				break;
-			case KEY_LEFT:
-				read_menu(menu.left);
-				lcd_puts_P(menu.text);
-				break;
-			case KEY_RIGHT:
-				/*
-				 * Check to see if we should show another menu or
-				 * run a function
-				 */
-				if (!menu.enter_func) {
-					/* Just another menu to display */
-					read_menu(menu.right);
-					lcd_puts_P(menu.text);
-					break;
-				}
-				/* Drop through here */
-			case KEY_ENTER:
-				/* Call the menu function on right or enter buttons */
-				if (menu.enter_func) {
-					menu.enter_func(menu.state);
-					if (menu.state) {
-						/*
-						 * We just called a selection menu (not a test),
-						 * so re-display the text for this menu level
-						 */
-						lcd_puts_P(menu.text);
-					}
-					/* After enter key, check the right button menu and display. */
-					read_menu(menu.right);
-					lcd_puts_P(menu.text);
-				}
-				break;
-			default:
-				break;
-			}
-			/* After button press, check for menus... */
-			check_menu();
-		}
-		/* Process any progress frames */
-
-	} /* end for(). */
+	/* Everything else runs from the tasks of sched_tasks.h */
+	sched_run();
 } /* end main(). */
 
 /** \} */
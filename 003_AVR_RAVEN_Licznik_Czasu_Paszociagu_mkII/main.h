@@ -57,6 +57,9 @@
  #define TRUE    (!false)
 
  #define PING_ATTEMPTS       (4)
+ #define PING_PERIOD         (1000)  /**< ms between ping requests */
+ #define TEMP_AUTO_PERIOD    (1000)  /**< ms between automatic temperature sends */
+ #define FLASH_IDLE_TIME     (2000)  /**< ms without dataflash use before it powers down */
  /** \} */
 
  /** \name These are GUI to Radio Binary commands. */
@@ -67,6 +70,12 @@
  #define SEND_ADC2                     (0x82)
  #define SEND_SLEEP                    (0x83)
  #define SEND_WAKE                     (0x84)
+ #define SEND_LINK_SPEED               (0x85)
+ #define SEND_BULK_DATA                (0x86)
+ #define SEND_EXPORT_INFO              (0x87)
+ #define SEND_TELEMETRY                (0x88)
+ #define SEND_LINK_STATS               (0x89)
+ #define SEND_RUNTIME                  (0x8A)
  /** \} */
 
  /** \name These are the Radio to GUI binary commands. */
@@ -75,6 +84,13 @@
  #define REPORT_PING_BEEP              (0xC1)
  #define REPORT_TEXT_MSG               (0xC2)
  #define REPORT_WAKE                   (0xC3)
+ #define REPORT_LINK_SPEED             (0xC4)
+ #define REPORT_BULK_ACK               (0xC5)
+ #define REPORT_EXPORT                 (0xC6)
+ #define REPORT_TELEMETRY_MODE         (0xC7)
+ #define REPORT_LINK_STATS             (0xC8)
+ #define REPORT_TIME                   (0xC9)
+ #define REPORT_LINES                  (0xCA)
  /** \} */
 
 
@@ -49,6 +49,9 @@
 
  #include <avr/eeprom.h>
  #include <util/delay.h>
+ #include <util/atomic.h>
+ #include <stddef.h>
+ #include <string.h>
  #include "menu.h"
  #include "main.h"
  #include "lcd.h"
@@ -57,6 +60,11 @@
  #include "sleep.h"
  #include "temp.h"
  #include "timer.h"
+ #include "rtc.h"
+ #include "rs485.h"
+ #include "modbus.h"
+ #include "sched.h"
+ #include "swtimer.h"
 
 
  uint8_t sleep_count;
@@ -68,11 +76,51 @@
  bool temp_mode;
  bool auto_temp=true;
 
+ /** \brief Paces the ping requests. */
+ static t_swtimer menu_ping_timer;
+
+ /** \brief Paces the automatic temperature sends. */
+ static t_swtimer menu_temp_timer;
+
+ static void menu_ping_next(void);
+
  /**
   *  \addtogroup lcd
   *  \{
  */
 
+ /** \brief Link counters shown by menu_link_stats(), see tuart_stats. */
+ static const char stats_text0[] PROGMEM = "OVERRUN";
+ static const char stats_text1[] PROGMEM = "FRAMING";
+ static const char stats_text2[] PROGMEM = "PARITY";
+ static const char stats_text3[] PROGMEM = "RX FULL";
+ static const char stats_text4[] PROGMEM = "Q FULL";
+ static const char stats_text5[] PROGMEM = "BAD FRM";
+ static const char stats_text6[] PROGMEM = "TO LEN";
+ static const char stats_text7[] PROGMEM = "TO ACK";
+ static const char stats_text8[] PROGMEM = "TO CMD";
+ static const char stats_text9[] PROGMEM = "TO DATA";
+ static const char stats_text10[] PROGMEM = "TO EOF";
+
+ static const struct {
+     const char *text;
+     uint8_t offset;
+ } stats_items[] PROGMEM = {
+     { stats_text0,  offsetof(tuart_stats, rx_overrun) },
+     { stats_text1,  offsetof(tuart_stats, rx_frame_err) },
+     { stats_text2,  offsetof(tuart_stats, rx_parity_err) },
+     { stats_text3,  offsetof(tuart_stats, rx_buf_full) },
+     { stats_text4,  offsetof(tuart_stats, rx_queue_full) },
+     { stats_text5,  offsetof(tuart_stats, rx_bad_frame) },
+     { stats_text6,  offsetof(tuart_stats, rx_timeout[RX_STATE_LENGTH]) },
+     { stats_text7,  offsetof(tuart_stats, rx_timeout[RX_STATE_ACK_EOF]) },
+     { stats_text8,  offsetof(tuart_stats, rx_timeout[RX_STATE_CMD]) },
+     { stats_text9,  offsetof(tuart_stats, rx_timeout[RX_STATE_PAYLOAD]) },
+     { stats_text10, offsetof(tuart_stats, rx_timeout[RX_STATE_EOF]) },
+ };
+
+ #define STATS_ITEMS (sizeof(stats_items) / sizeof(stats_items[0]))
+
  /*---------------------------------------------------------------------------*/
 
  /**
@@ -184,7 +232,7 @@
      uart_serial_send_frame(SEND_SLEEP, 1, (uint8_t *)&sleep_count);
 
      /* Turn off UART when transmission is complete */
-         while(!(UCSR0A & (1 << TXC0)));
+         uart_tx_flush();
      _delay_us(10000); //deinit trash clears done flag on 1284p
          uart_deinit();
 
@@ -240,7 +288,7 @@
          uart_serial_send_frame(SEND_SLEEP, 1, (uint8_t *)&sleep_count);
 
       /* Wait for transmission complete, then sleep 3290p for 5 seconds */
-                 while(!(UCSR0A & (1 << TXC0)));
+                 uart_tx_flush();
  //              uart_deinit();
          sleep_now(sleep_count+1);
  //              uart_init();
@@ -284,8 +332,27 @@
 
      menu_send_ping();
 
-     /* Reset the timer for 1 sec resolution between pings. */
-     TCNT1 = 0;
+ #if !MODBUS_ENABLE
+     /* No 1284p to ping on the Modbus line */
+     swtimer_start(&menu_ping_timer, menu_ping_next, SWTIMER_MS(PING_PERIOD), SWTIMER_MS(PING_PERIOD));
+ #endif
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief Ping timer handler. The previous ping has had its time, send the
+  *   next one or stop after PING_ATTEMPTS. A ping left unanswered keeps its
+  *   dash on the display.
+ */
+ static void
+ menu_ping_next(void)
+ {
+     if (ping_count >= PING_ATTEMPTS){
+         menu_stop_ping();
+         return;
+     }
+     menu_send_ping();
  }
 
  /*---------------------------------------------------------------------------*/
@@ -318,6 +385,7 @@
  menu_stop_ping(void)
  {
      ping_mode = false;
+     swtimer_stop(&menu_ping_timer);
  }
 
  /*---------------------------------------------------------------------------*/
@@ -440,10 +508,14 @@
      if(*val){
          /* Only send the temp value once. */
          auto_temp = false;
+         swtimer_stop(&menu_temp_timer);
      }
      else{
-         /* Auto send the temp value based on TIMER1 interval. */
+         /* Auto send the temp value every TEMP_AUTO_PERIOD. */
          auto_temp = true;
+ #if !MODBUS_ENABLE
+         swtimer_start(&menu_temp_timer, menu_send_temp, SWTIMER_MS(TEMP_AUTO_PERIOD), SWTIMER_MS(TEMP_AUTO_PERIOD));
+ #endif
      }
 
      menu_send_temp();
@@ -458,16 +530,93 @@
  menu_stop_temp(void)
  {
      auto_temp = false;
+     swtimer_stop(&menu_temp_timer);
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ #if MEASURE_ADC2
+ extern uint16_t ADC2_reading;
+ #endif
+
+ /** \brief Telemetry format and batch size, see menu_telemetry_mode(). */
+ static uint8_t telemetry_mode = TELEMETRY_ASCII;
+ static uint8_t telemetry_batch = 1;
+
+ /** \brief SEND_TELEMETRY payload, samples are added until telemetry_batch is reached. */
+ static struct {
+     uint8_t count;
+     ttelemetry sample[TELEMETRY_MAX_BATCH];
+ } telemetry_frame;
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief REPORT_TELEMETRY_MODE handler, selects ASCII or binary telemetry.
+  *   Samples not sent yet are dropped.
+  *
+  *   \param payload TELEMETRY_ASCII or TELEMETRY_BINARY, then samples per frame.
+  *   \param length Payload length.
+ */
+ void
+ menu_telemetry_mode(const uint8_t *payload, uint8_t length)
+ {
+     telemetry_mode = (payload[0] == TELEMETRY_BINARY) ? TELEMETRY_BINARY : TELEMETRY_ASCII;
+     telemetry_batch = payload[1];
+     if (telemetry_batch < 1){
+         telemetry_batch = 1;
+     }
+     if (telemetry_batch > TELEMETRY_MAX_BATCH){
+         telemetry_batch = TELEMETRY_MAX_BATCH;
+     }
+     telemetry_frame.count = 0;
  }
 
  /*---------------------------------------------------------------------------*/
 
  /**
-  *   \brief This will send the data via the serial port.
+  *   \brief This will add a binary sample to the telemetry frame, and send the
+  *   frame once it holds telemetry_batch samples.
+  *
+  *   \param temp The temperature just measured.
  */
+ static void
+ menu_send_telemetry(int16_t temp)
+ {
+     ttelemetry *sample = &telemetry_frame.sample[telemetry_frame.count];
+     t_time now;
+
+     rtc_now(&now);
+     sample->time = now.total_sec;
+     sample->temp = temp;
  #if MEASURE_ADC2
- extern uint16_t ADC2_reading;
+     sample->adc2_mv = ADC2_reading;
+ #else
+     sample->adc2_mv = 0;
  #endif
+     sample->key = key_state_get();
+     sample->menu = menu_ndx;
+     sample->flags = (temp_mode == TEMP_UNIT_FAHRENHEIT) ? TELEMETRY_FAHRENHEIT : 0;
+     if (!(MCUCR & (1 << JTD))){
+         sample->flags |= TELEMETRY_JTAG;
+     }
+     if (now.flags & TIME_UNCERTAIN){
+         sample->flags |= TELEMETRY_TIME_UNCERTAIN;
+     }
+
+     if (++telemetry_frame.count >= telemetry_batch){
+         uart_serial_send_frame(SEND_TELEMETRY,
+                 1 + telemetry_frame.count * sizeof(ttelemetry), (uint8_t *)&telemetry_frame);
+         telemetry_frame.count = 0;
+     }
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief This will send the data via the serial port, as text frames or as
+  *   binary telemetry depending on the mode the 1284p asked for.
+ */
  void
  menu_send_temp(void)
  {
@@ -481,6 +630,12 @@
      /* Get the latest temp value. */
      result = temp_get(temp_mode);
 
+     if (telemetry_mode == TELEMETRY_BINARY){
+         menu_send_telemetry(result);
+         led_off();
+         return;
+     }
+
      /* Convert signed decimal number to ASCII. */
      p = signed_dectoascii(result, (str + 10));
 
@@ -497,4 +652,91 @@
      led_off();
  }
 
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief This is the link debug page. It shows one uart_stats counter at a
+  *   time, up/down step through them, left/enter return to the menu. The link
+  *   keeps being serviced and the counter is refreshed every second.
+  *
+  *   \param val place holder
+ */
+ void
+ menu_link_stats(uint8_t *val)
+ {
+     tuart_stats stats;
+     uint8_t item = 0;
+     uint16_t value;
+
+     for (;;){
+         ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+             memcpy(&stats, (const void *)&uart_stats, sizeof(stats));
+         }
+         memcpy(&value, (uint8_t *)&stats + pgm_read_byte(&stats_items[item].offset), sizeof(value));
+         lcd_puts_P((const char *)pgm_read_word(&stats_items[item].text));
+         lcd_num_putdec(value > 9999 ? 9999 : value, LCD_NUM_PADDING_SPACE);
+
+         while (!(sched_wait(SCHED_EV_KEY | SCHED_EV_TICK) & SCHED_EV_TICK) && !is_button())
+             ;
+         if (!is_button()){
+             continue;
+         }
+
+         switch (get_button()){
+             case KEY_UP:
+                 item = item ? item - 1 : STATS_ITEMS - 1;
+                 break;
+             case KEY_DOWN:
+                 item = (item + 1 < STATS_ITEMS) ? item + 1 : 0;
+                 break;
+             case KEY_LEFT:
+             case KEY_ENTER:
+                 lcd_num_clr();
+                 return;
+             default:
+                 break;
+         }
+     }
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief This will set the RS-485 node address. Up/down change it, enter
+  *   stores it in EEPROM, left leaves it as it was. The bus keeps being
+  *   serviced meanwhile.
+  *
+  *   \param val place holder
+ */
+ void
+ menu_rs485_address(uint8_t *val)
+ {
+     uint8_t address = rs485_address;
+
+     for (;;){
+         lcd_num_putdec(address, LCD_NUM_PADDING_SPACE);
+
+         while (!is_button()){
+             sched_wait(SCHED_EV_KEY);
+         }
+
+         switch (get_button()){
+             case KEY_UP:
+                 address = (address < RS485_ADDR_MAX) ? address + 1 : 1;
+                 break;
+             case KEY_DOWN:
+                 address = (address > 1) ? address - 1 : RS485_ADDR_MAX;
+                 break;
+             case KEY_ENTER:
+                 rs485_set_address(address);
+                 /* fall through */
+             case KEY_LEFT:
+                 lcd_num_clr();
+                 return;
+             default:
+                 break;
+         }
+     }
+ }
+
  /** \}   */
@@ -67,15 +67,39 @@
      tmenufunc enter_func;       /**< Pointer to function to call when enter button is pressed. */
  } tmenu_item;
 
+ /** \name Telemetry formats, selected by the 1284p with REPORT_TELEMETRY_MODE */
+ /** \{ */
+ #define TELEMETRY_ASCII       (0)   /**< SEND_TEMP and SEND_ADC2 text frames, the default. */
+ #define TELEMETRY_BINARY      (1)   /**< SEND_TELEMETRY frames. */
+ /** \} */
+
+ #define TELEMETRY_FAHRENHEIT  (0x01)    /**< ttelemetry flag, temp is in degrees F. */
+ #define TELEMETRY_JTAG        (0x02)    /**< ttelemetry flag, JTAG enabled, temp not valid. */
+ #define TELEMETRY_TIME_UNCERTAIN (0x04) /**< ttelemetry flag, clock not set since power up, see calendar.h. */
+
+ /** \brief One SEND_TELEMETRY sample, little endian as stored by the 3290p. */
+ typedef struct {
+     uint32_t time;              /**< RTC.total_sec when sampled. */
+     int16_t temp;               /**< Temperature in the current temp_mode unit. */
+     uint16_t adc2_mv;           /**< EXT_SUPL_SIG in millivolts, 0 without MEASURE_ADC2. */
+     uint8_t key;                /**< key_state_get(). */
+     uint8_t menu;               /**< Index of the menu item shown. */
+     uint8_t flags;              /**< TELEMETRY_xxx flags. */
+ } ttelemetry;
+
+ /** \brief Samples per SEND_TELEMETRY frame, bounded by the TX buffer. */
+ #define TELEMETRY_MAX_BATCH   (6)
+
  extern uint8_t ping_response;
  extern bool ping_mode;
  extern bool timeout_flag;
  extern bool temp_flag;
  extern bool auto_temp;
  extern const PROGMEM tmenu_item menu_items[];
+ extern uint8_t menu_ndx;
  char top_menu_text[20];
 
- #define EEPROM_DEBUG_ADDR   0
+ #define EEPROM_DEBUG_ADDR   0   /**< RS485_EEPROM_ADDR follows. */
 
  void menu_run_sleep(uint8_t *val);
  void menu_run_doze(uint8_t *val);
@@ -93,5 +117,8 @@
  void menu_prepare_temp(uint8_t *val);
  void menu_stop_temp(void);
  void menu_send_temp(void);
+ void menu_telemetry_mode(const uint8_t *payload, uint8_t length);
+ void menu_link_stats(uint8_t *val);
+ void menu_rs485_address(uint8_t *val);
 
  #endif /* MENU_H */
@@ -0,0 +1,444 @@
+/*
+ * modbus.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Modbus RTU slave, see modbus.h for the register map.
+ */
+
+#include <string.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "modbus.h"
+#include "uart.h"
+#include "menu.h"
+#include "temp.h"
+#include "timer.h"
+#include "rtc.h"
+#include "calendar.h"
+
+/**
+ *  \addtogroup lcd
+ *  \{
+ */
+
+/** CRC-16/MODBUS, polynomial 0xA001 reflected */
+static const uint16_t modbus_crc_table[256] PROGMEM = {
+	0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+	0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+	0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+	0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+	0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+	0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+	0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+	0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+	0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+	0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+	0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+	0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+	0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+	0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+	0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+	0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+	0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+	0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+	0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+	0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+	0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+	0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+	0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+	0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+	0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+	0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+	0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+	0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+	0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+	0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+	0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+	0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+};
+
+/** time of day registers, written to RTC from modbus_poll() */
+static t_time modbus_clock;
+static volatile bool modbus_clock_written;
+
+/** Holding registers, built from modbus_regs.h */
+static const t_modbus_reg modbus_regs[] PROGMEM = {
+#define MODBUS_REG(var, writable, min, max) { (void *) &(var), sizeof(var), writable, min, max },
+#include "modbus_regs.h"
+#undef MODBUS_REG
+};
+
+#define MODBUS_HOLDING_COUNT (sizeof(modbus_regs) / sizeof(modbus_regs[0]))
+
+uint8_t modbus_address = MODBUS_ADDRESS;
+t_modbus_stats modbus_stats;
+
+/** request being received, answered in place */
+static uint8_t modbus_frame[MODBUS_FRAME_MAX];
+static volatile uint8_t modbus_rx_count;
+/** line error or overlong frame, the frame is dropped */
+static volatile bool modbus_rx_error;
+
+extern uint16_t ADC2_reading;
+
+/** input register values that take too long to read from an interrupt */
+static int16_t modbus_temp;
+static uint16_t modbus_adc2;
+/** low byte of RTC.total_sec at the last refresh */
+static uint8_t modbus_tick;
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief CRC over a frame. Over a frame including its CRC the result is 0.
+ */
+uint16_t modbus_crc(const uint8_t *buf, uint8_t length) {
+	uint16_t crc = 0xFFFF;
+
+	while (length--) {
+		crc = (crc >> 8) ^ pgm_read_word(&modbus_crc_table[(uint8_t) (crc ^ *buf++)]);
+	}
+	return crc;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static bool modbus_read_input(uint16_t reg, uint16_t *value) {
+	switch (reg) {
+	case MODBUS_IR_TEMP:
+		*value = modbus_temp;
+		break;
+	case MODBUS_IR_ADC2:
+		*value = modbus_adc2;
+		break;
+	case MODBUS_IR_TIME_HI:
+		*value = rtc_seconds() >> 16;
+		break;
+	case MODBUS_IR_TIME_LO:
+		*value = rtc_seconds();
+		break;
+	case MODBUS_IR_BUS_MSGS:
+		*value = modbus_stats.bus_msgs;
+		break;
+	case MODBUS_IR_CRC_ERRORS:
+		*value = modbus_stats.crc_errors;
+		break;
+	case MODBUS_IR_EXCEPTIONS:
+		*value = modbus_stats.exceptions;
+		break;
+	case MODBUS_IR_SLAVE_MSGS:
+		*value = modbus_stats.slave_msgs;
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static bool modbus_read_holding(uint16_t reg, uint16_t *value) {
+	void *var;
+
+	if (reg >= MODBUS_HOLDING_COUNT) {
+		return false;
+	}
+	var = pgm_read_ptr(&modbus_regs[reg].var);
+	if (pgm_read_byte(&modbus_regs[reg].size) == 1) {
+		*value = *(volatile uint8_t *) var;
+	} else {
+		*value = *(volatile uint16_t *) var;
+	}
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Check a holding register write, and do it unless check_only.
+ *
+ *   \return 0, or the MODBUS_EX_xxx code to answer with.
+ */
+static uint8_t modbus_write_holding(uint16_t reg, uint16_t value, bool check_only) {
+	void *var;
+
+	if (reg >= MODBUS_HOLDING_COUNT) {
+		return MODBUS_EX_ADDRESS;
+	}
+	if (!pgm_read_byte(&modbus_regs[reg].writable) ||
+			value < pgm_read_word(&modbus_regs[reg].min) ||
+			value > pgm_read_word(&modbus_regs[reg].max)) {
+		return MODBUS_EX_VALUE;
+	}
+	if (!check_only) {
+		var = pgm_read_ptr(&modbus_regs[reg].var);
+		if (pgm_read_byte(&modbus_regs[reg].size) == 1) {
+			*(volatile uint8_t *) var = value;
+		} else {
+			*(volatile uint16_t *) var = value;
+		}
+		if ((uint8_t *) var >= (uint8_t *) &modbus_clock &&
+				(uint8_t *) var < (uint8_t *) (&modbus_clock + 1)) {
+			modbus_clock_written = true;
+		}
+	}
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static uint8_t modbus_exception(uint8_t *buf, uint8_t code) {
+	buf[1] |= 0x80;
+	buf[2] = code;
+	modbus_stats.exceptions++;
+	return 3;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Carry out a request and build the reply over it.
+ *
+ *   \param buf The request, address first, without the CRC.
+ *   \param length Request length without the CRC.
+ *
+ *   \return Reply length without the CRC.
+ */
+static uint8_t modbus_request(uint8_t *buf, uint8_t length) {
+	uint16_t start = ((uint16_t) buf[2] << 8) | buf[3];
+	uint16_t count = ((uint16_t) buf[4] << 8) | buf[5];
+	uint16_t value;
+	uint8_t code;
+	uint8_t pass;
+	uint8_t i;
+
+	switch (buf[1]) {
+	case MODBUS_READ_HOLDING:
+	case MODBUS_READ_INPUT:
+		if (length != 6 || count < 1 || count > MODBUS_MAX_REGS) {
+			return modbus_exception(buf, MODBUS_EX_VALUE);
+		}
+		for (i = 0; i < count; i++) {
+			if (buf[1] == MODBUS_READ_HOLDING ?
+					!modbus_read_holding(start + i, &value) :
+					!modbus_read_input(start + i, &value)) {
+				return modbus_exception(buf, MODBUS_EX_ADDRESS);
+			}
+			buf[3 + 2 * i] = value >> 8;
+			buf[4 + 2 * i] = value;
+		}
+		buf[2] = count * 2;
+		return 3 + count * 2;
+
+	case MODBUS_WRITE_SINGLE:
+		if (length != 6) {
+			return modbus_exception(buf, MODBUS_EX_VALUE);
+		}
+		if ((code = modbus_write_holding(start, count, false))) {
+			return modbus_exception(buf, code);
+		}
+		/* the reply echoes the request */
+		return 6;
+
+	case MODBUS_WRITE_MULTI:
+		if (length < 7 || count < 1 || count > MODBUS_MAX_REGS ||
+				buf[6] != count * 2 || length != 7 + count * 2) {
+			return modbus_exception(buf, MODBUS_EX_VALUE);
+		}
+		/* all or nothing, check every register before writing any */
+		for (pass = 0; pass < 2; pass++) {
+			for (i = 0; i < count; i++) {
+				value = ((uint16_t) buf[7 + 2 * i] << 8) | buf[8 + 2 * i];
+				if ((code = modbus_write_holding(start + i, value, !pass))) {
+					return modbus_exception(buf, code);
+				}
+			}
+		}
+		return 6;
+
+	default:
+		return modbus_exception(buf, MODBUS_EX_FUNCTION);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Check a received frame and answer it in place.
+ *
+ *   \param buf The frame as received, address first, CRC last.
+ *   \param length Frame length including the CRC.
+ *
+ *   \return Length of the reply in buf including its CRC, 0 for no reply.
+ */
+uint8_t modbus_process(uint8_t *buf, uint8_t length) {
+	uint16_t crc;
+	uint8_t address;
+
+	if (length < 4 || modbus_crc(buf, length)) {
+		modbus_stats.crc_errors++;
+		return 0;
+	}
+	modbus_stats.bus_msgs++;
+
+	address = buf[0];
+	if (address != modbus_address && address != MODBUS_BROADCAST) {
+		return 0;
+	}
+	modbus_stats.slave_msgs++;
+
+	length = modbus_request(buf, length - 2);
+	if (address == MODBUS_BROADCAST) {
+		return 0;
+	}
+
+	crc = modbus_crc(buf, length);
+	buf[length++] = crc;
+	buf[length++] = crc >> 8;
+	return length;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Take a character from the USART RX interrupt and restart the t3.5
+ *   end of frame timer.
+ *
+ *   \param status UCSR0A as read before UDR0.
+ *   \param ch The character.
+ */
+void modbus_rx_char(uint8_t status, uint8_t ch) {
+	if (status & ((1 << FE0) | (1 << DOR0) | (1 << UPE0))) {
+		modbus_rx_error = true;
+	}
+	if (modbus_rx_count < sizeof(modbus_frame)) {
+		modbus_frame[modbus_rx_count++] = ch;
+	} else {
+		modbus_rx_error = true;
+	}
+
+	OCR1B = TCNT1 + MODBUS_T35;
+	TIFR1 = (1 << OCF1B);
+	TIMSK1 |= (1 << OCIE1B);
+}
+
+/*---------------------------------------------------------------------------*/
+
+#if MODBUS_ENABLE
+/**
+ *   \brief t3.5 of silence, the frame is complete. Answer it right here so the
+ *   reply latency does not depend on the main loop.
+ */
+ISR(TIMER1_COMPB_vect) {
+	uint8_t length;
+
+	TIMSK1 &= ~(1 << OCIE1B);
+
+	if (modbus_rx_error) {
+		modbus_stats.crc_errors++;
+	} else if ((length = modbus_process(modbus_frame, modbus_rx_count))) {
+		uart_queue_raw(modbus_frame, length);
+	}
+	modbus_rx_count = 0;
+	modbus_rx_error = false;
+}
+#endif
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Take over USART0 and TIMER1 for the Modbus slave, 38400 baud 8E1.
+ */
+void modbus_init(void) {
+	uart_init();
+	/* 8 bit character size, even parity as the RTU default */
+	UCSR0C = (1 << UPM01) | (3 << UCSZ00);
+
+	/* TIMER1 free running at 8us per tick, compare B times t3.5 */
+	PRR &= ~(1 << PRTIM1);
+	TCCR1A = 0;
+	TCCR1B = (1 << CS11) | (1 << CS10);
+	TIMSK1 &= ~(1 << OCIE1B);
+
+	modbus_rx_count = 0;
+	modbus_rx_error = false;
+	memset(&modbus_stats, 0, sizeof(modbus_stats));
+	modbus_tick = (uint8_t) rtc_seconds() - 1;
+	modbus_poll();
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Set RTC to a time of day written by the master, and refresh the
+ *   time of day registers. The date and TIME_UNCERTAIN are kept, as when the
+ *   clock is set by hand.
+ */
+static void modbus_clock_poll(void) {
+	t_time clock;
+	t_time now;
+	uint32_t epoch;
+	bool written;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		written = modbus_clock_written;
+		modbus_clock_written = false;
+		clock = modbus_clock;
+	}
+	if (written) {
+		rtc_now(&now);
+		epoch = calendar_epoch();
+		epoch -= epoch % 86400UL;
+		epoch += (uint32_t) clock.hour * 3600 + (uint16_t) clock.min * 60 + clock.sec;
+		if (calendar_set(epoch, now.flags)) {
+			calendar_checkpoint();
+		}
+	}
+
+	rtc_now(&now);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		/* a write since the copy above waits for the next second */
+		if (!modbus_clock_written) {
+			modbus_clock = now;
+		}
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Refresh the input registers that are too slow to read from an
+ *   interrupt, and the time of day registers, once a second. Call from the
+ *   main loop.
+ */
+void modbus_poll(void) {
+	int16_t temp;
+	uint8_t sreg;
+
+	if (modbus_tick == (uint8_t) rtc_seconds()) {
+		return;
+	}
+	modbus_tick = (uint8_t) rtc_seconds();
+	modbus_clock_poll();
+
+	temp = temp_get(TEMP_UNIT_CELCIUS);
+	sreg = SREG;
+	cli();
+	modbus_temp = temp;
+#if MEASURE_ADC2
+	modbus_adc2 = ADC2_reading;
+#endif
+	SREG = sreg;
+}
+
+/** \}   */
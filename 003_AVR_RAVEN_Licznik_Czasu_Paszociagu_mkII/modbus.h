@@ -0,0 +1,106 @@
+/*
+ * modbus.h
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Modbus RTU slave on USART0 for the farm SCADA.
+ *
+ *      Frames end after MODBUS_T35 of silence, timed with TIMER1 compare B.
+ *      The request is answered from that interrupt, so the reply starts
+ *      within t3.5 plus well under a millisecond of processing no matter
+ *      what the main loop is doing. The 1284p link and sleep_wakeup() are
+ *      not available in this mode.
+ *
+ *      Input registers (function 04), read only:
+ *        0  temperature in degrees C, refreshed once a second
+ *        1  EXT_SUPL_SIG in mV, 0 without MEASURE_ADC2
+ *        2  RTC.total_sec, high word
+ *        3  RTC.total_sec, low word
+ *        4  bus messages, frames with a good CRC
+ *        5  CRC errors, including parity and framing errors
+ *        6  exceptions sent
+ *        7  slave messages, frames for this address
+ *
+ *      Holding registers (functions 03, 06 and 16) are the variables listed
+ *      in modbus_regs.h, from address 0 up.
+ */
+
+#ifndef MODBUS_H
+#define MODBUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Build with the Modbus slave instead of the 1284p link */
+#ifndef MODBUS_ENABLE
+#define MODBUS_ENABLE 0
+#endif
+
+#define MODBUS_ADDRESS       (1)     /**< default slave address */
+#define MODBUS_BROADCAST     (0)
+#define MODBUS_FRAME_MAX     (80)    /**< longest request accepted, bounded by txbuf */
+#define MODBUS_MAX_REGS      (32)    /**< registers per read or write request */
+/** t3.5 in TIMER1 ticks of 8us, fixed at 1750us above 19200 baud */
+#define MODBUS_T35           (219)
+
+/** \name Function codes */
+/** \{ */
+#define MODBUS_READ_HOLDING  (0x03)
+#define MODBUS_READ_INPUT    (0x04)
+#define MODBUS_WRITE_SINGLE  (0x06)
+#define MODBUS_WRITE_MULTI   (0x10)
+/** \} */
+
+/** \name Exception codes */
+/** \{ */
+#define MODBUS_EX_FUNCTION   (0x01)
+#define MODBUS_EX_ADDRESS    (0x02)
+#define MODBUS_EX_VALUE      (0x03)
+/** \} */
+
+/** \name Input registers */
+/** \{ */
+#define MODBUS_IR_TEMP       (0)
+#define MODBUS_IR_ADC2       (1)
+#define MODBUS_IR_TIME_HI    (2)
+#define MODBUS_IR_TIME_LO    (3)
+#define MODBUS_IR_BUS_MSGS   (4)
+#define MODBUS_IR_CRC_ERRORS (5)
+#define MODBUS_IR_EXCEPTIONS (6)
+#define MODBUS_IR_SLAVE_MSGS (7)
+#define MODBUS_IR_COUNT      (8)
+/** \} */
+
+/** Modbus diagnostics counters, see the input registers */
+typedef struct {
+	uint16_t bus_msgs;
+	uint16_t crc_errors;
+	uint16_t exceptions;
+	uint16_t slave_msgs;
+} t_modbus_stats;
+
+/** Holding register table entry, built from modbus_regs.h */
+typedef struct {
+	void *var;
+	uint8_t size;		/**< 1 or 2 bytes, 8 bit variables read back zero extended */
+	uint8_t writable;
+	uint16_t min;
+	uint16_t max;
+} t_modbus_reg;
+
+extern uint8_t modbus_address;
+extern t_modbus_stats modbus_stats;
+
+void modbus_init(void);
+void modbus_poll(void);
+void modbus_rx_char(uint8_t status, uint8_t ch);
+uint16_t modbus_crc(const uint8_t *buf, uint8_t length);
+uint8_t modbus_process(uint8_t *buf, uint8_t length);
+
+#endif /* MODBUS_H */
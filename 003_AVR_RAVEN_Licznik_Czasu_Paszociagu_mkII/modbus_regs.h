@@ -0,0 +1,34 @@
+/*
+ * modbus_regs.h
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Modbus holding registers, numbered from 0 in the order listed. Each
+ *      line expands into the register table in flash (modbus.c).
+ *
+ *      MODBUS_REG(variable, writable, min, max)
+ *
+ *      variable is an 8 or 16 bit lvalue. Writes to a read only register or
+ *      outside min..max are refused with MODBUS_EX_VALUE.
+ *
+ *      The time of day is a copy of RTC refreshed every second. Writes to it
+ *      are set with calendar_set() and checkpointed by modbus_poll().
+ */
+
+/* No include guard, included once per expansion of MODBUS_REG */
+
+MODBUS_REG(modbus_clock.hour,        true,  0, 23)
+MODBUS_REG(modbus_clock.min,         true,  0, 59)
+MODBUS_REG(modbus_clock.sec,         true,  0, 59)
+MODBUS_REG(auto_temp,                true,  0, 1)
+MODBUS_REG(menu_ndx,                 false, 0, 0xff)
+MODBUS_REG(modbus_address,           true,  1, 247)
+MODBUS_REG(uart_stats.rx_overrun,    false, 0, 0xffff)
+MODBUS_REG(uart_stats.rx_parity_err, false, 0, 0xffff)
+MODBUS_REG(uart_stats.rx_frame_err,  false, 0, 0xffff)
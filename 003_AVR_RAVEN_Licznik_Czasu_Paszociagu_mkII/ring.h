@@ -0,0 +1,163 @@
+/*
+ * ring.h
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Single producer, single consumer character ring. One side may be an
+ *      interrupt, neither side needs to disable interrupts.
+ *
+ *      head and tail run freely and are masked on access, so the ring holds
+ *      all RING_SIZE characters and the count is head - tail. Only the
+ *      producer writes head and only the consumer writes tail, each after
+ *      the data it hands over, with a compiler barrier in between.
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define RING_SIZE   (128)               /**< Power of two, at most 128 for 8 bit indexes. */
+#define RING_MASK   (RING_SIZE - 1)
+
+#if RING_SIZE & RING_MASK || RING_SIZE > 128
+#error RING_SIZE must be a power of two up to 128
+#endif
+
+/** Keep the compiler from moving buffer accesses across an index update */
+#define ring_barrier() __asm__ __volatile__ ("" ::: "memory")
+
+/** \brief Ring of characters */
+typedef struct {
+	volatile uint8_t head;	/**< Free running write index, written by the producer only. */
+	volatile uint8_t tail;	/**< Free running read index, written by the consumer only. */
+	uint8_t buf[RING_SIZE];
+} t_ring;
+
+static inline void ring_init(t_ring *r) {
+	r->head = r->tail = 0;
+}
+
+static inline uint8_t ring_count(const t_ring *r) {
+	return (uint8_t) (r->head - r->tail);
+}
+
+static inline uint8_t ring_free(const t_ring *r) {
+	return RING_SIZE - ring_count(r);
+}
+
+/**
+ *   \brief Producer, add a character.
+ *
+ *   \return False if the ring was full and the character dropped.
+ */
+static inline uint8_t ring_put(t_ring *r, uint8_t ch) {
+	uint8_t head = r->head;
+
+	if ((uint8_t) (head - r->tail) == RING_SIZE) {
+		return 0;
+	}
+	r->buf[head & RING_MASK] = ch;
+	ring_barrier();
+	r->head = head + 1;
+	return 1;
+}
+
+/**
+ *   \brief Producer, store length characters offset places past the head
+ *   without handing them over yet. Check ring_free() first.
+ */
+static inline void ring_stage(t_ring *r, uint8_t offset, const uint8_t *data, uint8_t length) {
+	uint8_t at = (uint8_t) (r->head + offset) & RING_MASK;
+	uint8_t first = RING_SIZE - at;
+
+	if (first > length) {
+		first = length;
+	}
+	memcpy(&r->buf[at], data, first);
+	memcpy(r->buf, data + first, length - first);
+}
+
+/**
+ *   \brief Producer, hand over count staged characters at once.
+ */
+static inline void ring_commit(t_ring *r, uint8_t count) {
+	ring_barrier();
+	r->head += count;
+}
+
+/**
+ *   \brief Producer, add length characters. Check ring_free() first.
+ */
+static inline void ring_write(t_ring *r, const uint8_t *data, uint8_t length) {
+	ring_stage(r, 0, data, length);
+	ring_commit(r, length);
+}
+
+/**
+ *   \brief Consumer, take a character. Check ring_count() first.
+ */
+static inline uint8_t ring_get(t_ring *r) {
+	uint8_t tail = r->tail;
+	uint8_t ch = r->buf[tail & RING_MASK];
+
+	ring_barrier();
+	r->tail = tail + 1;
+	return ch;
+}
+
+/**
+ *   \brief Consumer, find the characters that can be read in one piece,
+ *   up to the end of the buffer. Release them with ring_consume().
+ *
+ *   \param span Set to the first character.
+ *
+ *   \return Number of characters at span, 0 if the ring is empty.
+ */
+static inline uint8_t ring_span(t_ring *r, const uint8_t **span) {
+	uint8_t tail = r->tail;
+	uint8_t count = (uint8_t) (r->head - tail);
+	uint8_t first = RING_SIZE - (tail & RING_MASK);
+
+	ring_barrier();
+	*span = &r->buf[tail & RING_MASK];
+	return count < first ? count : first;
+}
+
+/**
+ *   \brief Consumer, release characters read through ring_span().
+ */
+static inline void ring_consume(t_ring *r, uint8_t count) {
+	ring_barrier();
+	r->tail += count;
+}
+
+/**
+ *   \brief Consumer, take up to length characters.
+ *
+ *   \return Number of characters copied to data.
+ */
+static inline uint8_t ring_read(t_ring *r, uint8_t *data, uint8_t length) {
+	const uint8_t *span;
+	uint8_t copied = 0;
+	uint8_t n;
+
+	while (copied < length && (n = ring_span(r, &span))) {
+		if (n > length - copied) {
+			n = length - copied;
+		}
+		memcpy(data + copied, span, n);
+		ring_consume(r, n);
+		copied += n;
+	}
+	return copied;
+}
+
+#endif /* RING_H */
@@ -0,0 +1,151 @@
+/*
+ * rs485.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Multi-drop RS-485 node, see rs485.h for the bus protocol.
+ */
+
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include "rs485.h"
+#include "modbus.h"
+#include "uart.h"
+
+#if RS485_ENABLE && MODBUS_ENABLE
+#error RS485_ENABLE and MODBUS_ENABLE both need USART0 and TIMER1 compare B
+#endif
+
+/**
+ *  \addtogroup lcd
+ *  \{
+ */
+
+/** Ack frame that ends a turn */
+static const uint8_t rs485_eot_frame[] = { SOF_CHAR, 0x80, EOF_CHAR };
+
+uint8_t rs485_address = RS485_ADDRESS;
+uint16_t rs485_polls;
+
+/** txbuf head when the poll arrived, the turn ends there */
+static volatile uint8_t rs485_tx_end;
+/** Characters of rs485_eot_frame sent this turn */
+static volatile uint8_t rs485_eot;
+
+/** Change MPCM0 without clearing TXC0, which is cleared by writing a one */
+#define rs485_mpcm(on) (UCSR0A = (UCSR0A & (1 << U2X0)) | ((on) ? (1 << MPCM0) : 0))
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Take an address character from the USART RX interrupt.
+ *
+ *   \param ch The address character, RS485_POLL and the node address.
+ */
+void rs485_rx_address(uint8_t ch) {
+	uint8_t node = ch & ~RS485_POLL;
+
+	if (ch & RS485_POLL) {
+		/* Nothing follows a poll, and our own reply is not for us either */
+		rs485_mpcm(true);
+		if (node == rs485_address) {
+			rs485_polls++;
+			rs485_tx_end = txbuf.head;
+			rs485_eot = 0;
+
+			/* Give the master time to release the bus */
+			OCR1B = TCNT1 + RS485_TURNAROUND;
+			TIFR1 = (1 << OCF1B);
+			TIMSK1 |= (1 << OCIE1B);
+		}
+	} else {
+		rs485_mpcm(node != rs485_address && node != RS485_BROADCAST);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Move the next character of this turn to the transmitter, from the
+ *   USART data register empty interrupt.
+ *
+ *   \return False once the turn is sent.
+ */
+uint8_t rs485_tx_char(void) {
+	if (txbuf.tail != rs485_tx_end) {
+		UDR0 = ring_get(&txbuf);
+		return true;
+	}
+	if (rs485_eot < sizeof(rs485_eot_frame)) {
+		UDR0 = rs485_eot_frame[rs485_eot++];
+		return true;
+	}
+	return false;
+}
+
+/*---------------------------------------------------------------------------*/
+
+#if RS485_ENABLE
+/**
+ *   \brief The turnaround after a poll is over, drive the bus and send.
+ */
+ISR(TIMER1_COMPB_vect) {
+	TIMSK1 &= ~(1 << OCIE1B);
+
+	rs485_de_on();
+	UCSR0B = (UCSR0B & ~(1 << TXCIE0)) | (1 << UDRIE0);
+}
+#endif
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Store a new node address in EEPROM, it takes effect right away.
+ *
+ *   \param address 1 to RS485_ADDR_MAX.
+ */
+void rs485_set_address(uint8_t address) {
+	if (address == RS485_BROADCAST || address > RS485_ADDR_MAX) {
+		return;
+	}
+	eeprom_update_byte(RS485_EEPROM_ADDR, address);
+	rs485_address = address;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Take over USART0 and TIMER1 for the RS-485 bus, 38400 baud with 9
+ *   bit characters, listening for address characters only.
+ */
+void rs485_init(void) {
+	uint8_t address = eeprom_read_byte(RS485_EEPROM_ADDR);
+
+	rs485_address = (address == RS485_BROADCAST || address > RS485_ADDR_MAX) ? RS485_ADDRESS : address;
+	rs485_polls = 0;
+
+	rs485_de_off();
+	RS485_DE_DDR |= (1 << RS485_DE_BIT);
+
+	uart_init();
+	/* 9 bit character size */
+	UCSR0C = (3 << UCSZ00);
+	UCSR0B |= (1 << UCSZ02);
+	rs485_mpcm(true);
+
+	/* TIMER1 free running at 8us per tick, compare B times the turnaround */
+	PRR &= ~(1 << PRTIM1);
+	TCCR1A = 0;
+	TCCR1B = (1 << CS11) | (1 << CS10);
+	TIMSK1 &= ~(1 << OCIE1B);
+}
+
+/** \}   */
@@ -0,0 +1,69 @@
+/*
+ * rs485.h
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Multi-drop RS-485 mode of the USART0 link, several counters on one
+ *      cable to a bus master.
+ *
+ *      Characters are 9 bits at 38400 baud. The master starts every transfer
+ *      with an address character, ninth bit set:
+ *
+ *        0aaaaaaa  select node a, the data characters that follow are the
+ *                  usual SOF frames for it. Address 0 selects every node.
+ *        1aaaaaaa  poll node a. After RS485_TURNAROUND it sends the complete
+ *                  frames it had queued when the poll arrived, then an ack
+ *                  frame (SOF, 0x80, EOF) to end its turn.
+ *
+ *      Unselected nodes run the USART in multi-processor mode (MPCM), so data
+ *      characters for other nodes never raise an interrupt. A node only
+ *      drives the bus, through RS485_DE, during its turn; frames are queued
+ *      as usual and wait for the next poll.
+ *
+ *      The node address is kept in EEPROM and set from the ADRES menu.
+ */
+
+#ifndef RS485_H
+#define RS485_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Build with the multi-drop RS-485 link instead of the 1284p link */
+#ifndef RS485_ENABLE
+#define RS485_ENABLE 0
+#endif
+
+#define RS485_ADDRESS        (1)     /**< address of a node with an erased EEPROM */
+#define RS485_ADDR_MAX       (0x7e)
+#define RS485_BROADCAST      (0x00)  /**< select only, a broadcast is never polled */
+#define RS485_POLL           (0x80)  /**< address character flag, poll instead of select */
+#define RS485_EEPROM_ADDR    ((uint8_t *) 1)  /**< after EEPROM_DEBUG_ADDR */
+
+/** Bus turnaround in TIMER1 ticks of 8us, a character time at 38400 baud */
+#define RS485_TURNAROUND     (36)
+
+/** \name Transceiver driver enable, tie DE and /RE together */
+/** \{ */
+#define RS485_DE_PORT        PORTE
+#define RS485_DE_DDR         DDRE
+#define RS485_DE_BIT         3       /**< PE2 is the joystick enter button */
+#define rs485_de_on()        (RS485_DE_PORT |= (1 << RS485_DE_BIT))
+#define rs485_de_off()       (RS485_DE_PORT &= ~(1 << RS485_DE_BIT))
+/** \} */
+
+extern uint8_t rs485_address;
+extern uint16_t rs485_polls;
+
+void rs485_init(void);
+void rs485_set_address(uint8_t address);
+void rs485_rx_address(uint8_t ch);
+uint8_t rs485_tx_char(void);
+
+#endif /* RS485_H */
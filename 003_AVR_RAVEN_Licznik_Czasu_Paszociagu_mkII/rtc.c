@@ -0,0 +1,92 @@
+/*
+ * rtc.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Sub-second RTC timestamps, see rtc.h.
+ */
+
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <util/delay_basic.h>
+#include "rtc.h"
+
+/**
+ *  \addtogroup lcd
+ *  \{
+ */
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Read total_sec and TCNT2 as one.
+ *
+ *   TCNT2 may have wrapped after the interrupts were disabled, with the
+ *   overflow interrupt still pending, so total_sec is one short. The flag is
+ *   read after TCNT2: if it is set and TCNT2 is in its first half, TCNT2 was
+ *   read after the wrap. A high TCNT2 was read before it, and then total_sec
+ *   is right as it is.
+ *
+ *   Both cross from the crystal clock through synchronizers, so a TCNT2 of 0
+ *   may show up a few cycles before the flag. Only then the flag is polled
+ *   up to RTC_SYNC_POLLS more times, once every 256 reads on average. A
+ *   pending overflow ends the wait as soon as its flag shows, the full wait
+ *   is only taken when the interrupt already ran.
+ *
+ *   \param count Returns TCNT2.
+ *
+ *   \return total_sec matching count.
+ */
+static uint32_t rtc_read(uint8_t *count) {
+	uint32_t sec;
+	uint8_t tcnt;
+	uint8_t ovf;
+	uint8_t poll;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		sec = RTC.total_sec;
+		tcnt = TCNT2;
+		ovf = TIFR2 & (1 << TOV2);
+		for (poll = RTC_SYNC_POLLS; !ovf && tcnt == 0 && poll; poll--) {
+			_delay_loop_1(1);
+			ovf = TIFR2 & (1 << TOV2);
+		}
+		if (ovf && tcnt < 0x80) {
+			sec++;
+		}
+	}
+	*count = tcnt;
+	return sec;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Timestamp in 1/RTC_TICK_HZ s, total_sec in the upper 24 bits.
+ */
+uint32_t rtc_stamp(void) {
+	uint8_t count;
+	uint32_t sec = rtc_read(&count);
+
+	return (sec << 8) | count;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Monotonic tick count in 1/RTC_TICK_HZ s since the RTC was started.
+ */
+uint64_t rtc_ticks(void) {
+	uint8_t count;
+	uint32_t sec = rtc_read(&count);
+
+	return ((uint64_t) sec << 8) | count;
+}
+
+/** \}   */
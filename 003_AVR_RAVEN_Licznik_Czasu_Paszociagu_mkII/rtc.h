@@ -0,0 +1,66 @@
+/*
+ * rtc.h
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Reading the TIMER2 RTC of timer.c with sub-second resolution.
+ *
+ *      TIMER2 counts the 32768 Hz crystal divided by 128, so TCNT2 steps
+ *      RTC_TICK_HZ times a second and RTC.total_sec counts its overflows.
+ *      A timestamp is the two put together, total_sec in the upper bits and
+ *      TCNT2 in the low byte. rtc_stamp() wraps after 194 days, which is fine
+ *      for the difference of two stamps; rtc_ticks() does not wrap.
+ *
+ *      total_sec is never set back (calendar_set() only changes the date and
+ *      the time of day), so both are monotonic. tools/rtcsim.c checks that against
+ *      a model of the asynchronous timer, across the overflow.
+ *
+ *      The overflow interrupt updates RTC one field at a time, so outside it
+ *      RTC is only read through rtc_now() or rtc_seconds(). Reading the
+ *      fields one by one can mix two seconds (12:59 and 13:00 read as 12:00),
+ *      and total_sec alone can tear between its bytes.
+ */
+
+#ifndef RTC_H
+#define RTC_H
+
+#include <stdint.h>
+#include <util/atomic.h>
+#include "timer.h"
+
+/** TCNT2 counts per second */
+#define RTC_TICK_HZ          (256)
+/** Polls of TOV2, at least 4 cycles each, for it to catch up with a TCNT2 of 0 */
+#define RTC_SYNC_POLLS       (8)
+
+/**
+ *   \brief Copy the whole of RTC, as of a single second.
+ */
+static inline void rtc_now(t_time *now) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		*now = RTC;
+	}
+}
+
+/**
+ *   \brief RTC.total_sec, read in one piece.
+ */
+static inline uint32_t rtc_seconds(void) {
+	uint32_t sec;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		sec = RTC.total_sec;
+	}
+	return sec;
+}
+
+uint32_t rtc_stamp(void);
+uint64_t rtc_ticks(void);
+
+#endif /* RTC_H */
@@ -0,0 +1,163 @@
+/*
+ * runtime.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Feed-line runtime totals, see runtime.h.
+ */
+
+#include <string.h>
+#include <stdbool.h>
+#include "runtime.h"
+#include "main.h"
+#include "uart.h"
+#include "rtc.h"
+#include "calendar.h"
+#include "temp.h"
+#include "flashrec.h"
+#include "flashlog.h"
+#include "swtimer.h"
+
+/**
+ *  \addtogroup lcd
+ *  \{
+ */
+
+static t_runtime_counters runtime_counters;
+/** Lines running, as last reported */
+static uint8_t runtime_lines;
+/** rtc_seconds() the totals are counted up to */
+static uint32_t runtime_since;
+/** The totals moved since the last checkpoint */
+static bool runtime_dirty;
+
+static flashFile_t runtime_file;
+static flashLog_t runtime_log;
+/** FLASH_LOG_NAME is open, false without flash or once it is full */
+static bool runtime_logging;
+/** Records were added since the log file was last closed */
+static bool runtime_log_dirty;
+
+static t_swtimer runtime_timer;
+static t_swtimer runtime_temp_timer;
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Add the seconds since the last update to the running lines.
+ */
+static void runtime_update(void) {
+	uint32_t now = rtc_seconds();
+	uint32_t run = now - runtime_since;
+	uint8_t line;
+
+	runtime_since = now;
+	if (!run || !runtime_lines) {
+		return;
+	}
+	for (line = 0; line < RUNTIME_LINES; line++) {
+		if (runtime_lines & (1 << line)) {
+			runtime_counters.seconds[line] += run;
+		}
+	}
+	runtime_dirty = true;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Check the result of a log write, logging stops on errors.
+ */
+static void runtime_log_result(int res) {
+	if (res < 0) {
+		runtime_logging = false;
+	} else {
+		runtime_log_dirty = true;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Log the temperature if it changed. Runs from runtime_temp_timer.
+ */
+static void runtime_log_temp(void) {
+	int16_t temp;
+
+	if (!runtime_logging) {
+		return;
+	}
+	temp = temp_get(TEMP_UNIT_CELCIUS);
+	if (!runtime_log.synced || temp != runtime_log.temp) {
+		runtime_log_result(flashLogTemp(&runtime_log, &runtime_file, calendar_epoch(), temp));
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Store the totals in the FLASH_REC_COUNTERS record if they moved,
+ *   and close the log file if it grew. Runs from runtime_timer, and when a
+ *   line starts or stops.
+ */
+static void runtime_checkpoint(void) {
+	if (runtime_log_dirty) {
+		flashClose(&runtime_file);
+		runtime_log_dirty = false;
+	}
+	runtime_update();
+	if (runtime_dirty && flashRecWrite(FLASH_REC_COUNTERS, &runtime_counters, sizeof(runtime_counters)) == 0) {
+		runtime_dirty = false;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Carry on from the last checkpoint, and start checkpointing. Call
+ *   after flashInit().
+ */
+void runtime_init(void) {
+	if (flashRecRead(FLASH_REC_COUNTERS, &runtime_counters, sizeof(runtime_counters)) < 0) {
+		memset(&runtime_counters, 0, sizeof(runtime_counters));
+	}
+	runtime_since = rtc_seconds();
+	swtimer_start(&runtime_timer, runtime_checkpoint,
+			SWTIMER_MS(RUNTIME_CHECKPOINT_PERIOD), SWTIMER_MS(RUNTIME_CHECKPOINT_PERIOD));
+
+	flashLogInit(&runtime_log);
+	runtime_logging = (flashOpen(FLASH_LOG_NAME, &runtime_file) == 0)
+			|| (flashCreate(FLASH_LOG_NAME, &runtime_file) > 0);
+	runtime_log_temp();
+	swtimer_start(&runtime_temp_timer, runtime_log_temp,
+			SWTIMER_MS(RUNTIME_TEMP_PERIOD), SWTIMER_MS(RUNTIME_TEMP_PERIOD));
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief REPORT_LINES handler, the 1284p reports the lines running. This
+ *   will answer with SEND_RUNTIME.
+ *
+ *   \param payload uint8 mask, bit n set while line n runs.
+ *   \param length Payload length, 1.
+ */
+void runtime_report_lines(const uint8_t *payload, uint8_t length) {
+	runtime_update();
+	if (payload[0] != runtime_lines) {
+		runtime_lines = payload[0];
+		if (runtime_logging) {
+			runtime_log_result(flashLogLines(&runtime_log, &runtime_file, calendar_epoch(), runtime_lines));
+		}
+		runtime_checkpoint();
+	}
+	uart_serial_send_frame(SEND_RUNTIME, sizeof(runtime_counters), (uint8_t *) &runtime_counters);
+}
+
+/** \}   */
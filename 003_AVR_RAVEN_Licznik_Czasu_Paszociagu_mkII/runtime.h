@@ -0,0 +1,53 @@
+/*
+ * runtime.h
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Feed-line runtime totals.
+ *
+ *      The 1284p reports which feed lines run with REPORT_LINES, a bit per
+ *      line. Every running line adds its seconds of RTC.total_sec to its
+ *      total, and REPORT_LINES is answered with SEND_RUNTIME carrying all
+ *      the totals, so the 1284p can also just repeat the last mask to read
+ *      them.
+ *
+ *      The totals are checkpointed in the FLASH_REC_COUNTERS record every
+ *      RUNTIME_CHECKPOINT_PERIOD while a line runs. A power cut loses at most
+ *      that much run time, runtime_init() carries on from the record with all
+ *      lines stopped.
+ *
+ *      Every start and stop also goes to the FLASH_LOG_NAME log, see
+ *      flashlog.h, with the temperature every RUNTIME_TEMP_PERIOD if it
+ *      changed. Log times are calendar_epoch() seconds, as total_sec starts
+ *      over at every power up. The log file is closed, so its new records
+ *      can be exported, with the next checkpoint.
+ */
+
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <stdint.h>
+
+/** Feed lines, one bit each in the REPORT_LINES mask */
+#define RUNTIME_LINES               (8)
+/** ms between checkpoints, at most 2047 s for a software timer */
+#define RUNTIME_CHECKPOINT_PERIOD   (60UL * 1000UL)
+/** ms between temperature samples for the log */
+#define RUNTIME_TEMP_PERIOD         (5UL * 60UL * 1000UL)
+
+/** \brief FLASH_REC_COUNTERS record, also the SEND_RUNTIME payload */
+typedef struct {
+	/** Seconds each line has run, little endian */
+	uint32_t seconds[RUNTIME_LINES];
+} t_runtime_counters;
+
+void runtime_init(void);
+void runtime_report_lines(const uint8_t *payload, uint8_t length);
+
+#endif /* RUNTIME_H */
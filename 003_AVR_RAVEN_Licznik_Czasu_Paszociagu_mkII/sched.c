@@ -0,0 +1,161 @@
+/*
+ * sched.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Cooperative event driven scheduler, see sched.h.
+ */
+
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#include "sched.h"
+#include "rtc.h"
+
+/**
+ *  \addtogroup lcd
+ *  \{
+ */
+
+volatile uint8_t sched_events;
+t_sched_stats sched_stats[SCHED_TASK_COUNT];
+uint32_t sched_idle_ticks;
+
+/** \brief Task table, built from sched_tasks.h. */
+static const t_sched_task sched_tasks[SCHED_TASK_COUNT] PROGMEM = {
+#define SCHED_TASK(name, events, flags, handler) { events, flags, handler },
+#include "sched_tasks.h"
+#undef SCHED_TASK
+};
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Take all pending events.
+ */
+static uint8_t sched_take(void) {
+	uint8_t events;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		events = sched_events;
+		sched_events = 0;
+	}
+	return events;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Call the tasks listening to the events, in table order.
+ *
+ *   \param events The events taken.
+ *   \param skip Task flags to leave out, SCHED_UI while a menu page waits.
+ */
+static void sched_dispatch(uint8_t events, uint8_t skip) {
+	t_sched_handler handler;
+	uint32_t start;
+	uint8_t mask;
+	uint8_t i;
+
+	for (i = 0; i < SCHED_TASK_COUNT; i++) {
+		mask = pgm_read_byte(&sched_tasks[i].events) & events;
+		if (!mask || (pgm_read_byte(&sched_tasks[i].flags) & skip)) {
+			continue;
+		}
+		handler = (t_sched_handler) pgm_read_word(&sched_tasks[i].handler);
+
+		start = rtc_stamp();
+		handler(mask);
+		sched_stats[i].ticks += rtc_stamp() - start;
+		if (sched_stats[i].runs != 0xffff) {
+			sched_stats[i].runs++;
+		}
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Sleep in idle mode unless an event is pending.
+ */
+static void sched_sleep(void) {
+	uint32_t start;
+
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	start = rtc_stamp();
+	cli();
+	if (!sched_events) {
+		/* sei() right before sleep_cpu() so no event is missed */
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+	}
+	sei();
+	sched_idle_ticks += rtc_stamp() - start;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Run the tasks for good, this is the main loop.
+ */
+void sched_run(void) {
+	uint8_t events;
+
+	for (;;) {
+		events = sched_take();
+		if (events) {
+			sched_dispatch(events, 0);
+		} else {
+			sched_sleep();
+		}
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Wait for events from a menu page. The tasks not marked SCHED_UI keep
+ *   running meanwhile, the SCHED_UI ones miss the events taken here.
+ *
+ *   \param events SCHED_EV_xxx bits to wait for.
+ *
+ *   \return The events of the mask that were posted.
+ */
+uint8_t sched_wait(uint8_t events) {
+	uint8_t pending;
+
+	for (;;) {
+		pending = sched_take();
+		if (!pending) {
+			sched_sleep();
+			continue;
+		}
+		sched_dispatch(pending, SCHED_UI);
+		if (pending & events) {
+			return pending & events;
+		}
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Clear the run time accounting.
+ */
+void sched_clear_stats(void) {
+	memset(sched_stats, 0, sizeof(sched_stats));
+	sched_idle_ticks = 0;
+}
+
+/** \}   */
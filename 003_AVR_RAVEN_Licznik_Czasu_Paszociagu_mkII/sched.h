@@ -0,0 +1,95 @@
+/*
+ * sched.h
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Cooperative event driven scheduler, it replaces the polled main loop.
+ *
+ *      Interrupts post SCHED_EV_xxx bits with sched_post(). sched_run() takes
+ *      the pending bits and calls every task of sched_tasks.h listening to one
+ *      of them, each task runs to completion. With nothing pending the CPU
+ *      sleeps in idle mode until the next interrupt.
+ *
+ *      A menu page that keeps the LCD and the joystick to itself waits with
+ *      sched_wait() instead of spinning. The tasks marked SCHED_UI are held
+ *      off meanwhile, the others keep running.
+ *
+ *      Run time of every task is accounted in sched_stats, in TIMER2 ticks of
+ *      1/256 s. A task mostly runs well under a tick, so single runs read 0 or
+ *      1, but the sum over many runs is right on average.
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <util/atomic.h>
+#include "modbus.h"
+
+/** \name Events */
+/** \{ */
+#define SCHED_EV_TICK        (0x01)  /**< one second RTC tick, TIMER2 overflow */
+#define SCHED_EV_KEY         (0x02)  /**< joystick scan due, TIMER2 compare */
+#define SCHED_EV_UART        (0x04)  /**< character received or txbuf sent */
+#define SCHED_EV_FLASH       (0x08)  /**< dataflash read done, more are due */
+#define SCHED_EV_TIMER       (0x10)  /**< software timer tick, TIMER2 compare */
+/** \} */
+
+/** Task flag, the task draws on the LCD or reads the joystick */
+#define SCHED_UI             (0x01)
+
+/** \brief Index of each task, see sched_tasks.h */
+enum {
+#define SCHED_TASK(name, events, flags, handler) SCHED_TASK_##name,
+#include "sched_tasks.h"
+#undef SCHED_TASK
+	SCHED_TASK_COUNT
+};
+
+/** \brief A task, called with the pending events it listens to */
+typedef void (*t_sched_handler)(uint8_t events);
+
+/** \brief Task table entry, kept in flash */
+typedef struct {
+	uint8_t events;
+	uint8_t flags;
+	t_sched_handler handler;
+} t_sched_task;
+
+/** \brief Run time accounting of a task */
+typedef struct {
+	uint16_t runs;
+	uint32_t ticks;      /**< run time in TIMER2 ticks of 1/256 s */
+} t_sched_stats;
+
+/* The task handlers */
+#define SCHED_TASK(name, events, flags, handler) void handler(uint8_t);
+#include "sched_tasks.h"
+#undef SCHED_TASK
+
+extern volatile uint8_t sched_events;
+extern t_sched_stats sched_stats[SCHED_TASK_COUNT];
+/** Time spent sleeping with nothing to do, in TIMER2 ticks */
+extern uint32_t sched_idle_ticks;
+
+/**
+ *   \brief Post events, from interrupts or from a task.
+ */
+static inline void sched_post(uint8_t events) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		sched_events |= events;
+	}
+}
+
+void sched_run(void) __attribute__((noreturn));
+uint8_t sched_wait(uint8_t events);
+void sched_clear_stats(void);
+
+#endif /* SCHED_H */
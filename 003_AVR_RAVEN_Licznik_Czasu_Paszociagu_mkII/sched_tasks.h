@@ -0,0 +1,32 @@
+/*
+ * sched_tasks.h
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Tasks run by sched_run(). Each line expands into the task table in
+ *      flash (sched.c), a SCHED_TASK_xxx index and the handler prototype
+ *      (sched.h).
+ *
+ *      SCHED_TASK(name, events, flags, handler)
+ *
+ *      The handler is void handler(uint8_t events) and gets the SCHED_EV_xxx
+ *      bits it listens to that were pending. Tasks run in table order.
+ */
+
+/* No include guard, included once per expansion of SCHED_TASK */
+
+SCHED_TASK(TIMERS, SCHED_EV_TIMER,                  0,        swtimer_task)
+SCHED_TASK(CLOCK,  SCHED_EV_TICK,                   SCHED_UI, main_clock_task)
+SCHED_TASK(KEYS,   SCHED_EV_KEY,                    SCHED_UI, main_key_task)
+#if MODBUS_ENABLE
+SCHED_TASK(MODBUS, SCHED_EV_TICK,                   0,        main_modbus_task)
+#else
+SCHED_TASK(LINK,   SCHED_EV_UART | SCHED_EV_TICK,   0,        main_link_task)
+SCHED_TASK(EXPORT, SCHED_EV_UART | SCHED_EV_TICK | SCHED_EV_FLASH, 0, main_export_task)
+#endif
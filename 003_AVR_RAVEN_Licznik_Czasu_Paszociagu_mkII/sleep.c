@@ -49,6 +49,7 @@
 #include <avr/sleep.h>
 #include <avr/wdt.h>
 #include <util/delay.h>
+#include <util/atomic.h>
 #include <stdbool.h>
 #include "main.h"
 #include "sleep.h"
@@ -56,6 +57,8 @@
 #include "key.h"
 #include "timer.h"
 #include "lcd.h" //temp
+#include "modbus.h"
+#include "rs485.h"
 
 /**
  * \addtogroup lcd
@@ -97,6 +100,9 @@ void sleep_now(int howlong) {
 
 	}
 
+	/* The TIMER2 tick would wake the CPU 32 times a second */
+	timer2_tick_stop();
+
 	/* Enable pin change 0 wakeup interrupt */
 	EIMSK |= (1 << PCIE0);
 	/* Select joystick button input pin */
@@ -113,33 +119,99 @@ void sleep_now(int howlong) {
 	EIMSK &= ~(1 << PCIE0);
 	PCMSK0 &= ~(1 << PCINT2);
 	/*TIMSK2&= ~(1 << TOIE2);*/
+	timer2_tick_start();
 }
 
 /*---------------------------------------------------------------------------*/
 
 /**
+ *   \brief Idle sleeps for the given time or until a character is received.
+ *   TIMER1 must be running at 128us per tick, see timer_init(). With
+ *   RS485_ENABLE it runs free at 8us per tick for the bus turnaround instead,
+ *   compare A is used on top of it and the timer is left as it is.
+ *
+ *   \param ms Time to wait in ms, at most 8191 (524 with RS485_ENABLE).
+ */
+static void sleep_idle(uint16_t ms) {
+#if RS485_ENABLE
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		/* TCNT1 and OCR1A share the TEMP register with the compare B interrupt */
+		OCR1A = TCNT1 + ms * 125;             //8us per tick
+	}
+	TIFR1 = (1 << OCF1A);
+#else
+	TCNT1 = 0;
+	OCR1A = (ms << 3) - 1;                    //~1.024ms per 8 ticks
+#endif
+	timer1_flag = 0;
+	TIMSK1 |= (1 << OCIE1A);
+
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	for (;;) {
+		cli();
+		if (timer1_flag || rx_char_ready()) {
+			sei();
+			break;
+		}
+		/* sei() right before sleep_cpu() so no wakeup IRQ is missed */
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+	}
 
+	TIMSK1 &= ~(1 << OCIE1A);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
  *   \brief This will send a wakeup command to ATmega1284p
  *   It may already be awake, if not it will respond during the next wake cycle
  *   Upon receiving the command it will return an acknowledgement frame
  *
- *   \brief This will send a single character forever to the ATmega1284p to cause a wakeup.
- *   The 1284p polls the USART for new data during each sleep cycle.  Upon receiving a
- *   character from the user LCD, it will wake up and send an acknowledgement frame.
+ *   SEND_WAKE is repeated with an exponential backoff from WAKE_BACKOFF_FIRST
+ *   to WAKE_BACKOFF_MAX ms, idle sleeping in between, until a character comes
+ *   back. After WAKE_TIMEOUT ms "WAKE ERR" and the attention symbol are shown.
+ *   tools/wakesim models the charge this costs against the old 1 ms flood.
+ *
+ *   \return true if the 1284p answered, false on timeout.
+ *   Always false with MODBUS_ENABLE, the line and TIMER1 belong to the slave.
  */
-void sleep_wakeup(void) {
+bool sleep_wakeup(void) {
+#if MODBUS_ENABLE
+	return false;
+#else
+	uint16_t backoff = WAKE_BACKOFF_FIRST;
+	uint16_t waited = 0;
+
 	lcd_puts_P(PSTR("WAKE 1284p"));
+	lcd_symbol_clr(LCD_SYMBOL_ATT);
+
+#if !RS485_ENABLE
+	/* TIMER1 paces the retries, on the bus it is already running */
+	timer_init();
+#endif
+
+	while (!rx_char_ready()) {
+		if (waited >= WAKE_TIMEOUT) {
+			lcd_puts_P(PSTR("WAKE ERR"));
+			lcd_symbol_set(LCD_SYMBOL_ATT);
+			return false;
+		}
 
-	/* Flood 1284p with wake commands until it responds*/
-	for (;;) {
 		uart_serial_send_frame(SEND_WAKE, 0, 0);
-		_delay_us(1000);
-		if (rx_char_ready())
-			break;
+		sleep_idle(backoff);
+
+		waited += backoff;
+		if (backoff < WAKE_BACKOFF_MAX)
+			backoff <<= 1;
 	}
 
 	/* Get a frame back */
 	uart_serial_rcv_frame(true);
+	return true;
+#endif
 }
 
 /*---------------------------------------------------------------------------*/
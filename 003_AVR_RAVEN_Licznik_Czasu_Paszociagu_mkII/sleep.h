@@ -48,8 +48,17 @@
  #ifndef __SLEEP_H__
  #define __SLEEP_H__
 
+ #include <stdbool.h>
+
+ /** \name Wake handshake timing, in ms */
+ /** \{ */
+ #define WAKE_BACKOFF_FIRST  (2)     /**< Wait after the first SEND_WAKE. */
+ #define WAKE_BACKOFF_MAX    (128)   /**< The wait doubles up to this. */
+ #define WAKE_TIMEOUT        (4000)  /**< Give up and show WAKE ERR after this. */
+ /** \} */
+
  /* Prototypes */
  void sleep_now(int howlong);
- void sleep_wakeup(void);
+ bool sleep_wakeup(void);
 
  #endif /* __SLEEP_H__ */
@@ -0,0 +1,146 @@
+/*
+ * swtimer.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Timer wheel, see swtimer.h.
+ */
+
+#include <stddef.h>
+#include <util/atomic.h>
+#include "swtimer.h"
+
+/**
+ *  \addtogroup lcd
+ *  \{
+ */
+
+#define SWTIMER_MASK (SWTIMER_SLOTS - 1)
+
+volatile uint16_t swtimer_now;
+
+/** last tick the wheel was turned to */
+static uint16_t swtimer_done;
+static t_swtimer *swtimer_wheel[SWTIMER_SLOTS];
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Link a timer in front of a list.
+ */
+static void swtimer_link(t_swtimer **head, t_swtimer *timer) {
+	timer->next = *head;
+	if (timer->next) {
+		timer->next->pprev = &timer->next;
+	}
+	timer->pprev = head;
+	*head = timer;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Read the tick count, it is advanced from the interrupt.
+ */
+static uint16_t swtimer_tick(void) {
+	uint16_t now;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		now = swtimer_now;
+	}
+	return now;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Put a timer on the wheel.
+ *
+ *   \param base Tick the delay counts from, swtimer_done or later.
+ *   \param delay Ticks from base, at least 1.
+ */
+static void swtimer_insert(t_swtimer *timer, uint16_t base, uint16_t delay) {
+	/* The wheel stands at swtimer_done, the turns are counted from there */
+	uint32_t ticks = (uint16_t) (base - swtimer_done) + (uint32_t) delay;
+
+	timer->rounds = (ticks - 1) / SWTIMER_SLOTS;
+	swtimer_link(&swtimer_wheel[(base + delay) & SWTIMER_MASK], timer);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Start or restart a timer.
+ *
+ *   \param timer The timer.
+ *   \param handler Called on expiry.
+ *   \param delay Ticks to the first expiry, 0 is taken as 1.
+ *   \param period Ticks between the following expiries, 0 for a one-shot.
+ */
+void swtimer_start(t_swtimer *timer, t_swtimer_handler handler, uint16_t delay, uint16_t period) {
+	swtimer_stop(timer);
+	timer->handler = handler;
+	timer->period = period;
+	swtimer_insert(timer, swtimer_tick(), delay ? delay : 1);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief Stop a timer, stopping a stopped timer does nothing.
+ */
+void swtimer_stop(t_swtimer *timer) {
+	if (!timer->pprev) {
+		return;
+	}
+	*timer->pprev = timer->next;
+	if (timer->next) {
+		timer->next->pprev = timer->pprev;
+	}
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ *   \brief TIMERS task, turns the wheel up to swtimer_now and runs the
+ *   handlers of the timers that expired.
+ */
+void swtimer_task(uint8_t events) {
+	t_swtimer *expired;
+	t_swtimer *timer;
+	t_swtimer *next;
+
+	while (swtimer_done != swtimer_tick()) {
+		swtimer_done++;
+
+		/* Move the expired timers aside first, the handlers may change the wheel */
+		expired = NULL;
+		for (timer = swtimer_wheel[swtimer_done & SWTIMER_MASK]; timer; timer = next) {
+			next = timer->next;
+			if (timer->rounds) {
+				timer->rounds--;
+			} else {
+				swtimer_stop(timer);
+				swtimer_link(&expired, timer);
+			}
+		}
+
+		while ((timer = expired)) {
+			swtimer_stop(timer);
+			if (timer->period) {
+				swtimer_insert(timer, swtimer_done, timer->period);
+			}
+			timer->handler();
+		}
+	}
+}
+
+/** \}   */
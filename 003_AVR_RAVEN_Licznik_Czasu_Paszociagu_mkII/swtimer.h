@@ -0,0 +1,71 @@
+/*
+ * swtimer.h
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/**
+ * \file
+ *
+ * \brief
+ *      Software timers on the TIMER2 compare tick, SWTIMER_HZ per second.
+ *
+ *      The timers hang off a wheel of SWTIMER_SLOTS lists, one per tick. A
+ *      timer goes in the list of the tick it expires on, with the number of
+ *      wheel turns left, so starting and stopping are O(1) and every tick
+ *      only walks the timers of a single list. The interrupt only counts the
+ *      tick, handlers run from the TIMERS task of the scheduler, so they may
+ *      send frames, touch the LCD and start or stop any timer.
+ *
+ *      Periodic timers are put back relative to the tick they expired on, so
+ *      they do not drift when the task runs late, a timer started from a
+ *      handler or a task counts from the current tick. The tick count is 16
+ *      bits, so the task can fall over half an hour behind without losing
+ *      wheel turns. The tick is stopped while sleep_now() sleeps, the timers
+ *      carry on where they were on wakeup.
+ */
+
+#ifndef SWTIMER_H
+#define SWTIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "timer.h"
+
+#define SWTIMER_HZ           TIMER2_TICK_HZ
+#define SWTIMER_SLOTS        (32)    /**< power of two */
+
+/** Ticks for a time in ms, rounded up */
+#define SWTIMER_MS(ms)       ((uint16_t) (((uint32_t) (ms) * SWTIMER_HZ + 999) / 1000))
+
+/** \brief Timer handler, runs in task context */
+typedef void (*t_swtimer_handler)(void);
+
+/** \brief A software timer, owned by its user, all zero when stopped */
+typedef struct t_swtimer {
+	struct t_swtimer *next;
+	/** link pointing to this timer, NULL while stopped */
+	struct t_swtimer **pprev;
+	t_swtimer_handler handler;
+	/** ticks between expiries, 0 for a one-shot timer */
+	uint16_t period;
+	/** wheel turns left before it expires */
+	uint16_t rounds;
+} t_swtimer;
+
+/** Tick count, advanced by the TIMER2 compare interrupt */
+extern volatile uint16_t swtimer_now;
+
+/**
+ *   \brief Check whether a timer is running.
+ */
+static inline bool swtimer_active(const t_swtimer *timer) {
+	return timer->pprev != 0;
+}
+
+void swtimer_start(t_swtimer *timer, t_swtimer_handler handler, uint16_t delay, uint16_t period);
+void swtimer_stop(t_swtimer *timer);
+void swtimer_task(uint8_t events);
+
+#endif /* SWTIMER_H */
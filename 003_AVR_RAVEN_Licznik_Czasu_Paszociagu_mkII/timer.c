@@ -51,6 +51,10 @@
 #include "timer.h"
 #include "key.h"
 #include "beep.h"
+#include "sched.h"
+#include "swtimer.h"
+#include "rtc.h"
+#include "calendar.h"
 
 
 /**
@@ -59,7 +63,19 @@
  */
 
 volatile uint8_t timer_flag;
-volatile t_time RTC;
+volatile uint8_t timer1_flag;
+/** 2000-01-01, a Saturday, until calendar_init() */
+volatile t_time RTC = { .day = 1, .month = 1, .wday = 6, .flags = TIME_UNCERTAIN };
+
+/** \brief Next OCR2A value, OCR2A is written through a temporary register in async mode. */
+static uint8_t timer2_tick_next;
+
+/** \brief HH:MM as on the LCD, in BCD and as segments, kept by the overflow interrupt. */
+static uint16_t clock_bcd;
+static lcd_num_image_t clock_image;
+/** \brief RTC.hour and RTC.min that clock_bcd shows, -1 until the first overflow. */
+static int8_t clock_hour = -1;
+static int8_t clock_min;
 
 /*---------------------------------------------------------------------------*/
 
@@ -93,7 +109,7 @@ void timer_start(void) {
 	TCNT1 = 0;
 
 	/* Enable TIMER1 output compare interrupt. */
-	TIMSK1 = (1 << OCIE1A);
+	TIMSK1 |= (1 << OCIE1A);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -114,7 +130,71 @@ void timer_stop(void) {
 
 ISR
 (TIMER1_COMPA_vect) {
+	/* Set the irq flag. */
+	timer1_flag = 1;
+}
 
+/**
+ *   \brief Redraw the digits of clock_image that differ from clock_bcd.
+ */
+static void clock_draw(uint16_t bcd) {
+	uint16_t changed = bcd ^ clock_bcd;
+	uint8_t dig;
+
+	clock_bcd = bcd;
+	for (dig = 0; changed; dig++) {
+		if (changed & 0xF) {
+			lcd_num_image_digit(&clock_image, bcd & 0xF, dig);
+		}
+		changed >>= 4;
+		bcd >>= 4;
+	}
+}
+
+/**
+ *   \brief Bring the clock up to RTC.hour and RTC.min, from the overflow
+ *   interrupt.
+ *
+ *   The usual case is the next minute, which is counted on in BCD and
+ *   mostly redraws one digit. Setting the clock converts from scratch.
+ */
+static void clock_update(void) {
+	uint16_t bcd = clock_bcd;
+	int8_t hour = clock_hour;
+	int8_t min = clock_min + 1;
+
+	if (min >= 60) {
+		min = 0;
+		if (++hour >= 24) {
+			hour = 0;
+		}
+	}
+
+	if (RTC.min == min && RTC.hour == hour) {
+		bcd++;
+		if ((bcd & 0x000F) == 0x000A) {
+			bcd += 0x0006;
+		}
+		if ((bcd & 0x00FF) == 0x0060) {
+			bcd += 0x0100 - 0x0060;
+			if ((bcd & 0x0F00) == 0x0A00) {
+				bcd += 0x0600;
+			}
+			if (bcd == 0x2400) {
+				bcd = 0;
+			}
+		}
+	} else {
+		hour = RTC.hour;
+		min = RTC.min;
+		bcd = itobcd(hour * 100 + min);
+		/* draw every digit */
+		clock_bcd = ~bcd;
+	}
+
+	clock_hour = hour;
+	clock_min = min;
+	clock_draw(bcd);
 }
 
 /**
@@ -134,10 +214,29 @@ ISR(TIMER2_OVF_vect) {
 	}
 	if (RTC.hour >= 24) {
 		RTC.hour = 0;
+		calendar_next_day();
+	}
+	/* Also catches the clock being set, from the menu or over Modbus */
+	if (RTC.min != clock_min || RTC.hour != clock_hour) {
+		clock_update();
 	}
 
 	/* Set the irq flag. */
 	timer_flag = 1;
+	sched_post(SCHED_EV_TICK);
+}
+
+/**
+ *   \brief This is the interrupt subroutine for the TIMER2 output compare, the
+ *   TIMER2_TICK_HZ tick of the joystick scan and the software timers.
+ */
+ISR(TIMER2_COMP_vect) {
+	/* OCR2A wraps along with TCNT2 */
+	timer2_tick_next += TIMER2_TICK_STEP;
+	OCR2A = timer2_tick_next;
+
+	swtimer_now++;
+	sched_post(SCHED_EV_KEY | SCHED_EV_TIMER);
 }
 
 /**
@@ -162,6 +261,7 @@ void timer2_start(void) {
 	TIMSK2 = 0;
 	/** Enable Timer2 overflow IRQ */
 	TIMSK2 |= (1 << TOIE2);
+	timer2_tick_start();
 }
 
 /**
@@ -170,31 +270,74 @@ void timer2_start(void) {
 void timer2_stop(void) {
 	/* Disable TIMER2 output overflow interrupt. */
 	TIMSK2 &= ~(1 << TOIE2);
+	timer2_tick_stop();
+}
+
+/**
+ *   \brief Start the TIMER2_TICK_HZ tick on the TIMER2 output compare.
+ */
+void timer2_tick_start(void) {
+	timer2_tick_next = TCNT2 + TIMER2_TICK_STEP;
+	/* Wait until the last OCR2A write is through */
+	while (ASSR & (1 << OCR2UB))
+		;
+	OCR2A = timer2_tick_next;
+	TIFR2 = (1 << OCF2A);
+	TIMSK2 |= (1 << OCIE2A);
+}
+
+/**
+ *   \brief Stop the TIMER2_TICK_HZ tick, so it does not wake the CPU from sleep.
+ */
+void timer2_tick_stop(void) {
+	TIMSK2 &= ~(1 << OCIE2A);
+}
+
+/**
+ *   \brief Show the time as HH:MM, from the segments the overflow interrupt
+ *   keeps ready. Blank until the first overflow.
+ */
+void show_clock(void) {
+	lcd_num_image_t image;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		image = clock_image;
+	}
+	lcd_num_image_put(&image);
 }
 
 /**
  *   \brief get hour - hour and minutes.
  *
- *	 \param time pointer to t_time struct
- *
  *   \return uint16_t hour Hour and minutes as DEC value
  */
 uint16_t get_hour(void) {
-	return ((RTC.hour * 100) + (RTC.min));
+	t_time now;
+
+	rtc_now(&now);
+	return ((now.hour * 100) + (now.min));
 }
 
 /**
- *   \brief incr_hour - increment/decrement hour.
+ *   \brief incr_hour - increment/decrement hour, wrapping within the day.
  *
  */
 void incr_hour(int8_t incr_val) {
-	RTC.hour += incr_val;
-	if(RTC.hour < 0) RTC.hour += 24;
-	else RTC.hour = RTC.hour % 24;
+	uint32_t epoch = calendar_epoch();
+	int8_t hour = (epoch % 86400UL) / 3600;
+	int8_t next = (hour + incr_val + 24) % 24;
+
+	calendar_set(epoch + (int32_t) (next - hour) * 3600, RTC.flags);
 }
 
 
 
+/**
+ *   \brief Set the hour and minute from the joystick, left/right pick the
+ *   field, up/down change it, enter leaves. Waits for the joystick with
+ *   sched_wait(), so the link and the software timers keep running. The
+ *   new time is checkpointed on the way out, see calendar.h.
+ */
 void set_real_time(volatile t_time * RTC_timer) {
 	uint8_t time_pos = 0;
 	int8_t key_flag = 0;
@@ -209,6 +352,9 @@ void set_real_time(volatile t_time * RTC_timer) {
 	while( !(key_flag == -2) ) {
 		key_flag = 0;
 
+		while (!is_button()) {
+			sched_wait(SCHED_EV_KEY);
+		}
 		switch (get_button()) {
 			case KEY_UP:
 				key_flag = 1;
@@ -245,19 +391,22 @@ void set_real_time(volatile t_time * RTC_timer) {
 		lcd_num_putdec(get_hour(), LCD_NUM_PADDING_ZERO);
 	}
 
+	 calendar_checkpoint();
 	 two_tone_beep(0);
 	 timer2_start();
 }
 
 
 /**
- *   \brief incr_hour - increment/decrement minutes.
+ *   \brief incr_min - increment/decrement minutes, wrapping within the hour.
  *
  */
 void incr_min(int8_t incr_val) {
-	RTC.min += incr_val;
-	if(RTC.min < 0) RTC.min += 60;
-	else RTC.min = RTC.min % 60;
+	uint32_t epoch = calendar_epoch();
+	int8_t min = (epoch % 3600) / 60;
+	int8_t next = (min + incr_val + 60) % 60;
+
+	calendar_set(epoch + (int32_t) (next - min) * 60, RTC.flags);
 }
 
 
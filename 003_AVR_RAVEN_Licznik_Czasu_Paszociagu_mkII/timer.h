@@ -58,15 +58,34 @@ typedef struct {
 	volatile int8_t min;
 	/** volatile uint8_t hour */
 	volatile int8_t hour;
+	/** day of the month, 1-31 */
+	volatile int8_t day;
+	/** month, 1-12 */
+	volatile int8_t month;
+	/** years since 2000, see calendar.h */
+	volatile int8_t year;
+	/** day of the week, 0 is Sunday */
+	volatile int8_t wday;
+	/** TIME_xxx flags */
+	volatile uint8_t flags;
 	/** total seconds */
 	volatile uint32_t total_sec;
 } t_time;
 
+/** t_time flag, carried on from a checkpoint and not set by the 1284p since */
+#define TIME_UNCERTAIN      (0x01)
+
 extern volatile uint8_t timer_flag;
+extern volatile uint8_t timer1_flag;
 extern volatile t_time RTC;
 
 #define _1_SEC      (0x1E84);
 
+/** Joystick scans and software timer ticks per second, on the TIMER2 output compare */
+#define TIMER2_TICK_HZ      (32)
+/** OCR2A step between ticks, TIMER2 counts at 256 Hz */
+#define TIMER2_TICK_STEP    (256 / TIMER2_TICK_HZ)
+
 void timer_init(void);
 void timer_start(void);
 void timer_stop(void);
@@ -74,7 +93,10 @@ void timer_stop(void);
 void timer2asRTC_init(void);
 void timer2_start(void);
 void timer2_stop(void);
+void timer2_tick_start(void);
+void timer2_tick_stop(void);
 uint16_t get_hour(void);
+void show_clock(void);
 void incr_hour(int8_t incr_val);
 void set_real_time(volatile t_time * RTC_timer);
 void incr_min(int8_t incr_val);
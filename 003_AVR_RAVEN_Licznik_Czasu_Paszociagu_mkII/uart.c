@@ -47,87 +47,88 @@
   *
   */
 
+ #include <avr/interrupt.h>
+ #include <avr/sleep.h>
+ #include <util/atomic.h>
+ #include <avr/pgmspace.h>
  #include "uart.h"
  #include "lcd.h"
  #include "main.h"
  #include "menu.h"
  #include "beep.h"
+ #include "timer.h"
+ #include "rtc.h"
+ #include "calendar.h"
+ #include "bulk.h"
+ #include "export.h"
+ #include "cobs.h"
+ #include "modbus.h"
+ #include "rs485.h"
+ #include "sched.h"
+ #include "flashfile.h"
+ #include "runtime.h"
 
  /**
   *  \addtogroup lcd
   *  \{
  */
 
- #define TIMEOUT (0xff)
-
  /** \brief The RX circular buffer, for storing characters from serial port. */
- tcirc_buf rxbuf;
+ t_ring rxbuf;
 
- /*---------------------------------------------------------------------------*/
+ /** \brief The TX circular buffer, drained by the USART data register empty interrupt. */
+ t_ring txbuf;
 
- /**
-  *   \brief This will intialize the circular buffer head and tail of tcirc_buf struct.
-  *
-  *   \param cbuf Pointer to buffer to initialize.
- */
- void
- uart_init_circ_buf(tcirc_buf *cbuf)
- {
-     cbuf->head = cbuf->tail = 0;
- }
+ /** \brief Set by the USART TX complete interrupt once txbuf is empty and sent. */
+ volatile uint8_t uart_tx_idle = true;
 
- /*---------------------------------------------------------------------------*/
+ /** \brief Current UART_SPEED_xxx of the 1284p link. */
+ static uint8_t link_speed;
 
- /**
-  *   \brief This will add a new character to the circular buffer.
-  *
-  *   \param cbuf Pointer to buffer where character will be stored.
-  *   \param ch Character to store into buffer.
- */
- void
- uart_add_to_circ_buf(tcirc_buf *cbuf, uint8_t ch)
- {
-     /* Add char to buffer */
-     uint8_t newhead = cbuf->head;
-     newhead++;
-     if (newhead >= BUFSIZE){
-         newhead = 0;
-     }
-     if (newhead == cbuf->tail){
-         /* Buffer full, quit it */
-         return;
-     }
+ /** \brief Errors seen at the current link speed, each good frame takes one off. */
+ static volatile uint8_t link_errors;
 
-     cbuf->buf[cbuf->head] = ch;
-     cbuf->head = newhead;
- }
+ /** \brief Current UART_FRAMING_xxx of the 1284p link. */
+ static uint8_t link_framing;
 
- /*---------------------------------------------------------------------------*/
+ /** \brief REPORT_LINK_SPEED payload, speed 0xFF until the 1284p answers. */
+ static uint8_t link_ack;
+ static uint8_t link_ack_framing;
 
- /**
-  *   \brief This will get a character from the buffer requested.
-  *
-  *   \param cbuf Pointer to buffer to get character from.
-  *
-  *   \return retval Return character from buffer.
- */
- uint8_t
- uart_get_from_circ_buf(tcirc_buf *cbuf)
- {
-     /* Get char from buffer. */
-     /* Be sure to check first that there is a char in buffer. */
-     uint8_t newtail = cbuf->tail;
-     uint8_t retval = cbuf->buf[newtail];
+ /** \brief UBRR0 value for each link speed, all but UART_SPEED_38400 use U2X mode. */
+ static const uint8_t link_ubrr[UART_SPEED_COUNT] = {
+     BAUD_RATE_38400, BAUD_RATE_250K_U2X, BAUD_RATE_500K_U2X
+ };
 
-     newtail++;
-     if (newtail >= BUFSIZE){
-         /* Rollover */
-         newtail = 0;
-     }
-     cbuf->tail = newtail;
+ static void uart_rx_ping(const uint8_t *payload, uint8_t length);
+ static void uart_rx_ping_beep(const uint8_t *payload, uint8_t length);
+ static void uart_rx_text_msg(const uint8_t *payload, uint8_t length);
+ static void uart_rx_link_speed(const uint8_t *payload, uint8_t length);
+ static void uart_rx_link_stats(const uint8_t *payload, uint8_t length);
 
-     return retval;
- }
+ /** \brief Command table, built from uart_cmds.h. */
+ static const tuart_cmd uart_cmd_table[UART_CMD_COUNT] PROGMEM = {
+ #define UART_CMD(cmd, min_len, max_len, handler) { cmd, min_len, max_len, handler },
+ #include "uart_cmds.h"
+ #undef UART_CMD
+ };
+
+ uint16_t uart_cmd_count[UART_CMD_COUNT];
+ uint16_t uart_cmd_rejected;
+ volatile tuart_stats uart_stats;
+
+ /** \brief Frame parser state, fed from rxbuf by uart_rx_poll(). */
+ static trx_state rx_state;
+ static uint8_t rx_count;        /**< Payload bytes received so far. */
+ static uint8_t rx_drop;         /**< Frame rejected by the command table, skip to EOF. */
+ static uint8_t rx_cobs[UART_MAX_PAYLOAD + 2];  /**< COBS block up to the delimiter, code, cmd, payload. */
+ static uint8_t rx_last_tick;    /**< Low byte of RTC.total_sec at the last byte received. */
+ static tuart_frame rx_frame;
+
+ /** \brief Queue of complete frames waiting for uart_get_frame(). */
+ static tuart_frame rx_queue[UART_FRAME_QUEUE];
+ static uint8_t rx_queue_head;
+ static uint8_t rx_queue_count;
 
  /*---------------------------------------------------------------------------*/
 
@@ -137,21 +138,24 @@
  void
  uart_clear_rx_buf(void)
  {
-     rxbuf.tail = rxbuf.head = 0;
+     /* Only the consumer index moves, the RX interrupt may be adding */
+     rxbuf.tail = rxbuf.head;
  }
 
  /**
-  *   \brief This will check for a character in the requested buffer.
-  *
-  *   \param cbuf Pointer to buffer to check for any characters.
-  *
-  *   \return True if buffer empty.
+  *   \brief This will start draining the TX buffer from the USART data register
+  *   empty interrupt.
  */
- uint8_t
- uart_circ_buf_has_char(tcirc_buf *cbuf)
+ static void
+ uart_tx_start(void)
  {
-     /* Return true if buffer empty */
-     return (cbuf->head != cbuf->tail);
+     ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+         uart_tx_idle = false;
+ #if !RS485_ENABLE
+         /* On the RS-485 bus the master's poll starts the transmitter */
+         UCSR0B = (UCSR0B & ~(1 << TXCIE0)) | (1 << UDRIE0);
+ #endif
+     }
  }
 
  /*---------------------------------------------------------------------------*/
@@ -192,33 +196,6 @@
 
  /*---------------------------------------------------------------------------*/
 
- /**
-  *   \brief This will wait for a new character from the ATmega1284p and timeout
-  *   if no new character is received.
-  *
-  *   \retval TIMEOUT Returns if timeout has occured.
-  *   \return retval Character returned upon seeing rx_char_ready()
- */
- uint8_t
- uart_get_char_rx(void)
- {
-     /* Gets a serial char, and waits for timeout */
-     uint32_t timex = 5000000;
-     uint8_t retval;
-
-     while (!rx_char_ready()){
-         if (!timex--){
-             /* Timeout, return timeout */
-             return TIMEOUT;
-         }
-     }
-
-     retval = uart_get_from_circ_buf(&rxbuf);
-     return retval;
- }
-
- /*---------------------------------------------------------------------------*/
-
  /**
   *   \brief Initialize UART to 38400 Baud Rate and only
   *   enable UART for transmission.
@@ -230,6 +207,11 @@
      PRR &= ~(1 << PRUSART0);
 
      uart_clear_rx_buf();
+     ring_init(&txbuf);
+     uart_tx_idle = true;
+     link_speed = UART_SPEED_38400;
+     link_framing = UART_FRAMING_SOF;
+     link_errors = 0;
      /* 38400 baud @ 8 MHz internal RC oscillator (error = 0.2%) */
      UBRR0 = BAUD_RATE_38400;
 
@@ -258,20 +240,92 @@
  /*---------------------------------------------------------------------------*/
 
  /**
-  *   \brief Send one byte over the uart. This is called to send binary commands.
+  *   \brief Queue one byte for the uart. This is called to send binary commands.
+  *   Only waits if the TX buffer is full.
   *
   *   \param byte The byte of data to send out the uart.
  */
  void
  uart_send_byte(uint8_t byte)
  {
-     /* Wait for last char to be gone... */
-     while(!(UCSR0A & (1 << UDRE0)))
+     /* Wait for room in the TX buffer... */
+     while (!ring_put(&txbuf, byte))
          ;
-     UDR0 = byte;
+     uart_tx_start();
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief Wait until the last queued byte has left the transmitter. The CPU
+  *   idles until the TX complete interrupt. Call this before turning off the
+  *   UART or entering a sleep mode that stops the USART clock.
+ */
+ void
+ uart_tx_flush(void)
+ {
+     set_sleep_mode(SLEEP_MODE_IDLE);
+     cli();
+     while (!uart_tx_idle){
+         /* sei() delays interrupts by one instruction, so none can slip in before sleep */
+         sleep_enable();
+         sei();
+         sleep_cpu();
+         sleep_disable();
+         cli();
+     }
+     sei();
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief This is the USART data register empty interrupt. It moves the next
+  *   byte of the TX buffer to the transmitter.
+ */
+ ISR
+ (USART_UDRE_vect)
+ {
+ #if RS485_ENABLE
+     /* Only the frames granted by the last poll, then the end of turn */
+     if (rs485_tx_char()){
+         UCSR0A |= (1 << TXC0);
+         return;
+     }
+ #else
+     if (ring_count(&txbuf)){
+         UDR0 = ring_get(&txbuf);
 
-     /* Clear the TXC bit to allow transmit complete test before sleep*/
-     UCSR0A |=(1 << TXC0);
+         /* Clear the TXC bit, it must only fire after the last byte */
+         UCSR0A |= (1 << TXC0);
+     }
+     if (ring_count(&txbuf)){
+         return;
+     }
+ #endif
+     /* Buffer empty, wait for the last byte to leave the shift register */
+     UCSR0B = (UCSR0B & ~(1 << UDRIE0)) | (1 << TXCIE0);
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief This is the USART TX complete interrupt. It signals tx_done() to the
+  *   sleep paths.
+ */
+ ISR
+ (USART_TX_vect)
+ {
+     UCSR0B &= ~(1 << TXCIE0);
+ #if RS485_ENABLE
+     /* Release the bus, frames queued after the poll wait for the next one */
+     rs485_de_off();
+     uart_tx_idle = !ring_count(&txbuf);
+ #else
+     uart_tx_idle = true;
+ #endif
+     /* Room in txbuf for whoever was waiting on it */
+     sched_post(SCHED_EV_UART);
  }
 
  /*---------------------------------------------------------------------------*/
@@ -284,16 +338,154 @@
  {
      /* Get byte from serial port, put in Rx Buffer. */
      uint8_t retval;
+     uint8_t status;
 
+     /* Error flags are only valid before UDR0 is read */
+     status = UCSR0A;
+     if (status & ((1 << FE0)|(1 << DOR0)|(1 << UPE0))){
+         if (status & (1 << DOR0)){
+             UART_STAT_INC(uart_stats.rx_overrun);
+         }
+         if (status & (1 << FE0)){
+             UART_STAT_INC(uart_stats.rx_frame_err);
+         }
+         if (status & (1 << UPE0)){
+             UART_STAT_INC(uart_stats.rx_parity_err);
+         }
+         if (link_errors < 0xff){
+             link_errors++;
+         }
+     }
+ #if RS485_ENABLE
+     /* The ninth bit marks an address character, it must be read before UDR0 */
+     if (UCSR0B & (1 << RXB80)){
+         rs485_rx_address(UDR0);
+         return;
+     }
+ #endif
      retval = UDR0;
-     uart_add_to_circ_buf(&rxbuf, retval);
+ #if MODBUS_ENABLE
+     modbus_rx_char(status, retval);
+ #else
+     if (!ring_put(&rxbuf, retval)){
+         UART_STAT_INC(uart_stats.rx_buf_full);
+     }
+     sched_post(SCHED_EV_UART);
+ #endif
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief This function queues raw bytes for the transmitter without waiting.
+  *   Nothing is queued unless all of them fit, so it is safe from interrupts.
+  *
+  *   \param buf Bytes to send.
+  *   \param length Number of bytes.
+  *
+  *   \retval true The bytes were queued.
+  *   \retval false Not enough room in the TX buffer.
+ */
+ uint8_t
+ uart_queue_raw(const uint8_t *buf, uint8_t length)
+ {
+     if (ring_free(&txbuf) < length){
+         return false;
+     }
+
+     ring_write(&txbuf, buf, length);
+     uart_tx_start();
+
+     return true;
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief This function queues a COBS frame, see uart_queue_frame(). The
+  *   frame is encoded straight into the TX buffer the way cobs_encode() does
+  *   it in place, each code byte staged once the next 0x00 is found.
+ */
+ static uint8_t
+ uart_queue_cobs(uint8_t cmd, uint8_t payload_length, uint8_t *payload)
+ {
+     uint8_t code_pos = 0;
+     uint8_t pos;
+     uint8_t code;
+     uint8_t ch;
+
+     /* code byte, cmd, payload and the delimiter */
+     if (payload_length + 3 > RING_SIZE || ring_free(&txbuf) < payload_length + 3){
+         return false;
+     }
+
+     for (pos = 1; pos <= payload_length + 1; pos++){
+         ch = (pos == 1) ? cmd : payload[pos - 2];
+         if (ch == 0){
+             code = pos - code_pos;
+             ring_stage(&txbuf, code_pos, &code, 1);
+             code_pos = pos;
+         }
+         else {
+             ring_stage(&txbuf, pos, &ch, 1);
+         }
+     }
+     code = pos - code_pos;
+     ring_stage(&txbuf, code_pos, &code, 1);
+     ch = 0;
+     ring_stage(&txbuf, pos, &ch, 1);
+     ring_commit(&txbuf, pos + 1);
+     uart_tx_start();
+
+     return true;
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief This function queues a binary command frame for the ATmega1284p
+  *   without waiting for the transmitter. The frame is queued whole or not at all,
+  *   and handed to the transmitter in one piece.
+  *
+  *   \param cmd Command to send.
+  *   \param payload_length Length of data to be sent with command.
+  *   \param payload Pointer to data to send.
+  *
+  *   \retval true The frame was queued.
+  *   \retval false Not enough room in the TX buffer, nothing was queued.
+ */
+ uint8_t
+ uart_queue_frame(uint8_t cmd, uint8_t payload_length, uint8_t *payload)
+ {
+     uint8_t header[3] = { SOF_CHAR, payload_length, cmd };
+     uint8_t eof = EOF_CHAR;
+
+     if (link_framing == UART_FRAMING_COBS){
+         return uart_queue_cobs(cmd, payload_length, payload);
+     }
+
+     if (ring_free(&txbuf) < payload_length + 4){
+         return false;
+     }
+
+     ring_stage(&txbuf, 0, header, sizeof(header));
+     ring_stage(&txbuf, sizeof(header), payload, payload_length);
+     ring_stage(&txbuf, sizeof(header) + payload_length, &eof, 1);
+     ring_commit(&txbuf, payload_length + 4);
+     uart_tx_start();
+
+     return true;
  }
 
  /*---------------------------------------------------------------------------*/
 
  /**
   *   \brief This function builds and sends a binary command frame to the
-  *   ATmega1284p.
+  *   ATmega1284p. Only waits while the TX buffer is full. The frame is queued
+  *   whole, so an RS-485 poll never hands out half of it.
+  *
+  *   With MODBUS_ENABLE there is no 1284p on the line and txbuf belongs to the
+  *   Modbus replies queued from the TIMER1 interrupt, the frame is dropped.
   *
   *   \param cmd Command to send.
   *   \param payload_length Length of data to be sent with command.
@@ -302,16 +494,13 @@
  void
  uart_serial_send_frame(uint8_t cmd, uint8_t payload_length, uint8_t *payload)
  {
-     /* Send a frame to 1284p */
-     int8_t i;
-
-     uart_send_byte(SOF_CHAR);
-     uart_send_byte(payload_length);
-     uart_send_byte(cmd);
-     for (i=0;i<=payload_length-1;i++){
-             uart_send_byte(payload[i]);
-         }
-     uart_send_byte(EOF_CHAR);
+ #if !MODBUS_ENABLE
+     /* Wait for room in the TX buffer, a frame larger than it is never sent */
+     if (payload_length + 4 <= RING_SIZE){
+         while (!uart_queue_frame(cmd, payload_length, payload))
+             ;
+     }
+ #endif
  }
 
  /*---------------------------------------------------------------------------*/
@@ -334,133 +523,577 @@
  /*---------------------------------------------------------------------------*/
 
  /**
-  *   \brief This will receive a frame from the ATmega1284p and parse the incoming
-  *   data.
+  *   \brief This will drop the frame being parsed and wait for the next SOF.
   *
-  *   If the incoming data is a binary command acknowledgement, then this will not
-  *   parse any data. If the incoming data is test reports, the menu will store the
-  *   data for end of test metrics.
+  *   \param reason Time out message to display, 0 for none.
+ */
+ static void
+ uart_rx_reset(uint8_t reason)
+ {
+     if (reason){
+         uart_timeout_msg(reason);
+         ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+             if (link_errors < 0xff){
+                 link_errors++;
+             }
+         }
+     }
+     rx_state = RX_STATE_SOF;
+     led_off();
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief This will switch the baud rate and framing of the 1284p link. The TX
+  *   buffer must be empty.
   *
-  *   \param wait_for_ack Flag used to wait for acknowledgement when receving a serial
-  *   frame.
+  *   \param speed One of UART_SPEED_xxx.
+  *   \param framing One of UART_FRAMING_xxx.
  */
- void
- uart_serial_rcv_frame(uint8_t wait_for_ack)
+ static void
+ uart_set_link(uint8_t speed, uint8_t framing)
  {
-     /* Gets a serial frame, if any, and displays data appropriately */
-     /* If wait_for_ack is true, this funtion will wait for serial chars. */
-     volatile uint8_t ch;
-     volatile uint8_t length;
-     volatile uint8_t cmd;
-     volatile uint8_t payload[20];
-     uint16_t i;
+     if (speed == UART_SPEED_38400){
+         UCSR0A &= ~(1 << U2X0);
+     }
+     else{
+         UCSR0A |= (1 << U2X0);
+     }
+     UBRR0 = link_ubrr[speed];
 
-     if (!wait_for_ack && !rx_char_ready()){
-         return;
+     link_speed = speed;
+     link_framing = framing;
+     link_errors = 0;
+     rx_count = 0;
+     rx_state = RX_STATE_SOF;
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief This will move the frame just parsed to the frame queue. The frame
+  *   is dropped if the queue is full.
+ */
+ static void
+ uart_rx_queue_frame(void)
+ {
+     uint8_t tail;
+
+     if (rx_queue_count < UART_FRAME_QUEUE){
+         tail = rx_queue_head + rx_queue_count;
+         if (tail >= UART_FRAME_QUEUE){
+             tail -= UART_FRAME_QUEUE;
+         }
+         memcpy(&rx_queue[tail], &rx_frame, sizeof(rx_frame));
+         rx_queue_count++;
+     }
+     else{
+         UART_STAT_INC(uart_stats.rx_queue_full);
+     }
+     uart_cmd_count[rx_frame.entry]++;
+     ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+         if (link_errors){
+             link_errors--;
+         }
      }
+     uart_rx_reset(0);
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief This will look up a command and check the payload length against
+  *   the command table.
+  *
+  *   \param cmd The command byte.
+  *   \param length The payload length.
+  *
+  *   \return The UART_CMD_ENTRY_xxx index, or UART_CMD_COUNT if the frame is
+  *   not accepted.
+ */
+ static uint8_t
+ uart_cmd_find(uint8_t cmd, uint8_t length)
+ {
+     uint8_t i;
 
-     /* Check for SOF */
-     ch = uart_get_char_rx();
-     if (ch != SOF_CHAR){
-         return uart_timeout_msg(1);
+     for (i=0;i<UART_CMD_COUNT;i++){
+         if (pgm_read_byte(&uart_cmd_table[i].cmd) == cmd){
+             if (length < pgm_read_byte(&uart_cmd_table[i].min_len) ||
+                 length > pgm_read_byte(&uart_cmd_table[i].max_len)){
+                 break;
+             }
+             return i;
+         }
      }
+     return UART_CMD_COUNT;
+ }
 
-     /* Turn on nose LED for activity indicator */
-     led_on();
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief This will parse the COBS block collected in rx_cobs at its 0x00
+  *   delimiter. A corrupted or overlong block is dropped here, so there is
+  *   nothing to time out.
+ */
+ static void
+ uart_rx_cobs_block(void)
+ {
+     uint8_t length;
 
-     /* Get length byte */
-     ch = uart_get_char_rx();
-     if (ch == TIMEOUT){
-         return uart_timeout_msg(2);
+     /* Back to back delimiters are just idle line */
+     length = rx_count;
+     rx_count = 0;
+     if (!length){
+         return;
      }
-     /* Check for ACK Frame */
-     if (ch >= 0x80){
-         /* This is an ack frame, just get it and go away. */
-         ch = uart_get_char_rx();
-         if (ch != EOF_CHAR){
-             uart_timeout_msg(3);
-         }
-         led_off();
+     if (length < 2 || length > sizeof(rx_cobs) || !(length = cobs_decode(rx_cobs, length))){
+         UART_STAT_INC(uart_stats.rx_bad_frame);
+         uart_rx_reset(8);
          return;
      }
 
-     length = ch;
-     if (length > sizeof(payload)){
-         /* invalid length */
+     rx_frame.cmd = rx_cobs[1];
+     rx_frame.length = length - 1;
+     rx_frame.entry = uart_cmd_find(rx_frame.cmd, rx_frame.length);
+     if (rx_frame.entry >= UART_CMD_COUNT){
+         uart_cmd_rejected++;
          return;
      }
+     memcpy(rx_frame.payload, &rx_cobs[2], rx_frame.length);
+     uart_rx_queue_frame();
+ }
 
-     /* Get cmd byte */
-     ch = uart_get_char_rx();
-     if (ch == TIMEOUT){
-         return uart_timeout_msg(5);
-     }
-     cmd = ch;
+ /*---------------------------------------------------------------------------*/
 
-     /* Get payload */
-     for (i=0;i<length;i++){
-         ch = uart_get_char_rx();
-         if (ch == TIMEOUT){
-             return uart_timeout_msg(i);
-         }
-         /* Save payload */
-         payload[i] = ch;
+ /**
+  *   \brief This will collect received characters into a COBS block, up to and
+  *   including the next delimiter.
+  *
+  *   \param data Characters received.
+  *   \param length Number of characters at data.
+  *
+  *   \return Number of characters used.
+ */
+ static uint8_t
+ uart_rx_cobs(const uint8_t *data, uint8_t length)
+ {
+     const uint8_t *delim = memchr(data, 0, length);
+     uint8_t run = delim ? delim - data : length;
+     uint8_t n;
+
+     if (rx_count < sizeof(rx_cobs)){
+         n = sizeof(rx_cobs) - rx_count;
+         memcpy(&rx_cobs[rx_count], data, n < run ? n : run);
      }
+     /* An overlong block is only counted, it is dropped at the delimiter */
+     rx_count = (rx_count + run > 0xff) ? 0xff : rx_count + run;
 
-     /* Get EOF */
-     ch = uart_get_char_rx();
-     if (ch != EOF_CHAR){
-         return uart_timeout_msg(7);
+     if (!delim){
+         return run;
      }
+     uart_rx_cobs_block();
+     return run + 1;
+ }
+
+ /*---------------------------------------------------------------------------*/
 
-     /* Process the received command */
-     switch (cmd){
-         case REPORT_PING:
-             /*
-              * This will update the lcd with the current ping status.
-              * Store the sequence number away.
-              */
-             ping_response = payload[0];
+ /**
+  *   \brief This will run the frame parser over the characters received from the
+  *   ATmega1284p so far. It never waits for more characters; a frame left
+  *   incomplete for UART_RX_TIMEOUT RTC ticks is dropped.
+  *
+  *   rxbuf is read a contiguous span at a time. COBS blocks and SOF frame
+  *   payloads are copied out of the span whole, only the SOF frame header
+  *   and EOF go through the parser one character at a time.
+ */
+ void
+ uart_rx_poll(void)
+ {
+     const uint8_t *span;
+     uint8_t count;
+     uint8_t used;
+     uint8_t n;
+     uint8_t ch;
 
-             if(ping_response == 1){
-                 lcd_single_print_dig(ping_response, 3);
+     while ((count = ring_span(&rxbuf, &span))){
+         rx_last_tick = (uint8_t)rtc_seconds();
+
+         for (used=0;used<count;){
+             if (link_framing == UART_FRAMING_COBS){
+                 used += uart_rx_cobs(span + used, count - used);
+                 continue;
              }
-             else if(ping_response == 2){
-                 lcd_single_print_dig(ping_response, 2);
+
+             if (rx_state == RX_STATE_PAYLOAD){
+                 n = rx_frame.length - rx_count;
+                 if (n > count - used){
+                     n = count - used;
+                 }
+                 memcpy(&rx_frame.payload[rx_count], span + used, n);
+                 rx_count += n;
+                 used += n;
+                 if (rx_count >= rx_frame.length){
+                     rx_state = RX_STATE_EOF;
+                 }
+                 continue;
              }
-             else if(ping_response == 3){
-                 lcd_single_print_dig(ping_response, 1);
+
+             ch = span[used++];
+             switch (rx_state){
+                 case RX_STATE_SOF:
+                     if (ch == SOF_CHAR){
+                         /* Turn on nose LED for activity indicator */
+                         led_on();
+                         rx_state = RX_STATE_LENGTH;
+                     }
+                     break;
+                 case RX_STATE_LENGTH:
+                     if (ch >= 0x80){
+                         /* This is an ack frame, only EOF follows */
+                         rx_frame.cmd = NULL_CMD;
+                         rx_frame.entry = UART_CMD_ENTRY_NULL_CMD;
+                         rx_frame.length = 0;
+                         rx_state = RX_STATE_ACK_EOF;
+                     }
+                     else if (ch > UART_MAX_PAYLOAD){
+                         /* invalid length */
+                         uart_rx_reset(0);
+                     }
+                     else{
+                         rx_frame.length = ch;
+                         rx_state = RX_STATE_CMD;
+                     }
+                     break;
+                 case RX_STATE_ACK_EOF:
+                     if (ch != EOF_CHAR){
+                         UART_STAT_INC(uart_stats.rx_bad_frame);
+                         uart_rx_reset(3);
+                     }
+                     else{
+                         uart_rx_queue_frame();
+                     }
+                     break;
+                 case RX_STATE_CMD:
+                     /* Validate once here, the payload is still read to stay in sync */
+                     rx_frame.cmd = ch;
+                     rx_frame.entry = uart_cmd_find(ch, rx_frame.length);
+                     rx_drop = (rx_frame.entry >= UART_CMD_COUNT);
+                     rx_count = 0;
+                     rx_state = rx_frame.length ? RX_STATE_PAYLOAD : RX_STATE_EOF;
+                     break;
+                 case RX_STATE_EOF:
+                     if (ch != EOF_CHAR){
+                         UART_STAT_INC(uart_stats.rx_bad_frame);
+                         uart_rx_reset(7);
+                     }
+                     else if (rx_drop){
+                         uart_cmd_rejected++;
+                         uart_rx_reset(0);
+                     }
+                     else{
+                         uart_rx_queue_frame();
+                     }
+                     break;
+                 case RX_STATE_PAYLOAD:
+                     /* Copied above */
+                     break;
              }
-             else if(ping_response == 4){
-                 lcd_single_print_dig(ping_response, 0);
+         }
+         ring_consume(&rxbuf, count);
+     }
+
+     /* Drop a frame the 1284p stopped sending half way */
+     if (rx_state != RX_STATE_SOF &&
+         (uint8_t)((uint8_t)rtc_seconds() - rx_last_tick) >= UART_RX_TIMEOUT){
+         UART_STAT_INC(uart_stats.rx_timeout[rx_state]);
+         uart_rx_reset(rx_state);
+     }
+
+     /* Too many errors on a negotiated link, the 1284p falls back the same way */
+     if ((link_speed != UART_SPEED_38400 || link_framing != UART_FRAMING_SOF) &&
+         link_errors >= UART_LINK_MAX_ERRORS){
+         uart_tx_flush();
+         uart_set_link(UART_SPEED_38400, UART_FRAMING_SOF);
+     }
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief This will take the oldest complete frame from the frame queue.
+  *
+  *   \param frame Location to copy the frame to.
+  *
+  *   \retval true A frame was copied.
+  *   \retval false The frame queue is empty.
+ */
+ uint8_t
+ uart_get_frame(tuart_frame *frame)
+ {
+     if (!rx_queue_count){
+         return false;
+     }
+
+     memcpy(frame, &rx_queue[rx_queue_head], sizeof(*frame));
+     if (++rx_queue_head >= UART_FRAME_QUEUE){
+         rx_queue_head = 0;
+     }
+     rx_queue_count--;
+
+     return true;
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief REPORT_PING handler. This will update the lcd with the current ping
+  *   status and store the sequence number away.
+ */
+ static void
+ uart_rx_ping(const uint8_t *payload, uint8_t length)
+ {
+     ping_response = payload[0];
+
+     if(ping_response == 1){
+         lcd_single_print_dig(ping_response, 3);
+     }
+     else if(ping_response == 2){
+         lcd_single_print_dig(ping_response, 2);
+     }
+     else if(ping_response == 3){
+         lcd_single_print_dig(ping_response, 1);
+     }
+     else if(ping_response == 4){
+         lcd_single_print_dig(ping_response, 0);
+     }
+
+     timeout_flag = false;
+
+     /* Beep on successful ping response. */
+     uart_rx_ping_beep(payload, length);
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief REPORT_PING_BEEP handler.
+ */
+ static void
+ uart_rx_ping_beep(const uint8_t *payload, uint8_t length)
+ {
+     lcd_symbol_set(LCD_SYMBOL_BELL);
+     beep(0);
+     lcd_symbol_clr(LCD_SYMBOL_BELL);
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief REPORT_TEXT_MSG handler. Copy text message to menu buffer and play
+  *   ringtone.
+ */
+ static void
+ uart_rx_text_msg(const uint8_t *payload, uint8_t length)
+ {
+     /* Prezero in case no string terminator in command */
+     memset(top_menu_text, 0, sizeof(top_menu_text));
+     if (length > sizeof(top_menu_text)-1){
+         length = sizeof(top_menu_text)-1;   //leave zero byte at end
+     }
+     memcpy(top_menu_text, payload, length);
+     play_ringtone();
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief REPORT_LINK_SPEED handler, speed accepted by the 1284p, see
+  *   uart_link_negotiate().
+ */
+ static void
+ uart_rx_link_speed(const uint8_t *payload, uint8_t length)
+ {
+     link_ack = payload[0];
+     link_ack_framing = (length > 1) ? payload[1] : UART_FRAMING_SOF;
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief REPORT_LINK_STATS handler. This will answer with SEND_LINK_STATS
+  *   carrying the requested UART_STATS_xxx page, all counters little endian.
+ */
+ static void
+ uart_rx_link_stats(const uint8_t *payload, uint8_t length)
+ {
+     uint8_t buf[4 + sizeof(tuart_stats) + sizeof(uart_cmd_count)];  /* either page */
+     uint8_t clear = (length > 1) && (payload[1] & UART_STATS_CLEAR);
+
+     buf[0] = payload[0];
+     if (payload[0] == UART_STATS_ERRORS){
+         buf[1] = link_speed;
+         buf[2] = link_framing;
+         buf[3] = link_errors;
+         ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+             memcpy(&buf[4], (const void *)&uart_stats, sizeof(tuart_stats));
+             if (clear){
+                 memset((void *)&uart_stats, 0, sizeof(tuart_stats));
              }
+         }
+         uart_serial_send_frame(SEND_LINK_STATS, 4 + sizeof(tuart_stats), buf);
+     }
+     else if (payload[0] == UART_STATS_FRAMES){
+         memcpy(&buf[1], &uart_cmd_rejected, sizeof(uart_cmd_rejected));
+         memcpy(&buf[3], uart_cmd_count, sizeof(uart_cmd_count));
+         uart_serial_send_frame(SEND_LINK_STATS, 3 + sizeof(uart_cmd_count), buf);
+         if (clear){
+             uart_cmd_rejected = 0;
+             memset(uart_cmd_count, 0, sizeof(uart_cmd_count));
+         }
+     }
+     else if (payload[0] == UART_STATS_TASKS){
+         uint8_t tasks[1 + sizeof(sched_idle_ticks) + sizeof(sched_stats)];
 
-             timeout_flag = false;
-
-             /* Beep on successful ping response. */
-             lcd_symbol_set(LCD_SYMBOL_BELL);
-             beep(0);
-             lcd_symbol_clr(LCD_SYMBOL_BELL);
-             break;
-         case REPORT_TEXT_MSG:
-             /* Copy text message to menu buffer and play ringtone */
-             /* Prezero in case no string terminator in command */
-             for (i=0;i<sizeof(top_menu_text);i++) top_menu_text[i]=0;
-             memcpy(&top_menu_text,(char *)payload,sizeof(top_menu_text)-1);  //leave zero byte at end
-             play_ringtone();
-             break;
-         case REPORT_PING_BEEP:
-             lcd_symbol_set(LCD_SYMBOL_BELL);
-             beep(0);
-             lcd_symbol_clr(LCD_SYMBOL_BELL);
-             break;
-         case REPORT_WAKE:
-             /* Indicates 1284 is awake*/
-             break;
-         default:
-             break;
+         tasks[0] = payload[0];
+         memcpy(&tasks[1], &sched_idle_ticks, sizeof(sched_idle_ticks));
+         memcpy(&tasks[1 + sizeof(sched_idle_ticks)], sched_stats, sizeof(sched_stats));
+         uart_serial_send_frame(SEND_LINK_STATS, sizeof(tasks), tasks);
+         if (clear){
+             sched_clear_stats();
+         }
      }
-     led_off();
+     else if (payload[0] == UART_STATS_FLASH){
+         uint16_t nodes[2];
+
+         nodes[0] = flashFree();
+         nodes[1] = (flashId < 0) ? 0 : FLASH_USABLE_NODES;
+         memcpy(&buf[1], nodes, sizeof(nodes));
+         memcpy(&buf[1 + sizeof(nodes)], &flashBufStats, sizeof(flashBufStats));
+         uart_serial_send_frame(SEND_LINK_STATS, 1 + sizeof(nodes) + sizeof(flashBufStats), buf);
+         if (clear){
+             memset(&flashBufStats, 0, sizeof(flashBufStats));
+         }
+     }
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief This will act on a frame received from the ATmega1284p by calling
+  *   the handler from the command table. Acks and REPORT_WAKE have no handler.
+  *
+  *   \param frame The received frame, already validated by the parser.
+ */
+ static void
+ uart_process_frame(tuart_frame *frame)
+ {
+     tuart_handler handler;
+
+     handler = (tuart_handler)pgm_read_ptr(&uart_cmd_table[frame->entry].handler);
+     if (handler){
+         handler(frame->payload, frame->length);
+     }
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief This will parse any characters received from the ATmega1284p and
+  *   act on every complete frame.
+  *
+  *   \param wait_for_ack Flag used to wait for a frame, bounded by UART_RX_TIMEOUT
+  *   RTC ticks, when nothing has been received yet.
+ */
+ void
+ uart_serial_rcv_frame(uint8_t wait_for_ack)
+ {
+     tuart_frame frame;
+     uint8_t start = (uint8_t)rtc_seconds();
+
+     uart_rx_poll();
+     if (wait_for_ack){
+         while (!rx_queue_count &&
+                (uint8_t)((uint8_t)rtc_seconds() - start) <= UART_RX_TIMEOUT){
+             uart_rx_poll();
+         }
+     }
+
+     while (uart_get_frame(&frame)){
+         uart_process_frame(&frame);
+     }
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief This will ask the 1284p to run the link at a higher baud rate and
+  *   optionally with COBS framing.
+  *
+  *   The 1284p answers with REPORT_LINK_SPEED carrying the speed it accepts, at
+  *   most the one requested, and the framing it accepts. A 1284p that only
+  *   sends the speed keeps SOF framing. Both sides switch once that frame is
+  *   out, and drop back to 38400 with SOF framing by themselves after
+  *   UART_LINK_MAX_ERRORS errors.
+  *
+  *   \param speed Requested UART_SPEED_xxx.
+  *   \param framing Requested UART_FRAMING_xxx.
+  *
+  *   \return The UART_SPEED_xxx the link runs at afterwards.
+ */
+ uint8_t
+ uart_link_negotiate(uint8_t speed, uint8_t framing)
+ {
+     uint8_t request[2];
+     uint8_t start;
+
+     if (speed >= UART_SPEED_COUNT || framing >= UART_FRAMING_COUNT ||
+         (speed == link_speed && framing == link_framing)){
+         return link_speed;
+     }
+
+     link_ack = 0xff;
+     request[0] = speed;
+     request[1] = framing;
+     uart_serial_send_frame(SEND_LINK_SPEED, sizeof(request), request);
+
+     start = (uint8_t)rtc_seconds();
+     while (link_ack == 0xff &&
+            (uint8_t)((uint8_t)rtc_seconds() - start) <= UART_RX_TIMEOUT){
+         uart_serial_rcv_frame(false);
+     }
+
+     if (link_ack < UART_SPEED_COUNT && link_ack_framing < UART_FRAMING_COUNT){
+         uart_tx_flush();
+         uart_set_link(link_ack, link_ack_framing);
+     }
+     return link_speed;
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief Get the current speed of the 1284p link.
+  *
+  *   \return One of UART_SPEED_xxx.
+ */
+ uint8_t
+ uart_link_speed(void)
+ {
+     return link_speed;
+ }
+
+ /*---------------------------------------------------------------------------*/
+
+ /**
+  *   \brief Get the current framing of the 1284p link.
+  *
+  *   \return One of UART_FRAMING_xxx.
+ */
+ uint8_t
+ uart_link_framing(void)
+ {
+     return link_framing;
  }
 
  /** \}   */
@@ -50,6 +50,7 @@
  #define __UART_H__   1
 
  #include <inttypes.h>
+ #include "ring.h"
 
  /** \name ASCII characters defined */
  /** \{ */
@@ -59,27 +60,121 @@
 
  /* Macros & Defines */
 
- #define BUFSIZE 80
  #define BAUD_RATE_38400     (12)
+ #define BAUD_RATE_250K_U2X  (3)     /**< 250000 baud in double speed mode (error = 0%). */
+ #define BAUD_RATE_500K_U2X  (1)     /**< 500000 baud in double speed mode (error = 0%). */
 
- /** \brief Circular buffer structure */
+ /** \name Link speeds negotiated with SEND_LINK_SPEED */
+ /** \{ */
+ #define UART_SPEED_38400    (0)     /**< Power-up speed, always supported. */
+ #define UART_SPEED_250K     (1)
+ #define UART_SPEED_500K     (2)
+ #define UART_SPEED_COUNT    (3)
+ /** \} */
+
+ /** \name Framing modes negotiated with SEND_LINK_SPEED */
+ /** \{ */
+ #define UART_FRAMING_SOF    (0)     /**< SOF, length, cmd, payload, EOF. Power-up mode. */
+ #define UART_FRAMING_COBS   (1)     /**< COBS(cmd, payload), 0x00, see cobs.h. */
+ #define UART_FRAMING_COUNT  (2)
+ /** \} */
+
+ #define UART_LINK_MAX_ERRORS (8)    /**< Line and frame errors before falling back to 38400 and SOF framing. */
+
+ #define UART_MAX_PAYLOAD    (20)    /**< Largest payload accepted from the 1284p. */
+ #define UART_FRAME_QUEUE    (4)     /**< Received frames waiting to be processed. */
+ #define UART_RX_TIMEOUT     (2)     /**< RTC ticks without a byte before a partial frame is dropped. */
+
+ /** \brief Receive frame parser states */
+ typedef enum {
+     RX_STATE_SOF,       /**< Waiting for SOF_CHAR. */
+     RX_STATE_LENGTH,    /**< Waiting for the length byte. */
+     RX_STATE_ACK_EOF,   /**< Waiting for EOF_CHAR of an ack frame. */
+     RX_STATE_CMD,       /**< Waiting for the command byte. */
+     RX_STATE_PAYLOAD,   /**< Receiving the payload. */
+     RX_STATE_EOF,       /**< Waiting for EOF_CHAR. */
+ } trx_state;
+
+ #define RX_STATE_COUNT      (RX_STATE_EOF + 1)
+
+ /** \name Pages of link counters sent with SEND_LINK_STATS */
+ /** \{ */
+ #define UART_STATS_ERRORS   (0)     /**< Speed, framing, link errors, then tuart_stats. */
+ #define UART_STATS_FRAMES   (1)     /**< uart_cmd_rejected, then uart_cmd_count[]. */
+ #define UART_STATS_TASKS    (2)     /**< sched_idle_ticks, then sched_stats[], see sched.h. */
+ #define UART_STATS_FLASH    (3)     /**< flashFree(), FLASH_USABLE_NODES, then flashBufStats, see flashHQ.h. */
+ #define UART_STATS_CLEAR    (0x01)  /**< REPORT_LINK_STATS flag, clear the page once sent. */
+ /** \} */
+
+ /** \brief Link error counters, all saturate at 0xFFFF */
+ typedef struct {
+     uint16_t rx_overrun;        /**< DOR0, characters lost in the USART. */
+     uint16_t rx_frame_err;      /**< FE0, bad stop bit. */
+     uint16_t rx_parity_err;     /**< UPE0, stays 0 as parity is off. */
+     uint16_t rx_buf_full;       /**< Characters dropped, rxbuf full. */
+     uint16_t rx_queue_full;     /**< Frames dropped, frame queue full. */
+     uint16_t rx_bad_frame;      /**< Frames without EOF_CHAR and bad COBS blocks. */
+     uint16_t rx_timeout[RX_STATE_COUNT];   /**< Partial frames timed out, by parser state. */
+ } tuart_stats;
+
+ #define UART_STAT_INC(x)    do { if ((x) != 0xffff) (x)++; } while (0)
+
+ /** \brief Index of each command in the command table, see uart_cmds.h */
+ enum {
+ #define UART_CMD(cmd, min_len, max_len, handler) UART_CMD_ENTRY_##cmd,
+ #include "uart_cmds.h"
+ #undef UART_CMD
+     UART_CMD_COUNT
+ };
+
+ /** \brief Handler for a received frame, the length is already validated */
+ typedef void (*tuart_handler)(const uint8_t *payload, uint8_t length);
+
+ /** \brief Command table entry, kept in flash */
  typedef struct {
-     volatile uint8_t head;  /**< Index to last available character in buffer. */
-     volatile uint8_t tail;  /**< Index to first available character in buffer. */
-     uint8_t buf[BUFSIZE];   /**< The actual buffer used for storing characters. */
- } tcirc_buf;
+     uint8_t cmd;
+     uint8_t min_len;
+     uint8_t max_len;
+     tuart_handler handler;
+ } tuart_cmd;
 
- extern tcirc_buf rxbuf;
+ /** \brief A complete frame received from the 1284p, ack frames have cmd NULL_CMD */
+ typedef struct {
+     uint8_t cmd;
+     uint8_t entry;      /**< UART_CMD_ENTRY_xxx, set by the parser. */
+     uint8_t length;
+     uint8_t payload[UART_MAX_PAYLOAD];
+ } tuart_frame;
+
+ /** \brief Frames received per command, and frames dropped by the command table */
+ extern uint16_t uart_cmd_count[UART_CMD_COUNT];
+ extern uint16_t uart_cmd_rejected;
+
+ /** \brief Link error counters, updated from the USART RX interrupt as well */
+ extern volatile tuart_stats uart_stats;
+
+ extern t_ring rxbuf;
  #define rx_char_ready() (rxbuf.head != rxbuf.tail)
 
+ extern t_ring txbuf;
+ extern volatile uint8_t uart_tx_idle;
+ /** \brief True once the last queued byte has left the transmitter. */
+ #define tx_done() (uart_tx_idle)
+
  /* Serial port functions */
  void uart_init(void);
  void uart_deinit(void);
- uint8_t uart_circ_buf_has_char(tcirc_buf *cbuf);
  void uart_clear_rx_buf(void);
- uint8_t uart_get_char_rx(void);
+ void uart_rx_poll(void);
+ uint8_t uart_get_frame(tuart_frame *frame);
  void uart_send_byte(uint8_t byte);
+ uint8_t uart_queue_raw(const uint8_t *buf, uint8_t length);
+ uint8_t uart_queue_frame(uint8_t cmd, uint8_t payload_length, uint8_t *payload);
  void uart_serial_send_frame(uint8_t cmd, uint8_t payload_length, uint8_t *payload);
+ void uart_tx_flush(void);
+ uint8_t uart_link_negotiate(uint8_t speed, uint8_t framing);
+ uint8_t uart_link_speed(void);
+ uint8_t uart_link_framing(void);
  void uart_serial_rcv_frame(uint8_t wait_for_it);
 
  #endif /* __UART_H__ */
@@ -0,0 +1,35 @@
+/*
+ * uart_cmds.h
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+ /**
+  * \file
+  *
+  * \brief
+  *      Frames accepted from the ATmega1284p. Each line expands into the command
+  *      table in flash (uart.c) and a UART_CMD_ENTRY_xxx index (uart.h).
+  *
+  *      UART_CMD(cmd, min_len, max_len, handler)
+  *
+  *      The parser drops frames with an unknown cmd or a payload length outside
+  *      min_len..max_len, so handlers never check the length again. The handler
+  *      is void handler(const uint8_t *payload, uint8_t length), or NULL.
+  */
+
+ /* No include guard, included once per expansion of UART_CMD */
+
+ UART_CMD(NULL_CMD,          0, 0,                   NULL)               /* ack frame */
+ UART_CMD(REPORT_PING,       1, UART_MAX_PAYLOAD,    uart_rx_ping)
+ UART_CMD(REPORT_PING_BEEP,  0, UART_MAX_PAYLOAD,    uart_rx_ping_beep)
+ UART_CMD(REPORT_TEXT_MSG,   0, UART_MAX_PAYLOAD,    uart_rx_text_msg)
+ UART_CMD(REPORT_WAKE,       0, UART_MAX_PAYLOAD,    NULL)
+ UART_CMD(REPORT_LINK_SPEED, 1, 2,                   uart_rx_link_speed)
+ UART_CMD(REPORT_BULK_ACK,   4, 4,                   bulk_ack)
+ UART_CMD(REPORT_EXPORT,     2, UART_MAX_PAYLOAD,    export_request)
+ UART_CMD(REPORT_TELEMETRY_MODE, 2, 2,               menu_telemetry_mode)
+ UART_CMD(REPORT_LINK_STATS, 1, 2,                   uart_rx_link_stats)
+ UART_CMD(REPORT_TIME,       4, 4,                   calendar_report_time)
+ UART_CMD(REPORT_LINES,      1, 1,                   runtime_report_lines)
@@ -0,0 +1,906 @@
+/*
+ * collector.cpp
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/*
+ * Telemetry collector for a fleet of counters, each on its own serial port.
+ *
+ *   collector [-o out] [-b batch] [-w window] <tty>...    collect until SIGINT/SIGTERM
+ *   collector [-o out] [-w window] -s <devices> [-r rate] [-t seconds]
+ *                                                          collect from simulated devices
+ *   collector bench [-t seconds] [max devices]             records per second as the
+ *                                                          device count doubles
+ *   collector dump <file>                                  print a collected file as CSV
+ *
+ * One thread runs an epoll loop over all ports and parses the SOF, length,
+ * cmd, payload, EOF frames of uart.c. SEND_TEMP and SEND_ADC2 text frames and
+ * SEND_TELEMETRY samples become records, stamped with the host time the frame
+ * arrived; batched samples are dated back by their RTC.total_sec difference
+ * to the newest sample of the batch. Records of all ports are merged in a
+ * heap and written in time order once they are older than the reorder window
+ * (default 8 s, longer than a full TELEMETRY_MAX_BATCH batch).
+ *
+ * -b sends REPORT_TELEMETRY_MODE to every port so the counters switch to
+ * binary telemetry with that many samples per frame. Ports that fail or
+ * disappear are reopened every RETRY_SECONDS. A counter whose samples carry
+ * TELEMETRY_TIME_UNCERTAIN is sent REPORT_TIME with the local time, at most
+ * every RETRY_SECONDS.
+ *
+ * Output file, little endian: "RVC1", uint16 device count, then per device
+ * a uint8 name length and the name. Then blocks of up to BLOCK_ROWS records:
+ * "BLK1", uint32 rows, then each column stored whole, in this order:
+ *
+ *   int64  time      host time in ns since the epoch
+ *   uint16 device    index into the device table
+ *   uint8  kind      REC_TEMP, REC_ADC2 or REC_SAMPLE
+ *   uint32 devTime   RTC.total_sec of a sample, 0 for text frames
+ *   int16  temp
+ *   uint16 adc2      EXT_SUPL_SIG in mV
+ *   uint8  key, menu, flags    as in ttelemetry, flags also for text temps
+ *
+ * -s forks a process that plays <devices> counters on ptys, half of them
+ * sending binary telemetry and half text frames, each <rate> frames per
+ * second (0 = as fast as the pty takes them), with a corrupted byte every
+ * SIM_CORRUPT frames to exercise resync.
+ *
+ * Build: g++ -O2 -Wall -std=c++17 -o collector collector.cpp
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+
+// from uart.h, main.h and menu.h
+#define SOF_CHAR                0x01
+#define EOF_CHAR                0x04
+#define SEND_TEMP               0x80
+#define SEND_ADC2               0x82
+#define SEND_TELEMETRY          0x88
+#define REPORT_TELEMETRY_MODE   0xC7
+#define REPORT_TIME             0xC9
+#define TELEMETRY_BINARY        1
+#define TELEMETRY_FAHRENHEIT    0x01
+#define TELEMETRY_TIME_UNCERTAIN 0x04
+#define CALENDAR_EPOCH          946684800   // 2000-01-01 00:00 in Unix time, see calendar.h
+#define TELEMETRY_MAX_BATCH     6
+#define TELEMETRY_SAMPLE_SIZE   11      // packed ttelemetry
+
+#define BLOCK_ROWS      4096
+#define RETRY_SECONDS   5
+#define SIM_CORRUPT     1000
+
+enum { REC_TEMP, REC_ADC2, REC_SAMPLE };
+
+struct Record {
+    int64_t time;
+    uint32_t seq;       // arrival order, keeps equal times stable
+    uint32_t devTime;
+    uint16_t device;
+    int16_t temp;
+    uint16_t adc2;
+    uint8_t kind;
+    uint8_t key;
+    uint8_t menu;
+    uint8_t flags;
+};
+
+static int64_t nowNs(clockid_t clock = CLOCK_REALTIME)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+ * Frame parser, the host side of uart_rx_poll() for SOF framing
+ */
+
+class FrameParser {
+public:
+    uint8_t cmd = 0;
+    uint8_t length = 0;
+    uint8_t payload[128];
+    unsigned badFrames = 0;
+
+    // @returns true when a frame is complete
+    bool feed(uint8_t ch)
+    {
+        switch (state) {
+        case SOF:
+            if (ch == SOF_CHAR) {
+                state = LENGTH;
+            }
+            break;
+        case LENGTH:
+            length = ch;
+            state = ch >= 0x80 ? ACK_EOF : CMD;
+            break;
+        case ACK_EOF:
+            // acks carry nothing to collect
+            badFrames += ch != EOF_CHAR;
+            state = SOF;
+            break;
+        case CMD:
+            cmd = ch;
+            count = 0;
+            state = length ? PAYLOAD : END;
+            break;
+        case PAYLOAD:
+            payload[count++] = ch;
+            if (count >= length) {
+                state = END;
+            }
+            break;
+        case END:
+            state = SOF;
+            if (ch == EOF_CHAR) {
+                return true;
+            }
+            badFrames++;
+            break;
+        }
+        return false;
+    }
+
+private:
+    enum { SOF, LENGTH, ACK_EOF, CMD, PAYLOAD, END } state = SOF;
+    uint8_t count = 0;
+};
+
+/*
+ * Columnar output
+ */
+
+class ColumnWriter {
+public:
+    uint64_t rows = 0;
+    uint64_t late = 0;      // records older than one already written
+
+    bool open(const char *path, const std::vector<std::string> &devices)
+    {
+        file = path ? fopen(path, "wb") : tmpfile();
+        if (!file) {
+            perror(path);
+            return false;
+        }
+        fwrite("RVC1", 1, 4, file);
+        put(uint16_t(devices.size()));
+        for (const std::string &name : devices) {
+            uint8_t n = uint8_t(std::min<size_t>(name.size(), 255));
+
+            put(n);
+            fwrite(name.data(), 1, n, file);
+        }
+        return true;
+    }
+
+    void add(const Record &r)
+    {
+        if (r.time < lastTime) {
+            late++;
+        }
+        lastTime = std::max(lastTime, r.time);
+        time.push_back(r.time);
+        device.push_back(r.device);
+        kind.push_back(r.kind);
+        devTime.push_back(r.devTime);
+        temp.push_back(r.temp);
+        adc2.push_back(r.adc2);
+        key.push_back(r.key);
+        menu.push_back(r.menu);
+        flags.push_back(r.flags);
+        rows++;
+        if (time.size() >= BLOCK_ROWS) {
+            flush();
+        }
+    }
+
+    void flush()
+    {
+        uint32_t n = uint32_t(time.size());
+
+        if (!n) {
+            return;
+        }
+        fwrite("BLK1", 1, 4, file);
+        put(n);
+        column(time);
+        column(device);
+        column(kind);
+        column(devTime);
+        column(temp);
+        column(adc2);
+        column(key);
+        column(menu);
+        column(flags);
+        fflush(file);
+    }
+
+    void close()
+    {
+        if (file) {
+            flush();
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+private:
+    FILE *file = nullptr;
+    int64_t lastTime = 0;
+    std::vector<int64_t> time;
+    std::vector<uint16_t> device;
+    std::vector<uint8_t> kind;
+    std::vector<uint32_t> devTime;
+    std::vector<int16_t> temp;
+    std::vector<uint16_t> adc2;
+    std::vector<uint8_t> key, menu, flags;
+
+    template <typename T> void put(T value)
+    {
+        fwrite(&value, sizeof(value), 1, file);
+    }
+
+    // little endian hosts only, like the 3290p itself
+    template <typename T> void column(std::vector<T> &values)
+    {
+        fwrite(values.data(), sizeof(T), values.size(), file);
+        values.clear();
+    }
+};
+
+/*
+ * Reorder buffer, releases records once they are older than the window
+ */
+
+class Merger {
+public:
+    explicit Merger(ColumnWriter &out, int64_t window) : out(out), window(window) {}
+
+    void push(Record r)
+    {
+        r.seq = seq++;
+        heap.push(r);
+    }
+
+    void drain(int64_t now)
+    {
+        while (!heap.empty() && heap.top().time <= now - window) {
+            out.add(heap.top());
+            heap.pop();
+        }
+    }
+
+    void drainAll()
+    {
+        drain(INT64_MAX);
+    }
+
+private:
+    struct Later {
+        bool operator()(const Record &a, const Record &b) const
+        {
+            return a.time != b.time ? a.time > b.time : a.seq > b.seq;
+        }
+    };
+
+    ColumnWriter &out;
+    int64_t window;
+    uint32_t seq = 0;
+    std::priority_queue<Record, std::vector<Record>, Later> heap;
+};
+
+/*
+ * Ports and the event loop
+ */
+
+struct Port {
+    std::string name;
+    int fd = -1;
+    int64_t retry = 0;      // CLOCK_MONOTONIC ns of the next open attempt
+    int64_t timeSent = 0;   // CLOCK_MONOTONIC ns of the last REPORT_TIME
+    FrameParser parser;
+    uint64_t frames = 0;
+};
+
+static volatile sig_atomic_t stopFlag;
+
+static void onSignal(int)
+{
+    stopFlag = 1;
+}
+
+static void rawMode(int fd)
+{
+    struct termios tio;
+
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetspeed(&tio, B38400);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+}
+
+static void sendFrame(int fd, uint8_t cmd, const uint8_t *payload, uint8_t length)
+{
+    uint8_t frame[132] = { SOF_CHAR, length, cmd };
+
+    memcpy(&frame[3], payload, length);
+    frame[3 + length] = EOF_CHAR;
+    if (write(fd, frame, length + 4) < 0) {
+        perror("write");
+    }
+}
+
+class Collector {
+public:
+    std::vector<Port> ports;
+    uint64_t records = 0;
+    bool reopen = true;     // false for ptys that are opened by the caller
+    int batch = 0;
+
+    Collector(Merger &merger) : merger(merger)
+    {
+        epollFd = epoll_create1(0);
+    }
+
+    ~Collector()
+    {
+        ::close(epollFd);
+    }
+
+    void add(const std::string &name, int fd = -1)
+    {
+        ports.emplace_back();
+        ports.back().name = name;
+        ports.back().fd = fd;
+        if (fd >= 0) {
+            watch(ports.size() - 1);
+        }
+    }
+
+    // run until stopFlag, or for seconds if > 0, or until every port is gone
+    void run(double seconds = 0)
+    {
+        int64_t end = nowNs(CLOCK_MONOTONIC) + int64_t(seconds * 1e9);
+        struct epoll_event events[64];
+        uint8_t buf[4096];
+
+        while (!stopFlag && (seconds <= 0 || nowNs(CLOCK_MONOTONIC) < end)) {
+            if (reopen) {
+                openPorts();
+            } else if (std::none_of(ports.begin(), ports.end(), [](const Port &p) { return p.fd >= 0; })) {
+                break;
+            }
+
+            int n = epoll_wait(epollFd, events, 64, 200);
+            int64_t now = nowNs();
+
+            for (int i = 0; i < n; i++) {
+                Port &port = ports[events[i].data.u32];
+                ssize_t got = read(port.fd, buf, sizeof(buf));
+
+                if (got < 0 && (errno == EAGAIN || errno == EINTR)) {
+                    continue;
+                }
+                if (got <= 0) {
+                    closePort(port);
+                    continue;
+                }
+                for (ssize_t j = 0; j < got; j++) {
+                    if (port.parser.feed(buf[j])) {
+                        port.frames++;
+                        decode(port, now);
+                    }
+                }
+            }
+            merger.drain(now);
+        }
+    }
+
+    unsigned badFrames() const
+    {
+        unsigned bad = 0;
+
+        for (const Port &port : ports) {
+            bad += port.parser.badFrames;
+        }
+        return bad;
+    }
+
+private:
+    Merger &merger;
+    int epollFd;
+
+    void watch(uint32_t index)
+    {
+        struct epoll_event ev = {};
+
+        ev.events = EPOLLIN;
+        ev.data.u32 = index;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, ports[index].fd, &ev);
+    }
+
+    void openPorts()
+    {
+        int64_t now = nowNs(CLOCK_MONOTONIC);
+
+        for (uint32_t i = 0; i < ports.size(); i++) {
+            Port &port = ports[i];
+
+            if (port.fd >= 0 || now < port.retry) {
+                continue;
+            }
+            port.retry = now + int64_t(RETRY_SECONDS) * 1000000000;
+            port.fd = ::open(port.name.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+            if (port.fd < 0) {
+                fprintf(stderr, "%s: %s\n", port.name.c_str(), strerror(errno));
+                continue;
+            }
+            rawMode(port.fd);
+            if (batch) {
+                uint8_t mode[2] = { TELEMETRY_BINARY, uint8_t(batch) };
+
+                sendFrame(port.fd, REPORT_TELEMETRY_MODE, mode, sizeof(mode));
+            }
+            watch(i);
+        }
+    }
+
+    void closePort(Port &port)
+    {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, port.fd, nullptr);
+        ::close(port.fd);
+        port.fd = -1;
+        port.retry = nowNs(CLOCK_MONOTONIC) + int64_t(RETRY_SECONDS) * 1000000000;
+        if (reopen) {
+            fprintf(stderr, "%s: closed, retrying in %d s\n", port.name.c_str(), RETRY_SECONDS);
+        }
+    }
+
+    void push(Record &r)
+    {
+        merger.push(r);
+        records++;
+    }
+
+    void decode(Port &port, int64_t now)
+    {
+        const FrameParser &f = port.parser;
+        Record r = {};
+
+        r.time = now;
+        r.device = uint16_t(&port - &ports[0]);
+
+        if (f.cmd == SEND_TEMP || f.cmd == SEND_ADC2) {
+            // signed_dectoascii(): "-12 C", "3300 mV", NUL terminated
+            char text[129];
+            char *end;
+
+            memcpy(text, f.payload, f.length);
+            text[f.length] = 0;
+            long value = strtol(text, &end, 10);
+            if (end == text) {
+                return;
+            }
+            if (f.cmd == SEND_TEMP) {
+                r.kind = REC_TEMP;
+                r.temp = int16_t(value);
+                r.flags = strchr(end, 'F') ? TELEMETRY_FAHRENHEIT : 0;
+            } else {
+                r.kind = REC_ADC2;
+                r.adc2 = uint16_t(value);
+            }
+            push(r);
+        } else if (f.cmd == SEND_TELEMETRY && f.length >= 1 &&
+                   f.length == 1 + f.payload[0] * TELEMETRY_SAMPLE_SIZE && f.payload[0]) {
+            const uint8_t *newest = &f.payload[1 + (f.payload[0] - 1) * TELEMETRY_SAMPLE_SIZE];
+
+            for (int i = 0; i < f.payload[0]; i++) {
+                const uint8_t *s = &f.payload[1 + i * TELEMETRY_SAMPLE_SIZE];
+
+                r.kind = REC_SAMPLE;
+                r.devTime = get32(s);
+                r.time = now - int64_t(get32(newest) - r.devTime) * 1000000000;
+                r.temp = int16_t(get16(s + 4));
+                r.adc2 = get16(s + 6);
+                r.key = s[8];
+                r.menu = s[9];
+                r.flags = s[10];
+                push(r);
+            }
+            if (r.flags & TELEMETRY_TIME_UNCERTAIN) {
+                setTime(port, now);
+            }
+        }
+    }
+
+    // set the counter's clock to local time, it was restored after a power cut
+    void setTime(Port &port, int64_t now)
+    {
+        int64_t mono = nowNs(CLOCK_MONOTONIC);
+        time_t t = time_t(now / 1000000000);
+        struct tm local;
+        uint8_t payload[4];
+
+        if (port.timeSent && mono - port.timeSent < int64_t(RETRY_SECONDS) * 1000000000) {
+            return;
+        }
+        port.timeSent = mono;
+        localtime_r(&t, &local);
+        uint32_t seconds = uint32_t(t + local.tm_gmtoff - CALENDAR_EPOCH);
+        for (int i = 0; i < 4; i++) {
+            payload[i] = uint8_t(seconds >> (8 * i));
+        }
+        sendFrame(port.fd, REPORT_TIME, payload, sizeof(payload));
+    }
+};
+
+/*
+ * Simulated devices
+ */
+
+static int openPty(std::string &name)
+{
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+        perror("pty");
+        return -1;
+    }
+    rawMode(fd);
+    name = ptsname(fd);
+    return fd;
+}
+
+static void simDevices(const std::vector<std::string> &names, double rate)
+{
+    std::vector<int> fds;
+    std::vector<double> due(names.size(), 0);
+    struct timespec idle = { 0, 1000000 };
+    double start = nowNs(CLOCK_MONOTONIC) / 1e9;
+    uint32_t sent = 0;
+
+    for (const std::string &name : names) {
+        int fd = open(name.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+        if (fd < 0) {
+            perror(name.c_str());
+            exit(1);
+        }
+        rawMode(fd);
+        fds.push_back(fd);
+    }
+
+    for (;;) {
+        double now = nowNs(CLOCK_MONOTONIC) / 1e9;
+        bool busy = false;
+
+        for (size_t d = 0; d < fds.size(); d++) {
+            uint8_t payload[1 + TELEMETRY_MAX_BATCH * TELEMETRY_SAMPLE_SIZE];
+            uint8_t frame[4 + sizeof(payload)];
+            uint8_t cmd;
+            int length;
+
+            if (rate > 0 && now < due[d]) {
+                continue;
+            }
+            busy = true;
+
+            if (d & 1) {
+                // text frames, alternating temperature and supply voltage
+                cmd = (sent & 1) ? SEND_ADC2 : SEND_TEMP;
+                length = sprintf((char *)payload, cmd == SEND_TEMP ? "%d C" : "%d mV",
+                                 cmd == SEND_TEMP ? int(d % 40) - 10 : 3300) + 1;
+            } else {
+                cmd = SEND_TELEMETRY;
+                payload[0] = TELEMETRY_MAX_BATCH;
+                for (int i = 0; i < TELEMETRY_MAX_BATCH; i++) {
+                    uint8_t *s = &payload[1 + i * TELEMETRY_SAMPLE_SIZE];
+                    uint32_t t = uint32_t(now - start);
+                    int16_t temp = int16_t(d % 40) - 10;
+                    uint16_t adc2 = 3300;
+
+                    memcpy(s, &t, 4);
+                    memcpy(s + 4, &temp, 2);
+                    memcpy(s + 6, &adc2, 2);
+                    s[8] = 0;
+                    s[9] = 4;
+                    s[10] = 0;
+                }
+                length = 1 + TELEMETRY_MAX_BATCH * TELEMETRY_SAMPLE_SIZE;
+            }
+
+            frame[0] = SOF_CHAR;
+            frame[1] = uint8_t(length);
+            frame[2] = cmd;
+            memcpy(&frame[3], payload, length);
+            frame[3 + length] = EOF_CHAR;
+            if (++sent % SIM_CORRUPT == 0) {
+                frame[3 + length] ^= 0x55;
+            }
+
+            ssize_t n = write(fds[d], frame, length + 4);
+            if (n < 0 && errno == EIO) {
+                exit(0);    // the collector closed the pty
+            }
+            if (n < 0) {
+                sent--;
+                continue;   // pty full, try again later
+            }
+            // never leave half a frame behind
+            while (n < length + 4) {
+                struct pollfd pfd = { fds[d], POLLOUT, 0 };
+                ssize_t more;
+
+                poll(&pfd, 1, 100);
+                if ((more = write(fds[d], frame + n, length + 4 - n)) < 0 && errno != EAGAIN) {
+                    exit(0);
+                }
+                n += std::max<ssize_t>(more, 0);
+            }
+            due[d] = (rate > 0 ? std::max(due[d], now - 1) + 1 / rate : now);
+        }
+        if (!busy) {
+            nanosleep(&idle, nullptr);
+        }
+    }
+}
+
+static pid_t startSim(Collector &collector, int devices, double rate)
+{
+    std::vector<std::string> names;
+
+    for (int d = 0; d < devices; d++) {
+        std::string name;
+        int fd = openPty(name);
+
+        if (fd < 0) {
+            exit(1);
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        names.push_back(name);
+        collector.add(name, fd);
+    }
+    collector.reopen = false;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        for (const Port &port : collector.ports) {
+            close(port.fd);
+        }
+        simDevices(names, rate);
+    }
+    return pid;
+}
+
+static void stopSim(pid_t pid)
+{
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+    }
+}
+
+/*
+ * Commands
+ */
+
+static int bench(double seconds, int maxDevices)
+{
+    printf("devices  records/s    frames/s  bad frames  late\n");
+    for (int devices = 1; devices <= maxDevices; devices *= 2) {
+        ColumnWriter out;
+        std::vector<std::string> names(devices, "sim");
+        Merger merger(out, 2000000000LL);
+        Collector collector(merger);
+
+        if (!out.open(nullptr, names)) {
+            return 1;
+        }
+        pid_t pid = startSim(collector, devices, 0);
+        int64_t start = nowNs(CLOCK_MONOTONIC);
+
+        collector.run(seconds);
+        merger.drainAll();
+        out.close();
+        stopSim(pid);
+
+        double elapsed = (nowNs(CLOCK_MONOTONIC) - start) / 1e9;
+        uint64_t frames = 0;
+
+        for (const Port &port : collector.ports) {
+            frames += port.frames;
+        }
+        printf("%7d  %9.0f  %10.0f  %10u  %4llu\n", devices, out.rows / elapsed, frames / elapsed,
+               collector.badFrames(), (unsigned long long)out.late);
+        fflush(stdout);
+    }
+    return 0;
+}
+
+static int dump(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    char magic[4];
+    uint16_t count;
+    uint64_t rows = 0, late = 0;
+    int64_t last = 0;
+
+    if (!file) {
+        perror(path);
+        return 1;
+    }
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, "RVC1", 4) || fread(&count, 2, 1, file) != 1) {
+        fprintf(stderr, "%s: not a collector file\n", path);
+        return 1;
+    }
+    std::vector<std::string> devices(count);
+    for (std::string &name : devices) {
+        uint8_t n;
+        char buf[256];
+
+        if (fread(&n, 1, 1, file) != 1 || fread(buf, 1, n, file) != n) {
+            fprintf(stderr, "%s: truncated\n", path);
+            return 1;
+        }
+        name.assign(buf, n);
+    }
+
+    printf("time,device,kind,devtime,temp,adc2,key,menu,flags\n");
+    while (fread(magic, 1, 4, file) == 4 && !memcmp(magic, "BLK1", 4)) {
+        uint32_t n;
+
+        if (fread(&n, 4, 1, file) != 1) {
+            break;
+        }
+        std::vector<int64_t> time(n);
+        std::vector<uint16_t> device(n), adc2(n);
+        std::vector<uint8_t> kind(n), key(n), menu(n), flags(n);
+        std::vector<uint32_t> devTime(n);
+        std::vector<int16_t> temp(n);
+        bool ok = fread(time.data(), 8, n, file) == n && fread(device.data(), 2, n, file) == n &&
+                  fread(kind.data(), 1, n, file) == n && fread(devTime.data(), 4, n, file) == n &&
+                  fread(temp.data(), 2, n, file) == n && fread(adc2.data(), 2, n, file) == n &&
+                  fread(key.data(), 1, n, file) == n && fread(menu.data(), 1, n, file) == n &&
+                  fread(flags.data(), 1, n, file) == n;
+        if (!ok) {
+            fprintf(stderr, "%s: truncated block\n", path);
+            break;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            static const char *kinds[] = { "temp", "adc2", "sample" };
+
+            late += time[i] < last;
+            last = std::max(last, time[i]);
+            printf("%lld.%09lld,%s,%s,%u,%d,%u,%u,%u,%u\n", (long long)(time[i] / 1000000000),
+                   (long long)(time[i] % 1000000000),
+                   device[i] < count ? devices[device[i]].c_str() : "?", kind[i] < 3 ? kinds[kind[i]] : "?",
+                   devTime[i], temp[i], adc2[i], key[i], menu[i], flags[i]);
+        }
+        rows += n;
+    }
+    fprintf(stderr, "%llu records, %llu out of time order\n", (unsigned long long)rows,
+            (unsigned long long)late);
+    fclose(file);
+    return 0;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: collector [-o out] [-b batch] [-w window] <tty>...\n"
+                    "       collector [-o out] [-w window] -s <devices> [-r rate] [-t seconds]\n"
+                    "       collector bench [-t seconds] [max devices]\n"
+                    "       collector dump <file>\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *outPath = "telemetry.rvc";
+    double window = 8;
+    double seconds = 0;
+    double rate = 10;
+    int simCount = 0;
+    int batch = 0;
+    int opt;
+
+    if (argc > 1 && strcmp(argv[1], "dump") == 0) {
+        if (argc != 3) {
+            usage();
+        }
+        return dump(argv[2]);
+    }
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        seconds = 2;
+        optind = 2;
+        while ((opt = getopt(argc, argv, "t:")) != -1) {
+            if (opt != 't') {
+                usage();
+            }
+            seconds = atof(optarg);
+        }
+        return bench(seconds, optind < argc ? atoi(argv[optind]) : 64);
+    }
+
+    while ((opt = getopt(argc, argv, "o:b:w:s:r:t:")) != -1) {
+        switch (opt) {
+        case 'o': outPath = optarg; break;
+        case 'b': batch = std::clamp(atoi(optarg), 1, TELEMETRY_MAX_BATCH); break;
+        case 'w': window = atof(optarg); break;
+        case 's': simCount = atoi(optarg); break;
+        case 'r': rate = atof(optarg); break;
+        case 't': seconds = atof(optarg); break;
+        default: usage();
+        }
+    }
+    if (simCount <= 0 && optind >= argc) {
+        usage();
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    ColumnWriter out;
+    Merger merger(out, int64_t(window * 1e9));
+    Collector collector(merger);
+    std::vector<std::string> names;
+    pid_t pid = 0;
+
+    collector.batch = batch;
+    if (simCount > 0) {
+        pid = startSim(collector, simCount, rate);
+    } else {
+        for (int i = optind; i < argc; i++) {
+            collector.add(argv[i]);
+        }
+    }
+    for (const Port &port : collector.ports) {
+        names.push_back(port.name);
+    }
+    if (!out.open(outPath, names)) {
+        stopSim(pid);
+        return 1;
+    }
+
+    collector.run(seconds);
+    stopSim(pid);
+    merger.drainAll();
+    out.close();
+
+    fprintf(stderr, "%llu records from %zu ports, %u bad frames, %llu written out of time order\n",
+            (unsigned long long)collector.records, collector.ports.size(), collector.badFrames(),
+            (unsigned long long)out.late);
+    return 0;
+}
@@ -0,0 +1,491 @@
+/*
+ * exportrx.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/*
+ * Host receiver for the log export, plays the 1284p side of export.h/bulk.h.
+ *
+ *   exportrx <tty> <file> <out>               export a file
+ *   exportrx -r <from>,<to> <tty> <out>       export a time range of the log
+ *
+ * A <tty> of the form sim:<image>[:loss%] starts a child process that runs the
+ * firmware export.c, bulk.c and swtimer.c against a flashtool image on the other end of a
+ * pty, dropping loss% of its frames, so the whole path can be tested without
+ * the board.
+ *
+ * Build: gcc -O2 -Wall -Ihost -o exportrx exportrx.c
+ */
+
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "hostflash.h"
+
+// the firmware sender, built with the packed on-flash structs
+#pragma pack(push, 1)
+#include "../003_AVR_RAVEN_Licznik_Czasu_Paszociagu_mkII/swtimer.c"
+#include "../003_AVR_RAVEN_Licznik_Czasu_Paszociagu_mkII/bulk.c"
+#include "../003_AVR_RAVEN_Licznik_Czasu_Paszociagu_mkII/export.c"
+#pragma pack(pop)
+
+#define FRAME_MAX 255
+
+// posted to by export.c, the board loop below stands in for sched_run()
+volatile uint8_t sched_events;
+
+typedef struct {
+    uint8_t cmd;
+    uint8_t length;
+    uint8_t payload[FRAME_MAX];
+} frame_t;
+
+// incremental frame parser, SOF len cmd payload EOF
+typedef struct {
+    int state;
+    uint8_t count;
+    frame_t frame;
+} parser_t;
+
+static int linkFd = -1;
+static int lossPercent;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int frameSend(int fd, uint8_t cmd, const uint8_t *payload, uint8_t length)
+{
+    uint8_t buf[FRAME_MAX + 4];
+
+    buf[0] = SOF_CHAR;
+    buf[1] = length;
+    buf[2] = cmd;
+    memcpy(&buf[3], payload, length);
+    buf[3 + length] = EOF_CHAR;
+    return write(fd, buf, length + 4) == length + 4 ? 0 : -1;
+}
+
+/**
+ * Feed one byte to the parser.
+ * @returns true when a complete frame is in parser->frame
+ */
+static bool frameParse(parser_t *p, uint8_t ch)
+{
+    switch (p->state) {
+    case 0:
+        if (ch == SOF_CHAR) {
+            p->state = 1;
+        }
+        break;
+    case 1:
+        p->frame.length = ch;
+        p->state = (ch >= 0x80) ? 4 : 2;    // ack frames have no cmd or payload
+        if (ch >= 0x80) {
+            p->frame.cmd = NULL_CMD;
+            p->frame.length = 0;
+        }
+        break;
+    case 2:
+        p->frame.cmd = ch;
+        p->count = 0;
+        p->state = p->frame.length ? 3 : 4;
+        break;
+    case 3:
+        p->frame.payload[p->count++] = ch;
+        if (p->count >= p->frame.length) {
+            p->state = 4;
+        }
+        break;
+    case 4:
+        p->state = 0;
+        return ch == EOF_CHAR;
+    }
+    return false;
+}
+
+static void rawMode(int fd)
+{
+    struct termios tio;
+
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetspeed(&tio, B38400);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+}
+
+/*
+ * Simulated board: firmware hooks
+ */
+
+volatile t_time RTC;
+static uint8_t *image;
+static size_t imageSize;
+
+uint8_t uart_queue_frame(uint8_t cmd, uint8_t payload_length, uint8_t *payload)
+{
+    if (lossPercent && (rand() % 100) < lossPercent) {
+        return true;    // lost on the wire
+    }
+    return frameSend(linkFd, cmd, payload, payload_length) == 0;
+}
+
+void uart_serial_send_frame(uint8_t cmd, uint8_t payload_length, uint8_t *payload)
+{
+    frameSend(linkFd, cmd, payload, payload_length);
+}
+
+int flashPageRead(void *datap, uint16_t page, uint16_t offset, uint16_t size)
+{
+    memcpy(datap, image + (size_t)page * FLASH_PAGE_SIZE + offset, size);
+    return 0;
+}
+
+int flashOpen(char *filename, flashFile_t *filep)
+{
+    uint16_t dirPage = FLASH_DIR_START_PAGE;
+    int count = 0;
+
+    while ((dirPage != 0) && (dirPage < FLASH_NUM_PAGES) && (count++ < FLASH_NUM_PAGES)) {
+        flashDirEntry_t *dir = (flashDirEntry_t *)(image + (size_t)dirPage * FLASH_PAGE_SIZE);
+
+        if (dir->nextEntryPage == 0xFFFF) {
+            break;      // empty directory
+        }
+        if (strcmp(dir->name, filename) == 0) {
+            memset(filep, 0, sizeof(*filep));
+            filep->size = dir->size;
+            filep->startNode = dir->startNode;
+            filep->endNode = dir->endNode;
+            filep->dirPage = dirPage;
+            return 0;
+        }
+        dirPage = dir->nextEntryPage;
+    }
+    return -1;
+}
+
+static int openImage(const char *name)
+{
+    struct stat st;
+    int fd = open(name, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(name);
+        return -1;
+    }
+    imageSize = st.st_size;
+    image = mmap(NULL, imageSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        perror(name);
+        return -1;
+    }
+    for (flashId = 0; flashId < FLASH_GEOM_COUNT; flashId++) {
+        if ((size_t)FLASH_NUM_PAGES * FLASH_PAGE_SIZE == imageSize) {
+            return 0;
+        }
+    }
+    fprintf(stderr, "%s: unknown image size %zu\n", name, imageSize);
+    return -1;
+}
+
+static void board(int fd)
+{
+    parser_t parser = { 0 };
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    uint8_t buf[256];
+    double start = now();
+
+    linkFd = fd;
+    srand(getpid());
+    for (;;) {
+        // don't wait while the export has more dataflash reads due
+        int timeout = (sched_events & SCHED_EV_FLASH) ? 0 : 10;
+
+        sched_events = 0;
+        RTC.total_sec = (uint32_t)(now() - start);
+        // the TIMER2 compare tick
+        swtimer_now = (uint16_t)((now() - start) * SWTIMER_HZ);
+        swtimer_task(SCHED_EV_TIMER);
+        if (poll(&pfd, 1, timeout) > 0) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+
+            if (n <= 0) {
+                exit(0);
+            }
+            for (ssize_t i = 0; i < n; i++) {
+                if (!frameParse(&parser, buf[i])) {
+                    continue;
+                }
+                if (parser.frame.cmd == REPORT_EXPORT) {
+                    export_request(parser.frame.payload, parser.frame.length);
+                } else if (parser.frame.cmd == REPORT_BULK_ACK) {
+                    bulk_ack(parser.frame.payload, parser.frame.length);
+                }
+            }
+        }
+        export_poll();
+    }
+}
+
+/*
+ * Receiver
+ */
+
+typedef struct {
+    bool have[256];
+    uint8_t length[256];
+    uint8_t data[256][BULK_DATA_SIZE];
+    uint8_t base;
+    bool done;
+} receiver_t;
+
+static void sendAck(int fd, receiver_t *rx)
+{
+    uint8_t payload[4];
+    uint16_t crc = 0xFFFF;
+
+    payload[0] = rx->base;
+    payload[1] = 0;
+    for (int i = 0; i < 8; i++) {
+        if (rx->have[(uint8_t)(rx->base + 1 + i)]) {
+            payload[1] |= 1 << i;
+        }
+    }
+    crc = _crc_ccitt_update(crc, payload[0]);
+    crc = _crc_ccitt_update(crc, payload[1]);
+    payload[2] = crc & 0xFF;
+    payload[3] = crc >> 8;
+    frameSend(fd, REPORT_BULK_ACK, payload, sizeof(payload));
+}
+
+/**
+ * Store a SEND_BULK_DATA block and write out every block now in order.
+ */
+static void rxBlock(int fd, receiver_t *rx, frame_t *frame, FILE *out, size_t *bytes, unsigned *bad)
+{
+    uint16_t crc = 0xFFFF;
+    uint8_t len;
+    uint8_t seq;
+
+    if (frame->length < 3) {
+        (*bad)++;
+        return;
+    }
+    len = frame->length - 3;
+    for (int i = 0; i < frame->length - 2; i++) {
+        crc = _crc_ccitt_update(crc, frame->payload[i]);
+    }
+    if (crc != (frame->payload[len + 1] | (frame->payload[len + 2] << 8)) || len > BULK_DATA_SIZE) {
+        (*bad)++;
+        return;
+    }
+
+    seq = frame->payload[0];
+    if ((uint8_t)(seq - rx->base) < BULK_WINDOW && !rx->done) {
+        rx->have[seq] = true;
+        rx->length[seq] = len;
+        memcpy(rx->data[seq], &frame->payload[1], len);
+        while (rx->have[rx->base]) {
+            rx->have[rx->base] = false;
+            if (!rx->length[rx->base]) {
+                rx->done = true;
+            }
+            fwrite(rx->data[rx->base], 1, rx->length[rx->base], out);
+            *bytes += rx->length[rx->base];
+            rx->base++;
+            if (rx->done) {
+                break;
+            }
+        }
+    }
+    // ack duplicates as well, the earlier ack may have been lost
+    sendAck(fd, rx);
+}
+
+static int receive(int fd, const uint8_t *request, uint8_t requestLen, const char *outName)
+{
+    static receiver_t rx;
+    parser_t parser = { 0 };
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    FILE *out = fopen(outName, "wb");
+    uint8_t buf[256];
+    double start = now();
+    double last = start;
+    double doneAt = 0;
+    size_t bytes = 0;
+    unsigned bad = 0;
+    int32_t size = -1;
+
+    if (!out) {
+        perror(outName);
+        return 1;
+    }
+    frameSend(fd, REPORT_EXPORT, request, requestLen);
+
+    while (!rx.done || now() - doneAt < 0.5) {
+        if (now() - last > 5) {
+            fprintf(stderr, "timeout, %zu bytes received\n", bytes);
+            return 1;
+        }
+        if (poll(&pfd, 1, 50) <= 0) {
+            continue;
+        }
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        last = now();
+        for (ssize_t i = 0; i < n; i++) {
+            if (!frameParse(&parser, buf[i])) {
+                continue;
+            }
+            if (parser.frame.cmd == SEND_EXPORT_INFO && parser.frame.length == 5) {
+                if ((int8_t)parser.frame.payload[0] != EXPORT_OK) {
+                    fprintf(stderr, "export failed, status %d\n", (int8_t)parser.frame.payload[0]);
+                    return 1;
+                }
+                memcpy(&size, &parser.frame.payload[1], sizeof(size));
+            } else if (parser.frame.cmd == SEND_BULK_DATA) {
+                bool wasDone = rx.done;
+
+                rxBlock(fd, &rx, &parser.frame, out, &bytes, &bad);
+                if (rx.done && !wasDone) {
+                    doneAt = now();
+                }
+            }
+        }
+    }
+    fclose(out);
+
+    if (!rx.done) {
+        fprintf(stderr, "link closed, %zu bytes received\n", bytes);
+        return 1;
+    }
+    printf("%zu bytes in %.2f s, %u bad blocks", bytes, doneAt - start, bad);
+    if ((uint32_t)size != EXPORT_SIZE_UNKNOWN && (uint32_t)size != bytes) {
+        printf(", SIZE MISMATCH (expected %d)\n", size);
+        return 1;
+    }
+    printf("\n");
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: exportrx <tty> <file> <out>\n"
+                    "       exportrx -r <from>,<to> <tty> <out>\n"
+                    "<tty> may be sim:<image>[:loss%%]\n");
+    exit(2);
+}
+
+static pid_t boardPid;
+
+/**
+ * Open the link to the board, or start the simulated one.
+ * @returns the file descriptor, or -1
+ */
+static int openLink(char *spec)
+{
+    char *loss;
+    int fd;
+
+    if (strncmp(spec, "sim:", 4) != 0) {
+        fd = open(spec, O_RDWR | O_NOCTTY);
+        if (fd < 0) {
+            perror(spec);
+            return -1;
+        }
+        rawMode(fd);
+        return fd;
+    }
+
+    if ((loss = strchr(spec + 4, ':')) != NULL) {
+        *loss++ = 0;
+        lossPercent = atoi(loss);
+    }
+    if (openImage(spec + 4) < 0) {
+        return -1;
+    }
+    fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+        perror("pty");
+        return -1;
+    }
+    rawMode(fd);
+
+    boardPid = fork();
+    if (boardPid == 0) {
+        int slave = open(ptsname(fd), O_RDWR | O_NOCTTY);
+
+        close(fd);
+        rawMode(slave);
+        board(slave);
+    }
+    return fd;
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t request[UART_MAX_PAYLOAD];
+    uint8_t requestLen;
+    const char *outName;
+    int fd;
+    int rc;
+
+    if (argc == 5 && strcmp(argv[1], "-r") == 0) {
+        uint32_t from;
+        uint32_t to;
+
+        if (sscanf(argv[2], "%u,%u", &from, &to) != 2) {
+            usage();
+        }
+        request[0] = EXPORT_BY_TIME;
+        memcpy(&request[1], &from, sizeof(from));
+        memcpy(&request[5], &to, sizeof(to));
+        requestLen = 9;
+        fd = openLink(argv[3]);
+        outName = argv[4];
+    } else if (argc == 4) {
+        requestLen = strlen(argv[2]) + 1;
+        if (requestLen > UART_MAX_PAYLOAD) {
+            usage();
+        }
+        request[0] = EXPORT_BY_NAME;
+        memcpy(&request[1], argv[2], requestLen - 1);
+        fd = openLink(argv[1]);
+        outName = argv[3];
+    } else {
+        usage();
+    }
+    if (fd < 0) {
+        return 1;
+    }
+
+    rc = receive(fd, request, requestLen, outName);
+    if (boardPid > 0) {
+        kill(boardPid, SIGTERM);
+        waitpid(boardPid, NULL, 0);
+    }
+    return rc;
+}
@@ -0,0 +1,451 @@
+/*
+ * flashtool.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/*
+ * Host-side toolkit for raw AT45DB dataflash images written by flashfile.c.
+ *
+ *   flashtool mkfs <image> [pages [pagesize]]   create and format an image
+ *   flashtool ls   <image>                      list the directory
+ *   flashtool cat  <image> <file>               write a file to stdout
+ *   flashtool fsck <image>                      check map, directory and node chains
+ *
+ * Build: gcc -O2 -Wall -o flashtool flashtool.c
+ *
+ * The image is mmap()ed and the on-flash structs are taken straight from
+ * flashfile.h/flashrec.h, packed to match the AVR layout.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hostflash.h"
+
+static uint8_t *image;
+static size_t imageSize;
+
+// node usage found while walking the directory
+enum {
+    NODE_UNSEEN = 0,
+    NODE_SYSTEM,
+    NODE_DIR,
+    NODE_FILE,
+};
+
+static uint8_t *page(uint16_t page)
+{
+    return image + (size_t)page * FLASH_PAGE_SIZE;
+}
+
+static bool mapNodeFree(uint16_t node)
+{
+    return (image[node >> 3] & (1 << (7 - (node & 7)))) != 0;
+}
+
+static void mapUseNode(uint16_t node)
+{
+    image[node >> 3] &= ~(1 << (7 - (node & 7)));
+}
+
+// same as _crc_ccitt_update() in avr-libc
+static uint16_t crcCcittUpdate(uint16_t crc, uint8_t data)
+{
+    data ^= crc & 0xFF;
+    data ^= data << 4;
+    return ((((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4) ^ ((uint16_t)data << 3));
+}
+
+static uint16_t crcCcitt(uint16_t crc, const uint8_t *datap, size_t size)
+{
+    while (size--) {
+        crc = crcCcittUpdate(crc, *datap++);
+    }
+    return crc;
+}
+
+/**
+ * Find the newest valid slot of a persistent record, see flashrec.c
+ * @returns pointer to the slot header, or NULL if there is no valid copy
+ */
+static flashRecHeader_t *recFind(uint8_t rec)
+{
+    flashRecHeader_t *best = NULL;
+
+    for (uint8_t slot = 0; slot < 2; slot++) {
+        flashRecHeader_t *hdr = (flashRecHeader_t *)page(FLASH_REC_PAGE(rec, slot));
+        uint16_t crc;
+
+        if ((hdr->magic != FLASH_REC_MAGIC) || (hdr->size > FLASH_REC_MAX_SIZE)) {
+            continue;
+        }
+        crc = crcCcitt(0xFFFF, (uint8_t *)&hdr->seq, sizeof(hdr->seq));
+        crc = crcCcitt(crc, &hdr->size, sizeof(hdr->size));
+        crc = crcCcitt(crc, (uint8_t *)(hdr + 1), hdr->size);
+        if (crc != hdr->crc) {
+            continue;
+        }
+        if (!best || ((int16_t)(hdr->seq - best->seq) > 0)) {
+            best = hdr;
+        }
+    }
+
+    return best;
+}
+
+static void recWrite(uint8_t rec, void *datap, uint8_t size)
+{
+    flashRecHeader_t *cur = recFind(rec);
+    uint8_t slot = 0;
+    flashRecHeader_t *hdr;
+
+    if (cur) {
+        slot = (page(FLASH_REC_PAGE(rec, 0)) == (uint8_t *)cur) ? 1 : 0;
+    }
+    hdr = (flashRecHeader_t *)page(FLASH_REC_PAGE(rec, slot));
+    memset(hdr, 0xFF, FLASH_PAGE_SIZE);
+    hdr->magic = FLASH_REC_MAGIC;
+    hdr->seq = cur ? cur->seq + 1 : 1;
+    hdr->size = size;
+    memcpy(hdr + 1, datap, size);
+    hdr->crc = crcCcitt(0xFFFF, (uint8_t *)&hdr->seq, sizeof(hdr->seq));
+    hdr->crc = crcCcitt(hdr->crc, &hdr->size, sizeof(hdr->size));
+    hdr->crc = crcCcitt(hdr->crc, datap, size);
+}
+
+static int setGeometry(uint16_t pages, uint16_t pageSize)
+{
+    for (flashId = 0; flashId < FLASH_GEOM_COUNT; flashId++) {
+        if ((flashGeom[flashId].pageCount == pages) && (flashGeom[flashId].pageSize == pageSize)) {
+            return 0;
+        }
+    }
+    flashId = -1;
+    return -1;
+}
+
+static int openImage(const char *name, bool writable)
+{
+    struct stat st;
+    int fd = open(name, writable ? O_RDWR : O_RDONLY);
+
+    if ((fd < 0) || (fstat(fd, &st) < 0)) {
+        perror(name);
+        return -1;
+    }
+    imageSize = st.st_size;
+
+    for (flashId = 0; flashId < FLASH_GEOM_COUNT; flashId++) {
+        if ((size_t)FLASH_NUM_PAGES * FLASH_PAGE_SIZE == imageSize) {
+            break;
+        }
+    }
+    if (flashId == FLASH_GEOM_COUNT) {
+        fprintf(stderr, "%s: %zu bytes does not match any AT45DB geometry\n", name, imageSize);
+        close(fd);
+        return -1;
+    }
+
+    image = mmap(NULL, imageSize, writable ? PROT_READ|PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Format an image the same way flashFormat() formats the chip.
+ */
+static int cmdMkfs(const char *name, uint16_t pages, uint16_t pageSize)
+{
+    flashFormatStamp_t stamp = { FLASH_FORMAT_MAGIC, FLASH_FORMAT_LAYOUT };
+    uint16_t freeNodes;
+    int fd;
+
+    if (setGeometry(pages, pageSize) < 0) {
+        fprintf(stderr, "no AT45DB with %u pages of %u bytes\n", pages, pageSize);
+        return 1;
+    }
+    imageSize = (size_t)pages * pageSize;
+
+    fd = open(name, O_RDWR|O_CREAT|O_TRUNC, 0644);
+    if ((fd < 0) || (ftruncate(fd, imageSize) < 0)) {
+        perror(name);
+        return 1;
+    }
+    image = mmap(NULL, imageSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    // erased chip, map and first directory page in use
+    memset(image, 0xFF, imageSize);
+    for (uint16_t node = 0; node < FLASH_MAP_PAGE_COUNT+1; node++) {
+        mapUseNode(node);
+    }
+    // bytes of the last map page past the bitmap are zeroed
+    memset(image + FLASH_MAP_SIZE, 0, FLASH_PAGE_SIZE - (FLASH_MAP_SIZE % FLASH_PAGE_SIZE));
+    memcpy(page(FLASH_FORMAT_PAGE) + FLASH_FORMAT_OFFSET, &stamp, sizeof(stamp));
+    for (uint16_t node = FLASH_REC_START_PAGE; node < FLASH_NUM_PAGES; node++) {
+        mapUseNode(node);
+    }
+
+    freeNodes = FLASH_USABLE_NODES;
+    recWrite(FLASH_REC_FREE, &freeNodes, sizeof(freeNodes));
+
+    munmap(image, imageSize);
+    return 0;
+}
+
+/**
+ * Call fn for every directory entry, stops on loops or invalid pages.
+ * @returns number of entries visited
+ */
+static int dirWalk(void (*fn)(uint16_t dirPage, flashDirEntry_t *dir, void *arg), void *arg)
+{
+    uint16_t dirPage = FLASH_DIR_START_PAGE;
+    int count = 0;
+
+    while ((dirPage != 0) && (count < FLASH_NUM_PAGES)) {
+        flashDirEntry_t *dir = (flashDirEntry_t *)page(dirPage);
+
+        if (dir->nextEntryPage == 0xFFFF) {
+            break;      // empty directory
+        }
+        fn(dirPage, dir, arg);
+        count++;
+        dirPage = dir->nextEntryPage;
+        if (dirPage >= FLASH_NUM_PAGES) {
+            break;
+        }
+    }
+    return count;
+}
+
+static void lsEntry(uint16_t dirPage, flashDirEntry_t *dir, void *arg)
+{
+    printf("%10u  %5u %5u %5u  %.*s\n", dir->size, dirPage, dir->startNode, dir->endNode,
+            (int)(FLASH_PAGE_SIZE - offsetof(flashDirEntry_t, name)), dir->name);
+}
+
+static int cmdLs(void)
+{
+    flashRecHeader_t *rec = recFind(FLASH_REC_FREE);
+
+    printf("%10s  %5s %5s %5s  %s\n", "size", "dir", "start", "end", "name");
+    dirWalk(lsEntry, NULL);
+    if (rec) {
+        printf("%u of %u nodes free\n", *(uint16_t *)(rec + 1), FLASH_USABLE_NODES);
+    }
+    return 0;
+}
+
+struct catArg {
+    const char *name;
+    int found;
+};
+
+static void catEntry(uint16_t dirPage, flashDirEntry_t *dir, void *arg)
+{
+    struct catArg *cat = arg;
+    uint32_t left = dir->size;
+    uint16_t node = dir->startNode;
+    uint32_t hops = 0;
+
+    if (cat->found || strncmp(dir->name, cat->name, FLASH_PAGE_SIZE - offsetof(flashDirEntry_t, name))) {
+        return;
+    }
+    cat->found = 1;
+
+    while (left && node && (node < FLASH_NUM_PAGES) && (hops++ < FLASH_NUM_PAGES)) {
+        flashNode_t *nodep = (flashNode_t *)page(node);
+        uint32_t len = left < FLASH_FILE_NODE_SIZE ? left : FLASH_FILE_NODE_SIZE;
+
+        fwrite(nodep->data, 1, len, stdout);
+        left -= len;
+        node = nodep->hdr.nextNode;
+    }
+    if (left) {
+        fprintf(stderr, "%s: chain ends %u bytes short\n", cat->name, left);
+        cat->found = 2;
+    }
+}
+
+static int cmdCat(const char *name)
+{
+    struct catArg cat = { name, 0 };
+
+    dirWalk(catEntry, &cat);
+    if (!cat.found) {
+        fprintf(stderr, "%s: not found\n", name);
+        return 1;
+    }
+    return cat.found == 1 ? 0 : 1;
+}
+
+struct fsckArg {
+    uint8_t *owner;
+    int errors;
+};
+
+static void __attribute__((format(printf, 2, 3))) fsckError(struct fsckArg *fsck, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    fsck->errors++;
+}
+
+static void fsckClaim(struct fsckArg *fsck, uint16_t node, uint8_t use, const char *name)
+{
+    if (fsck->owner[node] != NODE_UNSEEN) {
+        fsckError(fsck, "%s: node %u is cross-linked\n", name, node);
+    }
+    fsck->owner[node] = use;
+    if (mapNodeFree(node)) {
+        fsckError(fsck, "%s: node %u is in use but free in the map\n", name, node);
+    }
+}
+
+static void fsckEntry(uint16_t dirPage, flashDirEntry_t *dir, void *arg)
+{
+    struct fsckArg *fsck = arg;
+    char name[64];
+    uint16_t node = dir->startNode;
+    uint16_t prev = 0;
+    uint16_t last = 0;
+    uint32_t nodes = 0;
+    uint32_t expect;
+
+    snprintf(name, sizeof(name), "%.*s", (int)(sizeof(name) - 1), dir->name);
+    if (dirPage != FLASH_DIR_START_PAGE) {
+        fsckClaim(fsck, dirPage, NODE_DIR, name);
+    }
+
+    while (node != 0) {
+        flashNode_t *nodep;
+
+        if (node >= FLASH_NUM_PAGES) {
+            fsckError(fsck, "%s: node %u out of range\n", name, node);
+            break;
+        }
+        if (fsck->owner[node] == NODE_FILE) {
+            fsckError(fsck, "%s: node chain loops at %u\n", name, node);
+            break;
+        }
+        fsckClaim(fsck, node, NODE_FILE, name);
+        nodep = (flashNode_t *)page(node);
+        if (nodep->hdr.prevNode != prev) {
+            fsckError(fsck, "%s: node %u prev is %u, expected %u\n", name, node, nodep->hdr.prevNode, prev);
+        }
+        prev = last = node;
+        node = nodep->hdr.nextNode;
+        nodes++;
+    }
+
+    if (last != dir->endNode) {
+        fsckError(fsck, "%s: chain ends at node %u, directory says %u\n", name, last, dir->endNode);
+    }
+    expect = (dir->size + FLASH_FILE_NODE_SIZE - 1) / FLASH_FILE_NODE_SIZE;
+    if ((expect == 0) && dir->startNode) {
+        expect = 1;
+    }
+    if (nodes != expect) {
+        fsckError(fsck, "%s: %u bytes need %u nodes, chain has %u\n", name, dir->size, expect, nodes);
+    }
+}
+
+static int cmdFsck(void)
+{
+    struct fsckArg fsck = { calloc(FLASH_NUM_PAGES, 1), 0 };
+    flashRecHeader_t *rec;
+    uint16_t mapFree = 0;
+    uint16_t orphans = 0;
+    flashFormatStamp_t *stamp = (flashFormatStamp_t *)(page(FLASH_FORMAT_PAGE) + FLASH_FORMAT_OFFSET);
+    int files;
+
+    if ((stamp->magic != FLASH_FORMAT_MAGIC) || (stamp->layout != FLASH_FORMAT_LAYOUT)) {
+        fsckError(&fsck, "format layout %u, the firmware uses %u, the records are not checked\n",
+                (stamp->magic == FLASH_FORMAT_MAGIC) ? stamp->layout : 0, FLASH_FORMAT_LAYOUT);
+        free(fsck.owner);
+        printf("%d errors\n", fsck.errors);
+        return 1;
+    }
+    for (uint16_t node = 0; node < FLASH_MAP_PAGE_COUNT+1; node++) {
+        fsckClaim(&fsck, node, NODE_SYSTEM, "map");
+    }
+    for (uint16_t node = FLASH_REC_START_PAGE; node < FLASH_NUM_PAGES; node++) {
+        fsckClaim(&fsck, node, NODE_SYSTEM, "records");
+    }
+
+    files = dirWalk(fsckEntry, &fsck);
+
+    for (uint16_t node = 0; node < FLASH_NUM_PAGES; node++) {
+        if (mapNodeFree(node)) {
+            mapFree++;
+        } else if (fsck.owner[node] == NODE_UNSEEN) {
+            orphans++;
+            fsckError(&fsck, "node %u is used in the map but not referenced\n", node);
+        }
+    }
+
+    rec = recFind(FLASH_REC_FREE);
+    if (!rec) {
+        fsckError(&fsck, "no valid free count record\n");
+    } else if (*(uint16_t *)(rec + 1) != mapFree) {
+        fsckError(&fsck, "free count record says %u, map has %u free\n", *(uint16_t *)(rec + 1), mapFree);
+    }
+
+    printf("%d files, %u of %u nodes free, %u orphans, %d errors\n",
+            files, mapFree, FLASH_NUM_PAGES, orphans, fsck.errors);
+    free(fsck.owner);
+    return fsck.errors ? 1 : 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: flashtool mkfs <image> [pages [pagesize]]\n"
+                    "       flashtool ls   <image>\n"
+                    "       flashtool cat  <image> <file>\n"
+                    "       flashtool fsck <image>\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        usage();
+    }
+
+    if (strcmp(argv[1], "mkfs") == 0) {
+        uint16_t pages = argc > 3 ? atoi(argv[3]) : 2048;
+        uint16_t pageSize = argc > 4 ? atoi(argv[4]) : 264;
+        return cmdMkfs(argv[2], pages, pageSize);
+    }
+
+    if (openImage(argv[2], false) < 0) {
+        return 1;
+    }
+    if (strcmp(argv[1], "ls") == 0) {
+        return cmdLs();
+    } else if ((strcmp(argv[1], "cat") == 0) && (argc > 3)) {
+        return cmdCat(argv[3]);
+    } else if (strcmp(argv[1], "fsck") == 0) {
+        return cmdFsck();
+    }
+    usage();
+    return 2;
+}
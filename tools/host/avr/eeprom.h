@@ -0,0 +1,41 @@
+/*
+ * Host version of <avr/eeprom.h>, the EEPROM is an array in RAM that starts
+ * erased.
+ */
+
+#ifndef _AVR_EEPROM_H_
+#define _AVR_EEPROM_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEPROM_SIZE 1024
+
+static uint8_t eeprom[EEPROM_SIZE];
+static uint8_t eepromErased;
+
+static inline uint8_t *eepromCell(const uint8_t *addr)
+{
+    if (!eepromErased) {
+        memset(eeprom, 0xFF, sizeof(eeprom));
+        eepromErased = 1;
+    }
+    return &eeprom[(uintptr_t)addr % EEPROM_SIZE];
+}
+
+static inline uint8_t eeprom_read_byte(const uint8_t *addr)
+{
+    return *eepromCell(addr);
+}
+
+static inline void eeprom_write_byte(uint8_t *addr, uint8_t value)
+{
+    *eepromCell(addr) = value;
+}
+
+static inline void eeprom_update_byte(uint8_t *addr, uint8_t value)
+{
+    *eepromCell(addr) = value;
+}
+
+#endif
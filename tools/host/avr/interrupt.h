@@ -0,0 +1,13 @@
+/*
+ * Host version of <avr/interrupt.h>. An ISR becomes a plain function the host
+ * tool calls to simulate the interrupt.
+ */
+
+#ifndef _AVR_INTERRUPT_H
+#define _AVR_INTERRUPT_H
+
+#define ISR(vect) void vect(void)
+#define sei()
+#define cli()
+
+#endif
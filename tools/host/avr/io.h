@@ -0,0 +1,4 @@
+/*
+ * Empty stand-in for <avr/io.h>, lets the host tools build firmware modules
+ * that do not touch any registers.
+ */
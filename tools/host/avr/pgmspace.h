@@ -0,0 +1,17 @@
+/*
+ * Host version of the avr-libc <avr/pgmspace.h> macros the firmware uses,
+ * flash data is plain data on the host.
+ */
+
+#ifndef _AVR_PGMSPACE_H
+#define _AVR_PGMSPACE_H
+
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_ptr(p) (*(void * const *)(p))
+
+#endif
@@ -0,0 +1,19 @@
+/*
+ * Host version of <avr/sleep.h>. There is nothing to wake the host up, so
+ * sleep_cpu() returns at once and the firmware loop around it polls.
+ */
+
+#ifndef _AVR_SLEEP_H_
+#define _AVR_SLEEP_H_
+
+#define SLEEP_MODE_IDLE     0
+#define SLEEP_MODE_PWR_SAVE 1
+#define SLEEP_MODE_PWR_DOWN 2
+
+#define set_sleep_mode(mode)    ((void)(mode))
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()
+#define sleep_mode()
+
+#endif
@@ -0,0 +1,13 @@
+/*
+ * Host version of <util/atomic.h>, the host tools run the firmware code from
+ * a single thread, so the block is just run once.
+ */
+
+#ifndef _UTIL_ATOMIC_H_
+#define _UTIL_ATOMIC_H_
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+#define ATOMIC_BLOCK(type) for (int atomicOnce = 1; atomicOnce; atomicOnce = 0)
+
+#endif
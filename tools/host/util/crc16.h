@@ -0,0 +1,17 @@
+/*
+ * Host version of the avr-libc <util/crc16.h> functions the firmware uses.
+ */
+
+#ifndef _UTIL_CRC16_H
+#define _UTIL_CRC16_H
+
+#include <stdint.h>
+
+static inline uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data)
+{
+    data ^= crc & 0xFF;
+    data ^= data << 4;
+    return ((((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4) ^ ((uint16_t)data << 3));
+}
+
+#endif
@@ -0,0 +1,18 @@
+/*
+ * Host version of <util/delay_basic.h>. A tool that models CPU cycles can
+ * define _delay_loop_1() itself before including the firmware.
+ */
+
+#ifndef _UTIL_DELAY_BASIC_H_
+#define _UTIL_DELAY_BASIC_H_
+
+#include <stdint.h>
+
+#ifndef _delay_loop_1
+static inline void _delay_loop_1(uint8_t count)
+{
+    (void)count;
+}
+#endif
+
+#endif
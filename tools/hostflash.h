@@ -0,0 +1,38 @@
+/*
+ * hostflash.h
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/*
+ * Firmware dataflash definitions for the host tools. The on-flash structs are
+ * packed to match the AVR layout.
+ */
+
+#ifndef _HOSTFLASH_H
+#define _HOSTFLASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#pragma pack(push, 1)
+#include "../003_AVR_RAVEN_Licznik_Czasu_Paszociagu_mkII/flashfile.h"
+#pragma pack(pop)
+
+// operating parameters for the different size flash chips, as in flashHQ.c
+flashGeometry_t flashGeom[] = {
+    { 9,  3,  7, 264,   512,  128 },
+    { 9,  3,  7, 264,  1024,  128 },
+    { 9,  3,  8, 264,  2048,  256 },
+    { 9,  3,  8, 264,  4096,  256 },
+    { 10, 3,  8, 528,  4096,  256 },
+    { 10, 3,  7, 528,  8192,  128 },
+    { 9,  3, 10, 264, 32768, 1024 },
+};
+int8_t flashId = -1;
+
+#define FLASH_GEOM_COUNT ((int8_t)(sizeof(flashGeom)/sizeof(flashGeom[0])))
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ * logdump.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/*
+ * Decoder for flashlog.c runtime logs.
+ *
+ *   logdump [-p pagesize] <logfile>    print the records of a log as CSV
+ *   logdump -b [days]                  encode a synthetic log and report the
+ *                                      compression against plain structs
+ *
+ * <logfile> is the file contents as extracted with "flashtool cat".
+ *
+ * Build: gcc -O2 -Wall -o logdump logdump.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hostflash.h"
+
+// the firmware codec, built with the packed on-flash structs
+#pragma pack(push, 1)
+#include "../003_AVR_RAVEN_Licznik_Czasu_Paszociagu_mkII/flashlog.c"
+#pragma pack(pop)
+
+// naive log entry the codec is compared against
+typedef struct __attribute__((packed)) {
+    uint32_t time;
+    uint8_t lines;
+    int16_t temp;
+} plainRecord_t;
+
+static uint8_t *benchBuf;
+static size_t benchSize;
+
+/**
+ * flashWrite() stand-in for the benchmark, appends to benchBuf.
+ */
+int flashWrite(flashFile_t *filep, void *datap, size_t size)
+{
+    benchBuf = realloc(benchBuf, benchSize + size);
+    memcpy(benchBuf + benchSize, datap, size);
+    benchSize += size;
+    filep->size += size;
+    return 0;
+}
+
+typedef void (*recordFn)(const flashLog_t *logp, void *arg);
+
+/**
+ * Decode a log, resyncing at the next node after padding or a bad record.
+ * @returns number of bad records skipped
+ */
+static int decode(const uint8_t *buf, size_t size, recordFn fn, void *arg)
+{
+    flashLog_t log;
+    size_t pos = 0;
+    int errors = 0;
+
+    flashLogInit(&log);
+    while (pos < size) {
+        size_t nodeEnd = (pos / FLASH_FILE_NODE_SIZE + 1) * FLASH_FILE_NODE_SIZE;
+        int8_t len;
+
+        if (nodeEnd > size) {
+            nodeEnd = size;
+        }
+        len = flashLogDecode(&log, buf + pos, nodeEnd - pos);
+        if (len <= 0) {
+            if (len < 0) {
+                errors++;
+                log.synced = false;
+            }
+            pos = nodeEnd;
+            continue;
+        }
+        pos += len;
+        if (log.synced) {
+            fn(&log, arg);
+        }
+    }
+    return errors;
+}
+
+static void printRecord(const flashLog_t *logp, void *arg)
+{
+    printf("%u,0x%02x,%d\n", logp->time, logp->lines, logp->temp);
+}
+
+static int dump(const char *name)
+{
+    FILE *fp = fopen(name, "rb");
+    uint8_t *buf;
+    long size;
+    int errors;
+
+    if (!fp) {
+        perror(name);
+        return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    buf = malloc(size);
+    if (fread(buf, 1, size, fp) != (size_t)size) {
+        perror(name);
+        return 1;
+    }
+    fclose(fp);
+
+    printf("time,lines,temp\n");
+    errors = decode(buf, size, printRecord, NULL);
+    if (errors) {
+        fprintf(stderr, "%s: %d bad records skipped\n", name, errors);
+    }
+    free(buf);
+    return errors ? 1 : 0;
+}
+
+struct verify {
+    plainRecord_t *expect;
+    size_t count;
+    size_t pos;
+    size_t mismatches;
+};
+
+static void verifyRecord(const flashLog_t *logp, void *arg)
+{
+    struct verify *v = arg;
+    plainRecord_t *rec = &v->expect[v->pos++];
+
+    if ((v->pos > v->count) || (rec->time != logp->time) ||
+        (rec->lines != logp->lines) || (rec->temp != logp->temp)) {
+        v->mismatches++;
+    }
+}
+
+/**
+ * Synthetic feed-line month: 4 lines, each started 8-16 times a day for
+ * 2-40 minutes, and a temperature sample every minute.
+ */
+static int bench(int days)
+{
+    flashFile_t file = { 0 };
+    flashLog_t log;
+    plainRecord_t *plain = NULL;
+    size_t count = 0;
+    uint8_t lines = 0;
+    int16_t temp = 40;
+    uint32_t stopAt[4] = { 0 };
+    uint32_t startAt[4];
+    struct verify v;
+    clock_t start;
+
+    srand(1);
+    for (int line = 0; line < 4; line++) {
+        startAt[line] = rand() % 7200;
+    }
+
+    flashLogInit(&log);
+    start = clock();
+    for (uint32_t now = 0; now < (uint32_t)days * 86400; now++) {
+        uint8_t next = lines;
+
+        for (int line = 0; line < 4; line++) {
+            if ((lines & (1 << line)) && (now >= stopAt[line])) {
+                next &= ~(1 << line);
+                startAt[line] = now + 86400 / (8 + rand() % 9);
+            } else if (!(lines & (1 << line)) && (now >= startAt[line])) {
+                next |= 1 << line;
+                stopAt[line] = now + 120 + rand() % 2280;
+            }
+        }
+        if (next != lines) {
+            lines = next;
+            flashLogLines(&log, &file, now, lines);
+        } else if ((now % 60) == 0) {
+            temp += (rand() % 3) - 1;
+            flashLogTemp(&log, &file, now, temp);
+        } else {
+            continue;
+        }
+
+        plain = realloc(plain, (count + 1) * sizeof(*plain));
+        plain[count].time = now;
+        plain[count].lines = lines;
+        plain[count].temp = temp;
+        count++;
+    }
+
+    v.expect = plain;
+    v.count = count;
+    v.pos = 0;
+    v.mismatches = 0;
+    decode(benchBuf, benchSize, verifyRecord, &v);
+
+    printf("%d days, %zu records\n", days, count);
+    printf("plain structs: %8zu bytes (%zu per record)\n", count * sizeof(*plain), sizeof(*plain));
+    printf("flashlog:      %8zu bytes (%.2f per record)\n", benchSize, (double)benchSize / count);
+    printf("ratio:         %8.2f : 1, %zu flash nodes\n",
+            (double)(count * sizeof(*plain)) / benchSize,
+            (benchSize + FLASH_FILE_NODE_SIZE - 1) / FLASH_FILE_NODE_SIZE);
+    printf("encode+decode: %8.1f ms, %s\n", (clock() - start) * 1000.0 / CLOCKS_PER_SEC,
+            (v.pos == count && !v.mismatches) ? "round trip ok" : "ROUND TRIP MISMATCH");
+
+    free(plain);
+    return (v.pos == count && !v.mismatches) ? 0 : 1;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: logdump [-p pagesize] <logfile>\n"
+                    "       logdump -b [days]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    uint16_t pageSize = 264;
+    int arg = 1;
+
+    if ((argc > 2) && (strcmp(argv[1], "-p") == 0)) {
+        pageSize = atoi(argv[2]);
+        arg += 2;
+    }
+    for (flashId = 0; flashId < FLASH_GEOM_COUNT; flashId++) {
+        if (flashGeom[flashId].pageSize == pageSize) {
+            break;
+        }
+    }
+    if (flashId == FLASH_GEOM_COUNT) {
+        usage();
+    }
+
+    if ((argc > arg) && (strcmp(argv[arg], "-b") == 0)) {
+        return bench(argc > arg + 1 ? atoi(argv[arg + 1]) : 30);
+    }
+    if (argc != arg + 1) {
+        usage();
+    }
+    return dump(argv[arg]);
+}
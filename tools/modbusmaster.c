@@ -0,0 +1,482 @@
+/*
+ * modbusmaster.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/*
+ * Modbus RTU master for the firmware slave in modbus.c.
+ *
+ *   modbusmaster <tty> <slave> input <start> <count>     read input registers
+ *   modbusmaster <tty> <slave> read <start> <count>      read holding registers
+ *   modbusmaster <tty> <slave> write <start> <value>...  write holding registers
+ *   modbusmaster <tty> <slave> test [polls]              protocol checks, then
+ *                                                        reply latency over polls
+ *
+ * A <tty> of "sim" starts a child process that runs the firmware modbus.c on
+ * the other end of a pty, with TIMER1 and the USART RX interrupt driven from
+ * the host clock, so the slave can be tested without the board. The latency
+ * is measured from the end of the request to the first byte of the reply.
+ *
+ * Build: gcc -O2 -Wall -Ihost -o modbusmaster modbusmaster.c
+ */
+
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+ * Simulated board: register stand-ins and firmware hooks
+ */
+
+static volatile uint8_t SREG, PRR, TIMSK1, TIFR1, TCCR1A, TCCR1B, UCSR0C;
+static volatile uint16_t TCNT1, OCR1B;
+#define FE0     4
+#define DOR0    3
+#define UPE0    2
+#define UPM01   5
+#define UCSZ00  1
+#define PRTIM1  3
+#define CS10    0
+#define CS11    1
+#define OCF1B   2
+#define OCIE1B  2
+
+// temp.h pulls in the ADC registers, only temp_get() is needed
+#define __TEMP_H__
+#define MEASURE_ADC2 1
+typedef enum { TEMP_UNIT_CELCIUS, TEMP_UNIT_FAHRENHEIT } temp_unit_t;
+int16_t temp_get(temp_unit_t unit);
+
+#define MODBUS_ENABLE 1
+#include "../003_AVR_RAVEN_Licznik_Czasu_Paszociagu_mkII/modbus.c"
+#include "../003_AVR_RAVEN_Licznik_Czasu_Paszociagu_mkII/calendar.c"
+
+#define SIM_TEMP    21
+#define SIM_ADC2    3300
+
+volatile t_time RTC;
+volatile tuart_stats uart_stats;
+bool auto_temp;
+uint8_t menu_ndx;
+uint16_t ADC2_reading = SIM_ADC2;
+
+static int linkFd = -1;
+
+int16_t temp_get(temp_unit_t unit)
+{
+    return SIM_TEMP;
+}
+
+// calendar.c checkpoints, there is no dataflash here
+int flashRecRead(uint8_t rec, void *datap, uint8_t size)
+{
+    return -1;
+}
+
+int flashRecWrite(uint8_t rec, void *datap, uint8_t size)
+{
+    return 0;
+}
+
+void swtimer_start(t_swtimer *timer, t_swtimer_handler handler, uint16_t delay, uint16_t period)
+{
+}
+
+void uart_init(void)
+{
+}
+
+uint8_t uart_queue_raw(const uint8_t *buf, uint8_t length)
+{
+    return write(linkFd, buf, length) == length;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// TIMER1 at 8us per tick
+static uint16_t timer1(void)
+{
+    return (uint16_t)(now() * 125000);
+}
+
+static void board(int fd)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    struct timespec tick = { 0, 50000 };
+    uint8_t buf[256];
+    double start = now();
+
+    linkFd = fd;
+    modbus_init();
+    for (;;) {
+        if (ppoll(&pfd, 1, &tick, NULL) > 0) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+
+            if (n <= 0) {
+                exit(0);
+            }
+            for (ssize_t i = 0; i < n; i++) {
+                TCNT1 = timer1();
+                modbus_rx_char(0, buf[i]);
+            }
+        }
+        TCNT1 = timer1();
+        if ((TIMSK1 & (1 << OCIE1B)) && (int16_t)(TCNT1 - OCR1B) >= 0) {
+            TIMER1_COMPB_vect();
+        }
+        RTC.total_sec = (uint32_t)(now() - start);
+        modbus_poll();
+    }
+}
+
+/*
+ * Master
+ */
+
+#define REPLY_TIMEOUT 0.1
+
+static double lastLatency;
+
+static void rawMode(int fd)
+{
+    struct termios tio;
+
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetspeed(&tio, B38400);
+        tio.c_cflag |= PARENB;
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+}
+
+// bitwise CRC, independent of the table in modbus.c
+static uint16_t crc16(const uint8_t *buf, int length)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (length--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+/**
+ * Wait for a reply, it ends after 3.5 characters of silence.
+ * @param sent when the request was written
+ * @returns reply length without the CRC, 0 for no reply, -1 for a bad CRC
+ */
+static int receive(int fd, uint8_t *reply, double sent)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    double last = 0;
+    int count = 0;
+
+    lastLatency = 0;
+    for (;;) {
+        double limit = count ? last + 0.002 : sent + REPLY_TIMEOUT;
+
+        if (now() >= limit) {
+            break;
+        }
+        if (poll(&pfd, 1, (int)((limit - now()) * 1000) + 1) <= 0) {
+            continue;
+        }
+        ssize_t n = read(fd, reply + count, 256 - count);
+        if (n <= 0) {
+            break;
+        }
+        last = now();
+        if (!count) {
+            lastLatency = last - sent;
+        }
+        count += n;
+    }
+
+    if (!count) {
+        return 0;
+    }
+    if (count < 4 || crc16(reply, count)) {
+        return -1;
+    }
+    return count - 2;
+}
+
+/**
+ * Send a request, CRC appended here, and wait for the reply.
+ * @returns reply length without the CRC, 0 for no reply, -1 for a bad CRC
+ */
+static int transact(int fd, uint8_t *req, int length, uint8_t *reply)
+{
+    uint16_t crc = crc16(req, length);
+
+    req[length++] = crc;
+    req[length++] = crc >> 8;
+    tcflush(fd, TCIFLUSH);
+    if (write(fd, req, length) != length) {
+        return -1;
+    }
+    return receive(fd, reply, now());
+}
+
+/**
+ * Read registers.
+ * @returns 0, the exception code, or -1 for no or a bad reply
+ */
+static int readRegs(int fd, uint8_t slave, uint8_t function, uint16_t start, uint16_t count, uint16_t *values)
+{
+    uint8_t req[8] = { slave, function, start >> 8, start, count >> 8, count };
+    uint8_t reply[256];
+    int length = transact(fd, req, 6, reply);
+
+    if (length == 3 && reply[1] == (function | 0x80)) {
+        return reply[2];
+    }
+    if (length != 3 + 2 * count || reply[1] != function || reply[2] != 2 * count) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        values[i] = (reply[3 + 2 * i] << 8) | reply[4 + 2 * i];
+    }
+    return 0;
+}
+
+/**
+ * Write holding registers, with function 06 for a single one.
+ * @returns 0, the exception code, or -1 for no or a bad reply
+ */
+static int writeRegs(int fd, uint8_t slave, uint16_t start, uint16_t count, const uint16_t *values)
+{
+    uint8_t req[256] = { slave, MODBUS_WRITE_SINGLE, start >> 8, start };
+    uint8_t reply[256];
+    int length;
+
+    if (count == 1) {
+        req[4] = values[0] >> 8;
+        req[5] = values[0];
+        length = 6;
+    } else {
+        req[1] = MODBUS_WRITE_MULTI;
+        req[4] = count >> 8;
+        req[5] = count;
+        req[6] = 2 * count;
+        for (int i = 0; i < count; i++) {
+            req[7 + 2 * i] = values[i] >> 8;
+            req[8 + 2 * i] = values[i];
+        }
+        length = 7 + 2 * count;
+    }
+
+    length = transact(fd, req, length, reply);
+    if (slave == MODBUS_BROADCAST) {
+        return length == 0 ? 0 : -1;
+    }
+    if (length == 3 && reply[1] == (req[1] | 0x80)) {
+        return reply[2];
+    }
+    return (length == 6 && memcmp(reply, req, 6) == 0) ? 0 : -1;
+}
+
+static int failures;
+
+static void check(bool ok, const char *what)
+{
+    printf("%-44s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) {
+        failures++;
+    }
+}
+
+static int cmpDouble(const void *a, const void *b)
+{
+    return (*(const double *)a > *(const double *)b) - (*(const double *)a < *(const double *)b);
+}
+
+static int test(int fd, uint8_t slave, int polls)
+{
+    uint16_t v[MODBUS_MAX_REGS];
+    uint16_t w[3] = { 1, 2, 3 };
+    uint16_t crcErrors;
+    uint8_t req[8];
+    uint8_t reply[256];
+    double *latency = calloc(polls, sizeof(double));
+    double sum = 0;
+    int done;
+
+    check(readRegs(fd, slave, MODBUS_READ_INPUT, 0, MODBUS_IR_COUNT, v) == 0 &&
+            v[MODBUS_IR_TEMP] == SIM_TEMP && v[MODBUS_IR_ADC2] == SIM_ADC2, "read input registers");
+    check(readRegs(fd, slave, MODBUS_READ_HOLDING, 0, 6, v) == 0 && v[5] == slave, "read holding registers");
+    w[0] = 12;
+    check(writeRegs(fd, slave, 0, 1, w) == 0 &&
+            readRegs(fd, slave, MODBUS_READ_HOLDING, 0, 1, v) == 0 && v[0] == 12, "write single register");
+    w[0] = 1;
+    check(writeRegs(fd, slave, 0, 3, w) == 0 &&
+            readRegs(fd, slave, MODBUS_READ_HOLDING, 0, 3, v) == 0 &&
+            v[0] == 1 && v[1] == 2 && v[2] == 3, "write multiple registers");
+    w[0] = 13;
+    w[1] = 60;
+    check(writeRegs(fd, slave, 0, 2, w) == MODBUS_EX_VALUE &&
+            readRegs(fd, slave, MODBUS_READ_HOLDING, 0, 1, v) == 0 && v[0] == 1,
+            "out of range write refused, nothing written");
+    check(writeRegs(fd, slave, 4, 1, w) == MODBUS_EX_VALUE, "read only register refused");
+    // the registers are refreshed from RTC every second, the write must have reached it
+    w[0] = 23;
+    w[1] = 59;
+    w[2] = 58;
+    check(writeRegs(fd, slave, 0, 3, w) == 0 && usleep(1500000) == 0 &&
+            readRegs(fd, slave, MODBUS_READ_HOLDING, 0, 3, v) == 0 &&
+            v[0] == 23 && v[1] == 59 && v[2] == 58, "time of day set in RTC");
+    check(readRegs(fd, slave, MODBUS_READ_INPUT, MODBUS_IR_COUNT - 1, 2, v) == MODBUS_EX_ADDRESS,
+            "read past the last register refused");
+    check(readRegs(fd, slave, MODBUS_READ_HOLDING, 0, MODBUS_MAX_REGS + 1, v) == MODBUS_EX_VALUE,
+            "too many registers refused");
+    check(readRegs(fd, slave, 0x2B, 0, 1, v) == MODBUS_EX_FUNCTION, "unknown function refused");
+    check(readRegs(fd, slave + 1, MODBUS_READ_INPUT, 0, 1, v) == -1, "other slave address ignored");
+
+    readRegs(fd, slave, MODBUS_READ_INPUT, MODBUS_IR_CRC_ERRORS, 1, &crcErrors);
+    memcpy(req, (uint8_t[]){ slave, MODBUS_READ_INPUT, 0, 0, 0, 1 }, 6);
+    req[6] = 0x12;
+    req[7] = 0x34;
+    check(write(fd, req, 8) == 8 && receive(fd, reply, now()) == 0, "bad CRC ignored");
+    check(readRegs(fd, slave, MODBUS_READ_INPUT, MODBUS_IR_CRC_ERRORS, 1, v) == 0 &&
+            v[0] == crcErrors + 1, "bad CRC counted");
+
+    w[0] = 7;
+    check(writeRegs(fd, MODBUS_BROADCAST, 1, 1, w) == 0 &&
+            readRegs(fd, slave, MODBUS_READ_HOLDING, 1, 1, v) == 0 && v[0] == 7, "broadcast write, no reply");
+
+    for (done = 0; done < polls; done++) {
+        if (readRegs(fd, slave, MODBUS_READ_INPUT, 0, MODBUS_IR_COUNT, v) != 0) {
+            check(false, "latency poll");
+            break;
+        }
+        latency[done] = lastLatency;
+        sum += lastLatency;
+    }
+    if (done) {
+        qsort(latency, done, sizeof(double), cmpDouble);
+        printf("latency over %d polls: min %.2f ms, avg %.2f ms, 99%% %.2f ms, max %.2f ms\n",
+                done, latency[0] * 1000, sum / done * 1000,
+                latency[done * 99 / 100] * 1000, latency[done - 1] * 1000);
+        // the maximum includes the host scheduling the simulated board late
+        check(latency[done * 99 / 100] < 0.005, "latency under 5 ms for 99% of polls");
+    }
+    free(latency);
+
+    return failures ? 1 : 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: modbusmaster <tty> <slave> input|read <start> <count>\n"
+                    "       modbusmaster <tty> <slave> write <start> <value>...\n"
+                    "       modbusmaster <tty> <slave> test [polls]\n"
+                    "<tty> may be sim\n");
+    exit(2);
+}
+
+static pid_t boardPid;
+
+static int openLink(const char *spec, uint8_t slave)
+{
+    int fd;
+
+    if (strcmp(spec, "sim") != 0) {
+        fd = open(spec, O_RDWR | O_NOCTTY);
+        if (fd < 0) {
+            perror(spec);
+            return -1;
+        }
+        rawMode(fd);
+        return fd;
+    }
+
+    fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+        perror("pty");
+        return -1;
+    }
+    rawMode(fd);
+
+    boardPid = fork();
+    if (boardPid == 0) {
+        int slaveFd = open(ptsname(fd), O_RDWR | O_NOCTTY);
+
+        close(fd);
+        rawMode(slaveFd);
+        modbus_address = slave;
+        board(slaveFd);
+    }
+    return fd;
+}
+
+int main(int argc, char **argv)
+{
+    uint16_t values[MODBUS_MAX_REGS];
+    uint8_t slave;
+    int count;
+    int fd;
+    int rc;
+
+    if (argc < 4) {
+        usage();
+    }
+    slave = atoi(argv[2]);
+    if ((fd = openLink(argv[1], slave)) < 0) {
+        return 1;
+    }
+
+    if (strcmp(argv[3], "test") == 0) {
+        rc = test(fd, slave, argc > 4 ? atoi(argv[4]) : 1000) ? -2 : 0;
+    } else if ((strcmp(argv[3], "input") == 0 || strcmp(argv[3], "read") == 0) && argc == 6) {
+        count = atoi(argv[5]);
+        if (count < 1 || count > MODBUS_MAX_REGS) {
+            usage();
+        }
+        rc = readRegs(fd, slave, argv[3][0] == 'i' ? MODBUS_READ_INPUT : MODBUS_READ_HOLDING,
+                atoi(argv[4]), count, values);
+        for (int i = 0; !rc && i < count; i++) {
+            printf("%d: %u\n", atoi(argv[4]) + i, values[i]);
+        }
+    } else if (strcmp(argv[3], "write") == 0 && argc > 5 && argc - 5 <= MODBUS_MAX_REGS) {
+        for (int i = 5; i < argc; i++) {
+            values[i - 5] = atoi(argv[i]);
+        }
+        rc = writeRegs(fd, slave, atoi(argv[4]), argc - 5, values);
+    } else {
+        usage();
+    }
+    if (rc > 0) {
+        fprintf(stderr, "exception %d\n", rc);
+    } else if (rc == -1) {
+        fprintf(stderr, "no reply\n");
+    }
+
+    if (boardPid > 0) {
+        kill(boardPid, SIGTERM);
+        waitpid(boardPid, NULL, 0);
+    }
+    return rc ? 1 : 0;
+}
@@ -0,0 +1,453 @@
+/*
+ * rs485poll.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/*
+ * Bus master for counters on a multi-drop RS-485 bus, see rs485.h.
+ *
+ *   rs485poll <tty> <first> <last> [cycles]   poll nodes first..last
+ *   rs485poll sim <nodes> [cycles]            poll simulated nodes 1..nodes
+ *
+ * Every cycle one node is also selected and sent a REPORT_LINK_STATS frame,
+ * then every node is polled once and its frames are collected up to the end
+ * of turn ack. The poll cycle time, frames, timeouts and, in sim mode,
+ * collisions are reported at the end.
+ *
+ * On a real bus the ninth bit is sent as mark/space parity (CMSPAR). A <tty>
+ * of "sim" instead forks one child per node, each running the firmware
+ * rs485.c on its own pty, with TIMER1, the USART interrupts and 38400 baud
+ * character times driven from the host clock. Everything the master writes
+ * goes to all of them, as on the cable. On a pty the ninth bit is carried
+ * in band: 0xFF a is address character a, 0xFF 0xFF is data 0xFF.
+ *
+ * Build: gcc -O2 -Wall -Ihost -o rs485poll rs485poll.c
+ */
+
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+ * Simulated node: register stand-ins and firmware hooks
+ */
+
+static volatile uint8_t PRR, TIMSK1, TIFR1, TCCR1A, TCCR1B;
+static volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UDR0, PORTE, DDRE;
+static volatile uint16_t TCNT1, OCR1B;
+#define MPCM0   0
+#define U2X0    1
+#define UCSZ02  2
+#define UCSZ00  1
+#define UDRIE0  5
+#define TXCIE0  6
+#define PRTIM1  3
+#define CS10    0
+#define CS11    1
+#define OCF1B   2
+#define OCIE1B  2
+
+#define RS485_ENABLE 1
+#include "../003_AVR_RAVEN_Licznik_Czasu_Paszociagu_mkII/rs485.c"
+
+// from main.h
+#define SEND_TEMP           0x80
+#define REPORT_LINK_STATS   0xC8
+
+#define CHAR_TIME   (11 / 38400.0)  // start, 9 data bits, stop
+#define SIM_PERIOD  0.05            // a node queues a SEND_TEMP frame this often
+#define ESC         0xFF
+
+t_ring txbuf;
+
+void uart_init(void)
+{
+    ring_init(&txbuf);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// TIMER1 at 8us per tick
+static uint16_t timer1(void)
+{
+    return (uint16_t)(now() * 125000);
+}
+
+static void node(int fd, uint8_t address)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    struct timespec tick = { 0, 20000 };
+    uint8_t frame[] = { SOF_CHAR, 2, SEND_TEMP, '2', '1', EOF_CHAR };
+    uint8_t buf[256];
+    bool escaped = false;
+    double nextChar = 0;
+    double nextFrame = now();
+    unsigned received = 0;
+    unsigned filtered = 0;
+    unsigned frames = 0;
+    unsigned driverErrors = 0;
+
+    rs485_init();
+    rs485_set_address(address);
+    for (;;) {
+        if (ppoll(&pfd, 1, &tick, NULL) > 0) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+
+            if (n <= 0) {
+                break;
+            }
+            for (ssize_t i = 0; i < n; i++) {
+                if (!escaped && buf[i] == ESC) {
+                    escaped = true;
+                    continue;
+                }
+                TCNT1 = timer1();
+                if (escaped && buf[i] != ESC) {
+                    rs485_rx_address(buf[i]);
+                } else if (UCSR0A & (1 << MPCM0)) {
+                    filtered++;     // no interrupt in multi-processor mode
+                } else {
+                    received++;
+                }
+                escaped = false;
+            }
+        }
+
+        TCNT1 = timer1();
+        if ((TIMSK1 & (1 << OCIE1B)) && (int16_t)(TCNT1 - OCR1B) >= 0) {
+            TIMER1_COMPB_vect();
+            nextChar = now();
+        }
+
+        // USART data register empty, one character per character time
+        if ((UCSR0B & (1 << UDRIE0)) && now() >= nextChar) {
+            if (!(PORTE & (1 << RS485_DE_BIT))) {
+                driverErrors++;
+            }
+            if (rs485_tx_char()) {
+                uint8_t out[2] = { ESC, UDR0 };
+
+                if (write(fd, UDR0 == ESC ? out : out + 1, UDR0 == ESC ? 2 : 1) < 0) {
+                    break;
+                }
+                nextChar += CHAR_TIME;
+            } else {
+                // TX complete
+                UCSR0B &= ~(1 << UDRIE0);
+                rs485_de_off();
+            }
+        }
+
+        // the application keeps queueing frames, they wait for a poll
+        if (now() >= nextFrame) {
+            nextFrame += SIM_PERIOD;
+            if (ring_free(&txbuf) >= sizeof(frame)) {
+                ring_write(&txbuf, frame, sizeof(frame));
+                frames++;
+            }
+        }
+    }
+
+    fprintf(stderr, "node %3u: %u polls, %u frames queued, %u characters received, "
+            "%u filtered by MPCM, %u sent without DE\n",
+            address, rs485_polls, frames, received, filtered, driverErrors);
+    exit(0);
+}
+
+/*
+ * Master
+ */
+
+#define REPLY_TIMEOUT 0.05
+#define MAX_NODES     RS485_ADDR_MAX
+
+static bool sim;
+static int nodes;
+static int busFd[MAX_NODES + 1];   // sim: one pty per node, index is the address
+static pid_t nodePid[MAX_NODES + 1];
+
+static void rawMode(int fd, bool mark)
+{
+    struct termios tio;
+
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetspeed(&tio, B38400);
+        if (!sim) {
+            // the ninth bit as stick parity, mark for address characters
+            tio.c_cflag |= PARENB | CMSPAR;
+            if (mark) {
+                tio.c_cflag |= PARODD;
+            }
+        }
+        tcsetattr(fd, TCSADRAIN, &tio);
+    }
+}
+
+static void pace(int length)
+{
+    struct timespec ts = { 0, (long)(length * CHAR_TIME * 1e9) };
+
+    nanosleep(&ts, NULL);
+}
+
+static void busWrite(const uint8_t *data, int length)
+{
+    uint8_t out[512];
+    int n = 0;
+
+    if (!sim) {
+        if (write(busFd[0], data, length) != length) {
+            perror("write");
+        }
+        return;
+    }
+    for (int i = 0; i < length; i++) {
+        if (data[i] == ESC) {
+            out[n++] = ESC;
+        }
+        out[n++] = data[i];
+    }
+    for (int a = 1; a <= nodes; a++) {
+        if (write(busFd[a], out, n) != n) {
+            perror("write");
+        }
+    }
+    pace(length);
+}
+
+static void busAddress(uint8_t ch)
+{
+    uint8_t out[2] = { ESC, ch };
+
+    if (!sim) {
+        rawMode(busFd[0], true);
+        if (write(busFd[0], &ch, 1) != 1) {
+            perror("write");
+        }
+        rawMode(busFd[0], false);
+        return;
+    }
+    for (int a = 1; a <= nodes; a++) {
+        if (write(busFd[a], out, 2) != 2) {
+            perror("write");
+        }
+    }
+    pace(1);
+}
+
+static void selectNode(uint8_t address, uint8_t cmd, const uint8_t *payload, uint8_t length)
+{
+    uint8_t frame[64] = { SOF_CHAR, length, cmd };
+
+    memcpy(&frame[3], payload, length);
+    frame[3 + length] = EOF_CHAR;
+    busAddress(address);
+    busWrite(frame, length + 4);
+}
+
+static unsigned collisions;
+
+/**
+ * Poll a node and collect its frames up to the end of turn.
+ * @returns frames received, -1 on a timeout
+ */
+static int pollNode(uint8_t address)
+{
+    int fd = sim ? busFd[address] : busFd[0];
+    struct pollfd pfd[MAX_NODES];
+    uint8_t frame[UART_MAX_PAYLOAD + 4];
+    double limit = now() + REPLY_TIMEOUT;
+    bool escaped = false;
+    int watch = sim ? nodes : 1;
+    int count = 0;
+    int frames = 0;
+
+    busAddress(RS485_POLL | address);
+
+    for (int i = 0; i < watch; i++) {
+        pfd[i].fd = sim ? busFd[i + 1] : fd;
+        pfd[i].events = POLLIN;
+    }
+    while (now() < limit) {
+        if (poll(pfd, watch, 1) <= 0) {
+            continue;
+        }
+        for (int w = 0; w < watch; w++) {
+            uint8_t buf[256];
+            ssize_t n;
+
+            if (!(pfd[w].revents & POLLIN) || (n = read(pfd[w].fd, buf, sizeof(buf))) <= 0) {
+                continue;
+            }
+            if (pfd[w].fd != fd) {
+                collisions++;
+                continue;
+            }
+            // the other nodes hear the reply on the cable too
+            for (int a = 1; sim && a <= nodes; a++) {
+                if (a != address && write(busFd[a], buf, n) != n) {
+                    perror("write");
+                }
+            }
+            for (ssize_t i = 0; i < n; i++) {
+                if (sim && !escaped && buf[i] == ESC) {
+                    escaped = true;
+                    continue;
+                }
+                escaped = false;
+                if (count == 0 && buf[i] != SOF_CHAR) {
+                    continue;
+                }
+                frame[count++] = buf[i];
+                // the ack frame has no cmd, others SOF, length, cmd, payload, EOF
+                if (count >= 3 && frame[1] >= 0x80 && buf[i] == EOF_CHAR) {
+                    return frames;
+                }
+                if (count >= 2 && frame[1] < 0x80 &&
+                    (frame[1] > UART_MAX_PAYLOAD || count == frame[1] + 4)) {
+                    frames += frame[count - 1] == EOF_CHAR;
+                    count = 0;
+                }
+            }
+        }
+    }
+    return -1;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: rs485poll <tty> <first> <last> [cycles]\n"
+                    "       rs485poll sim <nodes> [cycles]\n");
+    exit(2);
+}
+
+static int openSim(void)
+{
+    for (int a = 1; a <= nodes; a++) {
+        int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+        if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+            perror("pty");
+            return -1;
+        }
+        rawMode(fd, false);
+        busFd[a] = fd;
+
+        nodePid[a] = fork();
+        if (nodePid[a] == 0) {
+            int slaveFd = open(ptsname(fd), O_RDWR | O_NOCTTY);
+
+            for (int b = 1; b <= a; b++) {
+                close(busFd[b]);
+            }
+            rawMode(slaveFd, false);
+            node(slaveFd, a);
+        }
+    }
+    // let the nodes start up
+    usleep(100000);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int first = 1;
+    int last;
+    int cycles;
+    unsigned frames = 0;
+    unsigned timeouts = 0;
+    double minCycle = 1e9, maxCycle = 0, sumCycle = 0;
+
+    if (argc < 3) {
+        usage();
+    }
+    sim = strcmp(argv[1], "sim") == 0;
+    if (sim) {
+        last = nodes = atoi(argv[2]);
+        cycles = argc > 3 ? atoi(argv[3]) : 100;
+    } else {
+        if (argc < 4) {
+            usage();
+        }
+        first = atoi(argv[2]);
+        last = atoi(argv[3]);
+        cycles = argc > 4 ? atoi(argv[4]) : 100;
+    }
+    if (first < 1 || last < first || last > MAX_NODES || cycles < 1) {
+        usage();
+    }
+
+    if (sim) {
+        if (openSim() < 0) {
+            return 1;
+        }
+    } else {
+        busFd[0] = open(argv[1], O_RDWR | O_NOCTTY);
+        if (busFd[0] < 0) {
+            perror(argv[1]);
+            return 1;
+        }
+        rawMode(busFd[0], false);
+    }
+
+    for (int c = 0; c < cycles; c++) {
+        uint8_t page[1] = { 0 };
+        double start = now();
+
+        selectNode(first + c % (last - first + 1), REPORT_LINK_STATS, page, sizeof(page));
+        for (int a = first; a <= last; a++) {
+            int n = pollNode(a);
+
+            if (n < 0) {
+                timeouts++;
+            } else {
+                frames += n;
+            }
+        }
+
+        double cycle = now() - start;
+        sumCycle += cycle;
+        if (cycle < minCycle) {
+            minCycle = cycle;
+        }
+        if (cycle > maxCycle) {
+            maxCycle = cycle;
+        }
+    }
+
+    printf("%d nodes, %d cycles: poll cycle min %.2f ms, avg %.2f ms, max %.2f ms\n",
+           last - first + 1, cycles, minCycle * 1e3, sumCycle / cycles * 1e3, maxCycle * 1e3);
+    printf("%u frames collected, %u timeouts", frames, timeouts);
+    if (sim) {
+        printf(", %u collisions", collisions);
+    }
+    printf("\n");
+    fflush(stdout);
+
+    for (int a = 1; sim && a <= nodes; a++) {
+        close(busFd[a]);
+        waitpid(nodePid[a], NULL, 0);
+    }
+    return timeouts || collisions ? 1 : 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * rtcsim.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/*
+ * Checks the firmware rtc_stamp()/rtc_ticks() against a cycle model of the
+ * asynchronous TIMER2 and its overflow interrupt.
+ *
+ *   rtcsim [trials]
+ *
+ * Every trial starts the CPU a little before a TCNT2 overflow and reads
+ * timestamps back to back, a few cycles apart, until well past it. The
+ * overflow interrupt runs whenever interrupts are on and the flag is up,
+ * so reads race it from every side. Each read must not go back and must be
+ * within a tick of the model time. total_sec starts anywhere, including
+ * just before rtc_stamp() wraps.
+ *
+ * TCNT2 and TOV2 cross from the 32768 Hz domain through synchronizers, so
+ * the trials are repeated with the flag showing up from 3 cycles before to
+ * 30 cycles after the new TCNT2 value. rtc.c polls the flag for at least
+ * 32 cycles, which covers all of them, and any read that goes back or is
+ * off fails the run. A plain read of total_sec and TCNT2, without the
+ * flag, runs alongside to show the race being covered.
+ *
+ * Build: gcc -O2 -Wall -Ihost -o rtcsim rtcsim.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+/*
+ * Simulated board: TIMER2, the overflow interrupt and the interrupt enable
+ */
+
+#define CPU_HZ          8000000
+#define TICK_CYCLES     (CPU_HZ / 256)      // CPU cycles per TCNT2 step
+#define ISR_CYCLES      60                  // overflow interrupt, entry to reti
+
+#define TOV2 0
+
+static uint64_t cycle;              // CPU clock
+static uint64_t phase;              // cycle TCNT2 last read 0 before the trial
+static int countLag;                // cycles from the TOSC edge until TCNT2 shows it
+static int flagLag;                 // same for TOV2
+static bool irqOn = true;
+static uint64_t overflowsDone;      // overflow interrupts run since phase
+
+// the firmware clock
+#include "../003_AVR_RAVEN_Licznik_Czasu_Paszociagu_mkII/timer.h"
+volatile t_time RTC;
+
+static uint64_t steps(int lag)
+{
+    return (cycle - lag - phase) / TICK_CYCLES;
+}
+
+static bool flagUp(void)
+{
+    return steps(flagLag) / 256 > overflowsDone;
+}
+
+// advance the CPU, taking the interrupt at the instruction boundary
+static void simStep(int cycles)
+{
+    cycle += cycles;
+    while (irqOn && flagUp()) {
+        overflowsDone++;
+        RTC.total_sec++;
+        cycle += ISR_CYCLES;
+    }
+}
+
+static uint8_t simTcnt2(void)
+{
+    uint8_t value;
+
+    simStep(1);
+    value = steps(countLag) & 0xFF;
+    simStep(1);
+    return value;
+}
+
+static uint8_t simTifr2(void)
+{
+    uint8_t value = flagUp() ? (1 << TOV2) : 0;
+
+    simStep(1);
+    return value;
+}
+
+static int simCli(void)
+{
+    irqOn = false;
+    simStep(1);
+    return 1;
+}
+
+static int simSei(void)
+{
+    irqOn = true;
+    simStep(1);
+    return 0;
+}
+
+#define TCNT2 simTcnt2()
+#define TIFR2 simTifr2()
+#define _delay_loop_1(count) simStep(3 * (count))
+
+#include <util/atomic.h>
+#undef ATOMIC_BLOCK
+#define ATOMIC_BLOCK(type) for (int atomicOnce = simCli(); atomicOnce; atomicOnce = simSei())
+
+#include "../003_AVR_RAVEN_Licznik_Czasu_Paszociagu_mkII/rtc.c"
+
+// the read rtc.c replaces, total_sec and TCNT2 without the overflow flag
+static uint64_t plainTicks(void)
+{
+    uint32_t sec;
+    uint8_t count;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        sec = RTC.total_sec;
+        count = TCNT2;
+    }
+    return ((uint64_t)sec << 8) | count;
+}
+
+/*
+ * Trials
+ */
+
+typedef struct {
+    long reads;
+    long backwards;
+    long off;
+} result_t;
+
+// model time in ticks, as rtc_ticks() should read it
+static uint64_t modelTicks(uint32_t secAtPhase)
+{
+    return ((uint64_t)secAtPhase << 8) + steps(0);
+}
+
+#define NO_READ (~0ULL)
+
+// values are compared modulo 2^bits, rtc_stamp() wraps at 32
+static void check(result_t *r, uint64_t value, uint64_t *last, uint32_t secAtPhase, int bits)
+{
+    uint64_t mask = (bits < 64) ? (1ULL << bits) - 1 : ~0ULL;
+    int64_t back = (int64_t)(((value - *last) & mask) << (64 - bits));
+    int64_t ahead = (int64_t)(((value - modelTicks(secAtPhase)) & mask) << (64 - bits));
+
+    r->reads++;
+    if (*last != NO_READ && back < 0) {
+        r->backwards++;
+    }
+    // within a tick behind the model, never ahead
+    if (ahead > 0 || ahead < -(1LL << (64 - bits))) {
+        r->off++;
+    }
+    *last = value;
+}
+
+static void trial(result_t *stamp, result_t *ticks, result_t *plain)
+{
+    uint64_t lastStamp = NO_READ, lastTicks = NO_READ, lastPlain = NO_READ;
+    uint32_t secAtPhase;
+    uint64_t end;
+
+    // TCNT2 just read 0 at phase, the overflow interrupt for it already ran
+    secAtPhase = (rand() & 1) ? (uint32_t)rand() : 0xFFFFFF - (rand() & 3);
+    RTC.total_sec = secAtPhase;
+    phase = 1000000;
+    overflowsDone = 0;
+    irqOn = true;
+
+    // start up to 400 cycles before the next overflow, stop 400 after it
+    end = phase + 256ULL * TICK_CYCLES;
+    cycle = end - 1 - rand() % 400;
+    end += 400;
+
+    while (cycle < end) {
+        switch (rand() % 3) {
+        case 0:
+            check(stamp, rtc_stamp(), &lastStamp, secAtPhase, 32);
+            break;
+        case 1:
+            check(ticks, rtc_ticks(), &lastTicks, secAtPhase, 64);
+            break;
+        default:
+            check(plain, plainTicks(), &lastPlain, secAtPhase, 64);
+            break;
+        }
+        simStep(rand() % 8);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long trials = (argc > 1) ? atol(argv[1]) : 20000;
+    bool failed = false;
+    static const int lags[] = { -3, -2, -1, 0, 1, 2, 3, 6, 9, 12, 15, 20, 25, 30 };
+
+    srand(1);
+    printf("flag lag   rtc_stamp            rtc_ticks            plain read\n");
+    printf("(cycles)   reads  back   off    reads  back   off    reads  back   off\n");
+
+    for (size_t n = 0; n < sizeof(lags) / sizeof(lags[0]); n++) {
+        result_t stamp = { 0 }, ticks = { 0 }, plain = { 0 };
+        int lag = lags[n];
+
+        countLag = 3;
+        flagLag = countLag + lag;
+        for (long i = 0; i < trials; i++) {
+            trial(&stamp, &ticks, &plain);
+        }
+        printf("%+4d     %7ld %5ld %5ld  %7ld %5ld %5ld  %7ld %5ld %5ld\n", lag,
+               stamp.reads, stamp.backwards, stamp.off,
+               ticks.reads, ticks.backwards, ticks.off,
+               plain.reads, plain.backwards, plain.off);
+        if (stamp.backwards || stamp.off || ticks.backwards || ticks.off) {
+            failed = true;
+        }
+    }
+    return failed ? 1 : 0;
+}
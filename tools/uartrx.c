@@ -0,0 +1,537 @@
+/*
+ * uartrx.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/*
+ * Runs the firmware uart_rx_poll() frame parser against generated line
+ * traffic from the 1284p.
+ *
+ *   uartrx [rounds]
+ *
+ * Characters go in through the USART RX interrupt into rxbuf, a few at a
+ * time, and uart_rx_poll() runs after every batch, so frames arrive cut
+ * at every point and rxbuf wraps under the parser's spans. RTC.total_sec
+ * is stepped by hand to run the partial frame timeout.
+ *
+ * Both SOF and COBS framing are checked with whole frames cut every way,
+ * back to back frames, and frames that are cut off, carry a bad length,
+ * command or EOF, or sit in line noise. Every frame must come out of
+ * uart_get_frame() once and intact, and the parser must pick up the next
+ * good frame after each bad one. The random rounds throw noise at the
+ * parser, then check it takes the next frame after a timeout gap. COBS
+ * frames queued for the 1284p must match cobs_encode() wherever they wrap
+ * in txbuf.
+ *
+ * Build: gcc -O2 -Wall -Ihost -o uartrx uartrx.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Simulated board: USART0 registers and the firmware modules around uart.c
+ */
+
+static volatile uint8_t PRR, UCSR0A, UCSR0B, UCSR0C, UDR0;
+static volatile uint16_t UBRR0;
+#define PRUSART0    1
+#define UPE0        2
+#define DOR0        3
+#define FE0         4
+#define TXC0        6
+#define U2X0        1
+#define TXEN0       3
+#define RXEN0       4
+#define UDRIE0      5
+#define TXCIE0      6
+#define RXCIE0      7
+#define UCSZ00      1
+
+#include "../003_AVR_RAVEN_Licznik_Czasu_Paszociagu_mkII/cobs.c"
+#include "../003_AVR_RAVEN_Licznik_Czasu_Paszociagu_mkII/uart.c"
+
+volatile t_time RTC;
+volatile uint8_t sched_events;
+t_sched_stats sched_stats[SCHED_TASK_COUNT];
+uint32_t sched_idle_ticks;
+uint8_t ping_response;
+bool timeout_flag;
+int8_t flashId = -1;
+flashGeometry_t flashGeom[1];
+flashBufStats_t flashBufStats;
+
+void sched_clear_stats(void) {}
+void led_on(void) {}
+void led_off(void) {}
+void beep(uint8_t duration) {}
+void play_ringtone(void) {}
+void dectoascii(uint8_t val, char *str) {}
+int lcd_puts(const char *s) { return 0; }
+void lcd_single_print_dig(uint8_t numb, uint8_t pos) {}
+void lcd_symbol_set(lcd_symbol_t symbol) {}
+void lcd_symbol_clr(lcd_symbol_t symbol) {}
+void bulk_ack(const uint8_t *payload, uint8_t length) {}
+void export_request(const uint8_t *payload, uint8_t length) {}
+void menu_telemetry_mode(const uint8_t *payload, uint8_t length) {}
+void calendar_report_time(const uint8_t *payload, uint8_t length) {}
+uint16_t flashFree(void) { return 0; }
+void runtime_report_lines(const uint8_t *payload, uint8_t length) {}
+
+/*
+ * Line traffic and the frames that came out of the parser
+ */
+
+#define LINE_MAX    4096
+#define GOT_MAX     256
+#define CHUNK_MAX   (3 * UART_FRAME_QUEUE)  // the shortest frame is 3 characters, so a poll queues at most UART_FRAME_QUEUE
+
+static uint8_t line[LINE_MAX];      // characters still to send
+static int lineLen;
+static tuart_frame sent[GOT_MAX];   // good frames on the line, in order
+static int sentCount;
+static tuart_frame got[GOT_MAX];
+static int gotCount;
+
+static int failures;
+
+static void check(bool ok, const char *what)
+{
+    printf("%-44s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) {
+        failures++;
+    }
+}
+
+static void raw(const uint8_t *buf, int length)
+{
+    memcpy(&line[lineLen], buf, length);
+    lineLen += length;
+}
+
+static void expect(uint8_t cmd, const uint8_t *payload, uint8_t length)
+{
+    tuart_frame *f = &sent[sentCount++];
+
+    f->cmd = cmd;
+    f->length = length;
+    memcpy(f->payload, payload, length);
+}
+
+/** SOF, length, cmd, payload, EOF; expected back if good */
+static void sofFrame(uint8_t cmd, const uint8_t *payload, uint8_t length, bool good)
+{
+    uint8_t head[] = { SOF_CHAR, length, cmd };
+    uint8_t tail = EOF_CHAR;
+
+    raw(head, sizeof(head));
+    raw(payload, length);
+    raw(&tail, 1);
+    if (good) {
+        expect(cmd, payload, length);
+    }
+}
+
+static void ackFrame(void)
+{
+    uint8_t buf[] = { SOF_CHAR, 0x80, EOF_CHAR };
+
+    raw(buf, sizeof(buf));
+    expect(NULL_CMD, NULL, 0);
+}
+
+/** COBS(cmd, payload), 0x00; expected back if good */
+static void cobsFrame(uint8_t cmd, const uint8_t *payload, uint8_t length, bool good)
+{
+    uint8_t buf[UART_MAX_PAYLOAD + 3];
+    uint8_t n;
+
+    buf[1] = cmd;
+    memcpy(&buf[2], payload, length);
+    n = cobs_encode(buf, length + 1);
+    buf[n++] = 0;
+    raw(buf, n);
+    if (good) {
+        expect(cmd, payload, length);
+    }
+}
+
+static void drain(void)
+{
+    while (gotCount < GOT_MAX && uart_get_frame(&got[gotCount])) {
+        gotCount++;
+    }
+}
+
+/** The USART receiving one character */
+static void rxChar(uint8_t ch, uint8_t status)
+{
+    UCSR0A = status;
+    UDR0 = ch;
+    USART_RX_vect();
+    UCSR0A = 0;
+}
+
+/**
+ * Send the line, chunk characters between polls.
+ * @param chunk 0 for random chunks of 1..CHUNK_MAX
+ * @param keep leave the frames in the parser queue
+ */
+static void feed(int chunk, bool keep)
+{
+    for (int i = 0; i < lineLen;) {
+        int n = chunk ? chunk : 1 + rand() % CHUNK_MAX;
+
+        for (; n && i < lineLen; n--) {
+            rxChar(line[i++], 0);
+        }
+        uart_rx_poll();
+        if (!keep) {
+            drain();
+        }
+    }
+    lineLen = 0;
+}
+
+/** Let a partial frame time out */
+static void gap(void)
+{
+    RTC.total_sec += UART_RX_TIMEOUT;
+    uart_rx_poll();
+}
+
+static void restart(uint8_t framing)
+{
+    tuart_frame f;
+
+    uart_init();
+    uart_set_link(UART_SPEED_38400, framing);
+    while (uart_get_frame(&f))
+        ;
+    memset((void *)&uart_stats, 0, sizeof(uart_stats));
+    memset(uart_cmd_count, 0, sizeof(uart_cmd_count));
+    uart_cmd_rejected = 0;
+    lineLen = 0;
+    sentCount = 0;
+    gotCount = 0;
+}
+
+/** Every frame sent came back once, in order, and nothing else */
+static bool allBack(void)
+{
+    if (gotCount != sentCount) {
+        return false;
+    }
+    for (int i = 0; i < gotCount; i++) {
+        if (got[i].cmd != sent[i].cmd || got[i].length != sent[i].length ||
+            memcmp(got[i].payload, sent[i].payload, got[i].length) ||
+            pgm_read_byte(&uart_cmd_table[got[i].entry].cmd) != got[i].cmd) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** A frame the command table takes */
+static bool tableValid(const tuart_frame *f)
+{
+    return f->entry < UART_CMD_COUNT &&
+           pgm_read_byte(&uart_cmd_table[f->entry].cmd) == f->cmd &&
+           f->length >= pgm_read_byte(&uart_cmd_table[f->entry].min_len) &&
+           f->length <= pgm_read_byte(&uart_cmd_table[f->entry].max_len);
+}
+
+static uint16_t errors(void)
+{
+    uint16_t sum = uart_stats.rx_bad_frame;
+
+    for (int i = 0; i < RX_STATE_COUNT; i++) {
+        sum += uart_stats.rx_timeout[i];
+    }
+    return sum;
+}
+
+/** A random good frame, payload bytes include SOF, EOF and 0x00 */
+static void randomFrame(uint8_t framing)
+{
+    static const uint8_t pick[] = { 0x00, SOF_CHAR, EOF_CHAR, 0x80, 0xFF };
+    uint8_t payload[UART_MAX_PAYLOAD];
+    uint8_t length = rand() % (UART_MAX_PAYLOAD + 1);
+
+    for (int i = 0; i < length; i++) {
+        payload[i] = (rand() & 1) ? pick[rand() % sizeof(pick)] : rand();
+    }
+    if (framing == UART_FRAMING_COBS) {
+        cobsFrame(REPORT_TEXT_MSG, payload, length, true);
+    } else if (rand() % 8 == 0) {
+        ackFrame();
+    } else {
+        sofFrame(REPORT_TEXT_MSG, payload, length, true);
+    }
+}
+
+/*
+ * SOF framing
+ */
+
+static void testSof(long rounds)
+{
+    static const uint8_t ping[] = { 0x02, SOF_CHAR, EOF_CHAR, 0x00 };
+    uint8_t big[UART_MAX_PAYLOAD + 1];
+    bool ok;
+
+    memset(big, 'x', sizeof(big));
+
+    ok = true;
+    for (int chunk = 1; chunk <= 8; chunk++) {
+        restart(UART_FRAMING_SOF);
+        sofFrame(REPORT_PING, ping, sizeof(ping), true);
+        feed(chunk, false);
+        ok &= allBack() && !errors();
+    }
+    check(ok, "SOF frame cut at every point");
+
+    ok = true;
+    for (long r = 0; r < rounds; r++) {
+        restart(UART_FRAMING_SOF);
+        for (int i = 0; i < 12; i++) {
+            randomFrame(UART_FRAMING_SOF);
+        }
+        sofFrame(REPORT_LINK_SPEED, ping, 2, true);
+        sofFrame(REPORT_WAKE, NULL, 0, true);
+        sofFrame(REPORT_TEXT_MSG, big, UART_MAX_PAYLOAD, true);
+        feed(0, false);
+        ok &= allBack() && !errors() && !uart_cmd_rejected;
+    }
+    check(ok, "SOF back to back frames");
+
+    restart(UART_FRAMING_SOF);
+    for (int i = 0; i < 6; i++) {
+        sofFrame(REPORT_PING, ping, 1, i < UART_FRAME_QUEUE);
+    }
+    feed(RING_SIZE, true);
+    drain();
+    check(allBack() && uart_stats.rx_queue_full == 6 - UART_FRAME_QUEUE &&
+          uart_cmd_count[UART_CMD_ENTRY_REPORT_PING] == 6, "SOF frames past a full queue counted");
+
+    ok = true;
+    for (int cut = 1; cut < 4 + (int)sizeof(ping); cut++) {
+        restart(UART_FRAMING_SOF);
+        sofFrame(REPORT_PING, ping, sizeof(ping), false);
+        lineLen = cut;
+        feed(1, false);
+        uart_rx_poll();
+        ok &= !gotCount && rx_state != RX_STATE_SOF;
+        gap();
+        ok &= rx_state == RX_STATE_SOF && errors() == 1;
+        sofFrame(REPORT_PING, ping, sizeof(ping), true);
+        feed(1, false);
+        ok &= allBack();
+    }
+    check(ok, "SOF partial frame times out");
+
+    restart(UART_FRAMING_SOF);
+    sofFrame(REPORT_PING, ping, sizeof(ping), true);
+    for (int i = 0; i < lineLen; i++) {
+        rxChar(line[i], 0);
+        uart_rx_poll();
+        RTC.total_sec += UART_RX_TIMEOUT - 1;
+    }
+    lineLen = 0;
+    drain();
+    check(allBack() && !errors(), "SOF slow frame kept");
+
+    restart(UART_FRAMING_SOF);
+    sofFrame(REPORT_PING, ping, sizeof(ping), false);
+    line[lineLen - 1] = 'x';
+    sofFrame(REPORT_PING, ping, sizeof(ping), true);
+    line[lineLen++] = SOF_CHAR; // ack frame, the next SOF in place of EOF
+    line[lineLen++] = 0x80;
+    line[lineLen++] = SOF_CHAR;
+    sofFrame(REPORT_WAKE, NULL, 0, true);
+    feed(0, false);
+    check(allBack() && uart_stats.rx_bad_frame == 2, "SOF frame without EOF dropped");
+
+    restart(UART_FRAMING_SOF);
+    sofFrame(REPORT_TEXT_MSG, big, sizeof(big), false);
+    sofFrame(REPORT_PING, ping, sizeof(ping), true);
+    feed(0, false);
+    check(allBack() && !errors(), "SOF length over UART_MAX_PAYLOAD skipped");
+
+    restart(UART_FRAMING_SOF);
+    sofFrame(0x55, ping, 2, false);
+    sofFrame(REPORT_LINK_SPEED, ping, 3, false);
+    sofFrame(REPORT_PING, NULL, 0, false);
+    sofFrame(REPORT_PING, ping, sizeof(ping), true);
+    feed(0, false);
+    check(allBack() && uart_cmd_rejected == 3 && !errors(), "SOF unknown command and bad length rejected");
+
+    ok = true;
+    for (long r = 0; r < rounds; r++) {
+        uint8_t noise[32];
+
+        restart(UART_FRAMING_SOF);
+        for (int i = 0; i < 8; i++) {
+            for (int j = 0; j < (int)sizeof(noise); j++) {
+                noise[j] = SOF_CHAR + 1 + rand() % 0xFE;
+            }
+            raw(noise, rand() % sizeof(noise));
+            randomFrame(UART_FRAMING_SOF);
+        }
+        feed(0, false);
+        ok &= allBack() && !errors();
+    }
+    check(ok, "SOF frames between line noise");
+
+    ok = true;
+    for (long r = 0; r < rounds; r++) {
+        uint8_t noise[64];
+        int n = rand() % sizeof(noise);
+        int kept = 0;
+
+        restart(UART_FRAMING_SOF);
+        for (int j = 0; j < n; j++) {
+            noise[j] = (rand() & 3) ? rand() : SOF_CHAR;
+        }
+        raw(noise, n);
+        feed(0, false);
+        for (int i = 0; i < gotCount; i++) {
+            ok &= tableValid(&got[i]);
+        }
+        kept = gotCount;
+        gap();
+        gotCount = 0;
+        randomFrame(UART_FRAMING_SOF);
+        feed(0, false);
+        ok &= allBack() && kept <= n / 3;
+    }
+    check(ok, "SOF random noise, then a frame after a gap");
+
+    restart(UART_FRAMING_SOF);
+    rxChar('x', (1 << FE0));
+    rxChar('x', (1 << DOR0));
+    sofFrame(REPORT_PING, ping, sizeof(ping), true);
+    feed(0, false);
+    check(allBack() && uart_stats.rx_frame_err == 1 && uart_stats.rx_overrun == 1,
+          "SOF line errors counted");
+}
+
+/*
+ * COBS framing
+ */
+
+static void testCobs(long rounds)
+{
+    static const uint8_t zeros[] = { 0x00, 0x00, 0x01, 0x00 };
+    static const uint8_t idle[] = { 0x00, 0x00, 0x00 };
+    uint8_t big[UART_MAX_PAYLOAD + 1];
+    bool ok;
+
+    memset(big, 'x', sizeof(big));
+
+    ok = true;
+    for (int chunk = 1; chunk <= 8; chunk++) {
+        restart(UART_FRAMING_COBS);
+        cobsFrame(REPORT_PING, zeros, sizeof(zeros), true);
+        feed(chunk, false);
+        ok &= allBack() && !errors();
+    }
+    check(ok, "COBS frame cut at every point");
+
+    ok = true;
+    for (long r = 0; r < rounds; r++) {
+        restart(UART_FRAMING_COBS);
+        for (int i = 0; i < 12; i++) {
+            randomFrame(UART_FRAMING_COBS);
+            if (rand() & 1) {
+                raw(idle, 1 + rand() % sizeof(idle));
+            }
+        }
+        feed(0, false);
+        ok &= allBack() && !errors() && !uart_cmd_rejected;
+    }
+    check(ok, "COBS back to back frames and idle line");
+
+    restart(UART_FRAMING_COBS);
+    cobsFrame(REPORT_PING, zeros, sizeof(zeros), false);
+    line[0] = 0xFE;             // code past the delimiter
+    cobsFrame(REPORT_PING, zeros, sizeof(zeros), true);
+    line[lineLen++] = 0x01;     // code byte alone
+    line[lineLen++] = 0x00;
+    cobsFrame(REPORT_WAKE, NULL, 0, true);
+    feed(0, false);
+    check(allBack() && uart_stats.rx_bad_frame == 2, "COBS corrupted block dropped");
+
+    restart(UART_FRAMING_COBS);
+    cobsFrame(REPORT_TEXT_MSG, big, sizeof(big), false);
+    for (int i = 0; i < 300; i++) {
+        line[lineLen++] = 'x';
+    }
+    line[lineLen++] = 0x00;
+    cobsFrame(REPORT_PING, zeros, sizeof(zeros), true);
+    feed(0, false);
+    check(allBack() && uart_stats.rx_bad_frame == 2, "COBS overlong block dropped");
+
+    restart(UART_FRAMING_COBS);
+    cobsFrame(0x55, zeros, 2, false);
+    cobsFrame(REPORT_BULK_ACK, zeros, 3, false);
+    cobsFrame(REPORT_PING, zeros, sizeof(zeros), true);
+    feed(0, false);
+    check(allBack() && uart_cmd_rejected == 2 && !errors(), "COBS unknown command and bad length rejected");
+
+    restart(UART_FRAMING_COBS);
+    for (int i = 0; i < UART_LINK_MAX_ERRORS; i++) {
+        cobsFrame(REPORT_PING, zeros, sizeof(zeros), false);
+        line[lineLen - 2] = 0x7F;   // last code byte points past the delimiter
+    }
+    feed(0, false);
+    ok = link_framing == UART_FRAMING_SOF;
+    sofFrame(REPORT_PING, zeros, sizeof(zeros), true);
+    feed(0, false);
+    check(ok && allBack() && uart_stats.rx_bad_frame == UART_LINK_MAX_ERRORS,
+          "COBS link falls back to SOF on errors");
+
+    ok = true;
+    for (long r = 0; r < rounds; r++) {
+        uint8_t payload[RING_SIZE - 3];
+        uint8_t want[RING_SIZE];
+        uint8_t length = rand() % (sizeof(payload) + 1);
+        uint8_t cmd = (rand() & 3) ? SEND_TELEMETRY : 0;
+        uint8_t n;
+
+        restart(UART_FRAMING_COBS);
+        txbuf.head = txbuf.tail = rand();
+        for (int i = 0; i < length; i++) {
+            payload[i] = (rand() & 3) ? rand() : 0;
+        }
+        want[1] = cmd;
+        memcpy(&want[2], payload, length);
+        n = cobs_encode(want, length + 1);
+        want[n++] = 0;
+        ok &= uart_queue_frame(cmd, length, payload) && ring_count(&txbuf) == n;
+        for (int i = 0; ok && i < n; i++) {
+            ok &= ring_get(&txbuf) == want[i];
+        }
+    }
+    check(ok, "COBS frames encoded into txbuf");
+}
+
+int main(int argc, char **argv)
+{
+    long rounds = (argc > 1) ? atol(argv[1]) : 2000;
+
+    if (rounds <= 0) {
+        fprintf(stderr, "usage: uartrx [rounds]\n");
+        return 2;
+    }
+
+    srand(1);
+    testSof(rounds);
+    testCobs(rounds);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * wakesim.c
+ *
+ *  Created on: 19 paz 2026
+ *      Author: G505s
+ */
+
+/*
+ * Charge model of the 3290p side of the 1284p wake handshake, the old
+ * SEND_WAKE flood against the sleep_wakeup() backoff.
+ *
+ *   wakesim [trials]
+ *
+ * The 1284p sleeps in 1 s cycles and answers the first SEND_WAKE that lands
+ * after it wakes, so every trial picks its wake time uniformly within one
+ * cycle. The flood sends a frame and busy waits 1 ms, over and over, the
+ * UART keeping it from going faster than a frame time. The backoff follows
+ * sleep_wakeup() with the WAKE_* constants from sleep.h: queue a frame,
+ * idle sleep, double the wait, give up after WAKE_TIMEOUT ms. The answer
+ * takes another millisecond either way.
+ *
+ * The currents are for the 3290p at 8 MHz and 3 V, the line runs at
+ * 38400 baud. The last line is a 1284p that never answers.
+ *
+ * At the default 10000 trials:
+ *
+ *   flood      498.7 ms   1645.6 uC   477.7 frames   worst 1001.0 ms
+ *   backoff    558.4 ms    504.0 uC    10.3 frames   worst 1024.0 ms
+ *   dead      backoff gives up after 4094 ms, 3690 uC, 37 frames
+ *
+ * Build: gcc -O2 -Wall -Ihost -o wakesim wakesim.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../003_AVR_RAVEN_Licznik_Czasu_Paszociagu_mkII/sleep.h"
+
+#define ACTIVE_MA       3.3                     // CPU running
+#define IDLE_MA         0.9                     // idle sleep, UART and TIMER1 on
+#define FRAME_MS        (4 * 10 / 38400.0 * 1000)   // SEND_WAKE, 4 bytes of 10 bits
+#define QUEUE_MS        0.06                    // active time to queue a frame and run the TX ISRs
+#define ANSWER_MS       1.0                     // REPORT_WAKE coming back
+#define CYCLE_MS        1000.0                  // 1284p sleep cycle
+
+typedef struct {
+    double ms;          // until the answer is in
+    double uC;          // charge spent on the way
+    long frames;        // SEND_WAKE frames sent
+    bool answered;
+} wake_t;
+
+/** @param awake ms until the 1284p listens */
+static wake_t flood(double awake)
+{
+    wake_t w = { 0, 0, 0, true };
+
+    for (;;) {
+        w.frames++;
+        w.ms += 1.0;
+        if (w.ms < w.frames * FRAME_MS) {
+            w.ms = w.frames * FRAME_MS;
+        }
+        if (w.ms >= awake) {
+            break;
+        }
+    }
+    w.ms += ANSWER_MS;
+    w.uC = w.ms * ACTIVE_MA;
+    return w;
+}
+
+/** @param awake ms until the 1284p listens */
+static wake_t backoff(double awake)
+{
+    wake_t w = { 0, 0, 0, false };
+    uint16_t wait = WAKE_BACKOFF_FIRST;
+    uint16_t waited = 0;
+    double active = 0;
+
+    while (waited < WAKE_TIMEOUT) {
+        w.frames++;
+        active += QUEUE_MS;
+        if (w.ms + FRAME_MS >= awake) {
+            // the frame lands after the 1284p woke, its answer ends the idle sleep
+            w.ms += FRAME_MS + ANSWER_MS;
+            w.answered = true;
+            break;
+        }
+        w.ms += wait;
+        waited += wait;
+        if (wait < WAKE_BACKOFF_MAX) {
+            wait <<= 1;
+        }
+    }
+    w.uC = active * ACTIVE_MA + (w.ms - active) * IDLE_MA;
+    return w;
+}
+
+static void report(const char *name, wake_t (*mode)(double), long trials)
+{
+    double ms = 0, uC = 0, frames = 0, worst = 0;
+
+    srand(1);
+    for (long i = 0; i < trials; i++) {
+        wake_t w = mode(CYCLE_MS * rand() / ((double)RAND_MAX + 1));
+
+        ms += w.ms;
+        uC += w.uC;
+        frames += w.frames;
+        if (w.ms > worst) {
+            worst = w.ms;
+        }
+    }
+    printf("%-8s  %6.1f ms  %7.1f uC  %6.1f frames   worst %6.1f ms\n", name,
+           ms / trials, uC / trials, frames / trials, worst);
+}
+
+int main(int argc, char **argv)
+{
+    long trials = (argc > 1) ? atol(argv[1]) : 10000;
+    wake_t dead;
+
+    if (trials <= 0) {
+        fprintf(stderr, "usage: wakesim [trials]\n");
+        return 2;
+    }
+
+    report("flood", flood, trials);
+    report("backoff", backoff, trials);
+
+    // the flood never stops for a dead 1284p
+    dead = backoff(1e9);
+    printf("dead      backoff gives up after %.0f ms, %.0f uC, %ld frames\n",
+           dead.ms, dead.uC, dead.frames);
+    return dead.answered ? 1 : 0;
+}